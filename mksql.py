@@ -21,6 +21,7 @@ TARGETS = (
     "urban",
     "station",
     "line",
+    "alias_line",
     "city",
     "kilo",
     "fare",
@@ -28,6 +29,15 @@ TARGETS = (
     "fare_special",
     )
 
+# Columns to add normalized search keys.
+# The key of column 'foo' is stored in 'fookey'.
+SEARCH_KEYS = (
+    ("station", "stationname"),
+    ("station", "stationyomi"),
+    ("line", "linename"),
+    ("line", "lineyomi"),
+    )
+
 
 class CSVParseException(Exception):
     pass
@@ -187,6 +197,95 @@ def mktable_from_csv(db, tablename, filename = None):
     return
 
 
+# Small ka and ke in names such as Komagatake are read as normal ones.
+SEARCH_KEY_KANA = {
+    u"\u30f5": u"\u304b", u"\u30f6": u"\u3051",
+    u"\u3095": u"\u304b", u"\u3096": u"\u3051",
+    }
+
+# Half-width katakana from U+FF61 to U+FF9D.
+HALFWIDTH_KANA = (u"\u3002\u300c\u300d\u3001\u30fb\u30f2"
+                  u"\u30a1\u30a3\u30a5\u30a7\u30a9\u30e3\u30e5\u30e7\u30c3"
+                  u"\u30fc\u30a2\u30a4\u30a6\u30a8\u30aa"
+                  u"\u30ab\u30ad\u30af\u30b1\u30b3\u30b5\u30b7\u30b9\u30bb\u30bd"
+                  u"\u30bf\u30c1\u30c4\u30c6\u30c8\u30ca\u30cb\u30cc\u30cd\u30ce"
+                  u"\u30cf\u30d2\u30d5\u30d8\u30db\u30de\u30df\u30e0\u30e1\u30e2"
+                  u"\u30e4\u30e6\u30e8\u30e9\u30ea\u30eb\u30ec\u30ed\u30ef\u30f3")
+
+FULLWIDTH_SIGNS = {
+    u"\u3000": u" ",
+    u"\uff9e": u"\u3099", u"\uff9f": u"\u309a",
+    u"\uffe0": u"\xa2", u"\uffe1": u"\xa3", u"\uffe2": u"\xac",
+    u"\uffe4": u"\xa6", u"\uffe5": u"\xa5", u"\uffe6": u"\u20a9",
+    }
+
+VOICED_KANA = (u"\u304b\u304d\u304f\u3051\u3053\u3055\u3057\u3059\u305b\u305d"
+               u"\u305f\u3061\u3064\u3066\u3068\u306f\u3072\u3075\u3078\u307b"
+               u"\u30ab\u30ad\u30af\u30b1\u30b3\u30b5\u30b7\u30b9\u30bb\u30bd"
+               u"\u30bf\u30c1\u30c4\u30c6\u30c8\u30cf\u30d2\u30d5\u30d8\u30db")
+VOICED_OTHERS = {
+    u"\u3046": u"\u3094", u"\u30a6": u"\u30f4",
+    u"\u309d": u"\u309e", u"\u30fd": u"\u30fe",
+    u"\u30ef": u"\u30f7", u"\u30f0": u"\u30f8",
+    u"\u30f1": u"\u30f9", u"\u30f2": u"\u30fa",
+    }
+SEMIVOICED_KANA = u"\u306f\u3072\u3075\u3078\u307b\u30cf\u30d2\u30d5\u30d8\u30db"
+
+
+# Fold full-width ASCII and half-width katakana as NFKC does.
+# Other compatibility characters such as circled digits are kept.
+def unify_width(c):
+    if u"\uff01" <= c <= u"\uff5e": return unichr(ord(c) - 0xfee0)
+    if u"\uff61" <= c <= u"\uff9d": return HALFWIDTH_KANA[ord(c) - 0xff61]
+    return FULLWIDTH_SIGNS.get(c, c)
+
+
+# Compose kana and a combining voiced or semi-voiced sound mark.
+def compose_kana(base, mark):
+    if mark == u"\u3099":
+        if base in VOICED_KANA: return unichr(ord(base) + 1)
+        return VOICED_OTHERS.get(base)
+    if mark == u"\u309a" and base in SEMIVOICED_KANA:
+        return unichr(ord(base) + 2)
+    return None
+
+
+# Normalize a string to search without distinction of
+# katakana and hiragana, full-width and half-width, and case of ASCII.
+# CNameIndex::normalize_key() must return the same key.
+def search_key(x):
+    chars = []
+    for c in x:
+        c = unify_width(c)
+        composed = compose_kana(chars[-1], c) if chars else None
+        if composed: chars[-1] = composed
+        else: chars.append(c)
+    def normalize_char(c):
+        if c in SEARCH_KEY_KANA: return SEARCH_KEY_KANA[c]
+        if u"\u30a1" <= c <= u"\u30f4": return unichr(ord(c) - 0x60)
+        if c < u"\x80": return c.lower()
+        return c
+    return u"".join(normalize_char(c) for c in chars)
+
+
+def add_search_keys(db):
+    for table, column in SEARCH_KEYS:
+        sql = "ALTER TABLE %s ADD COLUMN %skey text" % (table, column)
+        if DEBUG: print sql
+        db.execute(sql)
+        rows = db.execute("SELECT %sid, %s FROM %s" %
+                          (table, column, table)).fetchall()
+        db.executemany("UPDATE %s SET %skey=? WHERE %sid=?" %
+                       (table, column, table),
+                       [(search_key(x), i) for i, x in rows if x is not None])
+        # LIKE is case-insensitive, so only a NOCASE index serves a prefix.
+        sql = ("CREATE INDEX %s_%skey ON %s (%skey COLLATE NOCASE)" %
+               (table, column, table, column))
+        if DEBUG: print sql
+        db.execute(sql)
+    return
+
+
 def create_view(db):
     sqls = [
         "CREATE VIEW junction AS SELECT station.* FROM kilo NATURAL JOIN station GROUP BY kilo.stationid HAVING count(*) > 1",
@@ -204,6 +303,7 @@ def mksqldb(db_name=DB_NAME):
     db.execute("PRAGMA foreign_keys = ON;")
     for i in TARGETS:
         mktable_from_csv(db, i)
+    add_search_keys(db)
     create_view(db)
     db.commit()
     db.close()
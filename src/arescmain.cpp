@@ -0,0 +1,44 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <cstdlib>
+#include "sqlite3_wrapper.h"
+#include "cnetworksnapshot.h"
+
+/**
+ * データベースから路線網のスナップショットを作り, ファイルに書き出す.
+ * 書き出したファイルは ares -s で読み込める.
+ * -m を付けると共有メモリに置き, ares -m で付けられるようにする.
+ */
+int main(int argc, char ** argv)
+{
+  const char * program = argv[0];
+  const bool shared = argc >= 2 && std::string(argv[1]) == "-m";
+  if(shared)
+  {
+    --argc;
+    ++argv;
+  }
+  if(argc != 3)
+  {
+    std::cerr << "Usage: " << program << " dbfile snapshotfile" << std::endl
+              << "       " << program << " -m dbfile shmname" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  try
+  {
+    sqlite3_wrapper::SQLite db(argv[1], SQLITE_OPEN_READONLY);
+    const ares::CNetworkSnapshot snapshot(db);
+    if(shared) { snapshot.publish(argv[2]); }
+    else { snapshot.write(argv[2]); }
+    std::cout << argv[2] << ": " << snapshot.size() << " bytes, "
+              << "format version " << ares::CNetworkSnapshot::FORMAT_VERSION
+              << std::endl;
+  }
+  catch(const std::exception & e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  return 0;
+}
@@ -1,11 +1,16 @@
 #include <iostream>
 #include <locale>
 #include <memory>
+#include <string>
+#include <vector>
 #include <stdexcept>
 #include <cstdlib>
 #include <boost/foreach.hpp>
 #include "cdatabase.h"
 #include "croute.h"
+#include "croutefinder.h"
+#include "ccontractionhierarchy.h"
+#include "cnetworksnapshot.h"
 #include "sqlite3_wrapper.h"
 
 class ExitWithUsage : public std::runtime_error
@@ -14,43 +19,278 @@ public:
   ExitWithUsage() : std::runtime_error("Error to show usage") {}
 };
 
+//! 解決できなかった名前はget_stationid()などと同じ例外を投げる.
+int get_resolved(const std::string & name, const ares::resolution_t & r)
+{
+  if(r.candidates.empty()) { throw ares::DoesNotExist(name); }
+  if(r.candidates.size() > 1)
+  {
+    throw ares::MultipleObjectReturned(name.c_str(), r.candidates.size());
+  }
+  return r.id;
+}
+
 void calc_route(std::shared_ptr<ares::CDatabase> db,
                 int argc,
                 char ** argv)
 {
-  if(argc == 0) { throw ExitWithUsage(); }
-  ares::CRoute route(db, db->get_stationid(argv[0]));
-  int i=1;
-  do
-  {
-    if(i+1 >= argc) { throw ExitWithUsage(); }
-    route.append_route(db->get_lineid   (argv[i  ]),
-                       db->get_stationid(argv[i+1]));
-    i += 2;
-  } while(i < argc);
+  if(argc < 3 || argc % 2 == 0) { throw ExitWithUsage(); }
+  std::vector<std::string> stations, lines;
+  for(int i=0; i<argc; ++i)
+  {
+    (i % 2 == 0 ? stations : lines).push_back(argv[i]);
+  }
+  std::vector<ares::resolution_t> station_ids, line_ids;
+  db->resolve_stations(stations, station_ids);
+  db->resolve_lines(lines, line_ids);
+  ares::CRoute route(db, get_resolved(stations[0], station_ids[0]));
+  for(size_t i=0; i<lines.size(); ++i)
+  {
+    route.append_route(get_resolved(lines[i], line_ids[i]),
+                       get_resolved(stations[i+1], station_ids[i+1]));
+  }
   int fare = route.calc_fare_inplace();
   std::cout << fare << std::endl;
 }
 
+/**
+ * 発駅, 経由駅, 着駅を通る最短の経路を探し, 経路と運賃を出力する.
+ * cheapestなら発駅から着駅までの運賃が最安の経路を探す.
+ * landmarksがあれば, そのファイルの目印を使う(なければ作って書く).
+ */
+void find_route(std::shared_ptr<ares::CDatabase> db,
+                bool cheapest,
+                const char * landmarks,
+                int argc,
+                char ** argv)
+{
+  if(argc < 2 || (cheapest && argc != 2)) { throw ExitWithUsage(); }
+  const std::vector<std::string> names(argv, argv + argc);
+  std::vector<ares::resolution_t> station_ids;
+  db->resolve_stations(names, station_ids);
+  ares::station_vector stops;
+  for(size_t i=0; i<names.size(); ++i)
+  {
+    stops.push_back(get_resolved(names[i], station_ids[i]));
+  }
+  ares::CRouteFinder finder(db);
+  if(landmarks)
+  {
+    try { finder.use_landmarks(landmarks); }
+    catch(const ares::IOException & e)
+    {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+  try
+  {
+    ares::CRoute route = cheapest
+      ? finder.find_cheapest(stops.front(), stops.back())
+      : finder.find(stops);
+    std::cout << route << std::endl;
+    std::cout << route.calc_fare_inplace() << std::endl;
+  }
+  catch(const ares::SearchTruncated & e)
+  {
+    std::cerr << e.what() << ", the route may not be the cheapest"
+              << std::endl;
+    ares::CRoute route = e.best;
+    std::cout << route << std::endl;
+    std::cout << route.calc_fare_inplace() << std::endl;
+  }
+  catch(const ares::RouteNotFound & e)
+  {
+    std::cerr << "No route from " << db->get_station_name(e.from)
+              << " to " << db->get_station_name(e.to) << std::endl;
+    std::cerr << "Found: " << e.partial << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+//! 発駅から着駅までの経路を営業キロの短い順にk本探し, 経路と運賃を出力する.
+void find_alternatives(std::shared_ptr<ares::CDatabase> db,
+                       int argc,
+                       char ** argv)
+{
+  if(argc != 3) { throw ExitWithUsage(); }
+  const int k = std::atoi(argv[0]);
+  if(k <= 0) { throw ExitWithUsage(); }
+  const std::vector<std::string> names(argv + 1, argv + argc);
+  std::vector<ares::resolution_t> station_ids;
+  db->resolve_stations(names, station_ids);
+  const ares::CRouteFinder finder(db);
+  try
+  {
+    for(const auto & alternative :
+          finder.find_alternatives(get_resolved(names[0], station_ids[0]),
+                                   get_resolved(names[1], station_ids[1]),
+                                   k))
+    {
+      std::cout << alternative.route << std::endl;
+      std::cout << ares::CHecto(alternative.hecto) << " "
+                << alternative.fare << std::endl;
+    }
+  }
+  catch(const ares::RouteNotFound & e)
+  {
+    std::cerr << "No route from " << db->get_station_name(e.from)
+              << " to " << db->get_station_name(e.to) << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * 2駅間の最短の営業キロと, その経路を縮約階層で求めて出力する.
+ * hierarchyがあれば, そのファイルの縮約階層を使う(なければ作って書く).
+ */
+void find_distance(std::shared_ptr<ares::CDatabase> db,
+                   const char * hierarchy,
+                   int argc,
+                   char ** argv)
+{
+  if(argc != 2) { throw ExitWithUsage(); }
+  const std::vector<std::string> names(argv, argv + argc);
+  std::vector<ares::resolution_t> station_ids;
+  db->resolve_stations(names, station_ids);
+  const ares::station_id_t begin = get_resolved(names[0], station_ids[0]);
+  const ares::station_id_t end = get_resolved(names[1], station_ids[1]);
+  ares::CRouteFinder finder(db);
+  if(hierarchy)
+  {
+    try { finder.use_hierarchy(hierarchy); }
+    catch(const ares::IOException & e)
+    {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+  else { finder.set_hierarchy(finder.build_hierarchy()); }
+  ares::CRoute route(db, begin);
+  const int hecto = finder.distance(begin, end, route);
+  if(hecto < 0)
+  {
+    std::cerr << "No route from " << names[0]
+              << " to " << names[1] << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  std::cout << route << std::endl;
+  std::cout << ares::CHecto(hecto) << std::endl;
+}
+
 int main(int argc, char ** argv)
 {
+  const char * program = argv[0];
   try
   {
+    // 問い合わせの計測を出力する形式. 空なら計測しない.
+    std::string profile;
+    if(argc >= 3 && std::string(argv[1]) == "-p")
+    {
+      profile = argv[2];
+      if(profile != "text" && profile != "json") { throw ExitWithUsage(); }
+      if(!ares::CQueryProfiler::is_compiled())
+      {
+        std::cerr << "Not compiled with ARES_PROFILE" << std::endl;
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    std::shared_ptr<const ares::CNetworkSnapshot> snapshot;
+    if(argc >= 3 && std::string(argv[1]) == "-s")
+    {
+      try { snapshot.reset(new ares::CNetworkSnapshot(argv[2])); }
+      catch(const std::exception & e)
+      {
+        std::cerr << e.what() << std::endl;
+        throw ExitWithUsage();
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    else if(argc >= 3 && std::string(argv[1]) == "-m")
+    {
+      try { snapshot = ares::CNetworkSnapshot::open_shared(argv[2]); }
+      catch(const std::exception & e)
+      {
+        std::cerr << e.what() << std::endl;
+        throw ExitWithUsage();
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    // 目印のファイル名. 空なら目印を使わない.
+    std::string landmarks;
+    if(argc >= 3 && std::string(argv[1]) == "-l")
+    {
+      landmarks = argv[2];
+      argc -= 2;
+      argv += 2;
+    }
+    // 縮約階層のファイル名. 空ならその場で作る.
+    std::string hierarchy;
+    if(argc >= 3 && std::string(argv[1]) == "-c")
+    {
+      hierarchy = argv[2];
+      argc -= 2;
+      argv += 2;
+    }
     if(argc < 2) { throw ExitWithUsage(); }
     std::shared_ptr<ares::CDatabase> db;
-    try { db.reset(new ares::CDatabase(argv[1])); }
+    try
+    {
+      if(snapshot) { db.reset(new ares::CDatabase(argv[1], snapshot)); }
+      else { db.reset(new ares::CDatabase(argv[1])); }
+    }
     catch(ares::IOException & e)
     {
       std::cerr << "DB file " << argv[1] << " not found" << std::endl;
       throw ExitWithUsage();
     }
-    calc_route(db, argc - 2, argv + 2);
+    db->get_profiler().set_enabled(!profile.empty());
+    if(argc >= 3 && (std::string(argv[2]) == "-route"
+                     || std::string(argv[2]) == "-cheapest"))
+    {
+      find_route(db, std::string(argv[2]) == "-cheapest",
+                 landmarks.empty() ? nullptr : landmarks.c_str(),
+                 argc - 3, argv + 3);
+    }
+    else if(argc >= 3 && std::string(argv[2]) == "-alternatives")
+    {
+      find_alternatives(db, argc - 3, argv + 3);
+    }
+    else if(argc >= 3 && std::string(argv[2]) == "-distance")
+    {
+      find_distance(db, hierarchy.empty() ? nullptr : hierarchy.c_str(),
+                    argc - 3, argv + 3);
+    }
+    else { calc_route(db, argc - 2, argv + 2); }
+    if(profile == "text") { db->get_profiler().dump_text(std::cerr); }
+    else if(profile == "json")
+    {
+      db->get_profiler().dump_json(std::cerr);
+      std::cerr << std::endl;
+    }
   }
   catch(const ExitWithUsage & e)
   {
-    std::cerr << "Usage: " << argv[0] << " dbfile"
+    std::cerr << "Usage: " << program
+              << " [-p text|json] [-s snapshotfile | -m shmname] dbfile"
               << " station1" << " line1" << " station2"
               << " ... stationN" << std::endl;
+    std::cerr << "       " << program
+              << " [-p text|json] [-s snapshotfile | -m shmname]"
+              << " [-l landmarkfile] dbfile"
+              << " -route station1 [via ...] stationN" << std::endl;
+    std::cerr << "       " << program
+              << " [-p text|json] [-s snapshotfile | -m shmname]"
+              << " [-l landmarkfile] dbfile"
+              << " -cheapest station1 station2" << std::endl;
+    std::cerr << "       " << program
+              << " [-p text|json] [-s snapshotfile | -m shmname] dbfile"
+              << " -alternatives k station1 station2" << std::endl;
+    std::cerr << "       " << program
+              << " [-p text|json] [-s snapshotfile | -m shmname]"
+              << " [-c hierarchyfile] dbfile"
+              << " -distance station1 station2" << std::endl;
     std::exit(EXIT_FAILURE);
   }
   return 0;
@@ -1,14 +1,18 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <utility>
 #include <iterator>
+#include <algorithm>
+#include <cstdlib>
 #include "ares.h"
 
 namespace ares
 {
   namespace
   {
-    size_t u8strlen(const std::string & str)
+    inline size_t u8strlen(const std::string & str)
     {
       size_t size = 0;
       for(auto itr=str.begin(); itr != str.end();)
@@ -26,5 +30,49 @@ namespace ares
       }
       return size;
     }
+
+    /**
+     * UTF-8の文字列を1文字ずつに分ける.
+     * 末尾で途切れた文字はそのまま1文字とする.
+     */
+    inline std::vector<std::string> u8split(const std::string & str)
+    {
+      std::vector<std::string> result;
+      for(size_t i=0; i<str.size();)
+      {
+        const unsigned char c = str[i];
+        size_t n = 1;
+        if(false) ;
+        else if(c < 0x80) n = 1;
+        else if(c < 0xe0) n = 2;
+        else if(c < 0xf0) n = 3;
+        else if(c < 0xf8) n = 4;
+        else if(c < 0xfc) n = 5;
+        else if(c < 0xfe) n = 6;
+        result.push_back(str.substr(i, n));
+        i += n;
+      }
+      return result;
+    }
+
+    /**
+     * check if a <= b. 等号がつくところに注意.
+     * @retval true  aが完全にbに内包されるとき(境界含む.)
+     * @retval false それ以外.
+     */
+    inline bool isRangeLess(const std::pair<int, int> a,
+                            const std::pair<int, int> b)
+    {
+      int a_max = std::max(a.first, a.second);
+      int a_min = std::min(a.first, a.second);
+      int b_max = std::max(b.first, b.second);
+      int b_min = std::min(b.first, b.second);
+      return b_min <= a_min && a_max <= b_max;
+    }
+
+    inline int getRangeLength(const std::pair<int, int> a)
+    {
+      return std::abs(a.first - a.second);
+    }
   }
 }
@@ -0,0 +1,162 @@
+/* -*-coding: utf-8-*- */
+#include <algorithm>
+#include <iterator>
+
+#include "util.hpp"
+#include "aresutil.h"
+#include "cdatabase.h"
+#include "cnameindex.h"
+#include "ccompletion.h"
+
+namespace ares
+{
+  namespace
+  {
+    typedef CStationCompletion::MATCH_TYPE MATCH_TYPE;
+
+    //! 1つの文字列に対する一致の種類.
+    MATCH_TYPE match_string(const std::string & target,
+                            const std::string & query)
+    {
+      const size_t pos = target.find(query);
+      if(pos == std::string::npos) { return CStationCompletion::MATCH_NONE; }
+      if(pos != 0) { return CStationCompletion::MATCH_PARTIAL; }
+      return target.size() == query.size() ? CStationCompletion::MATCH_EXACT
+        : CStationCompletion::MATCH_PREFIX;
+    }
+  }
+
+  CStationCompletion::MATCH_TYPE
+  CStationCompletion::match(const CStation & station, const std::string & query_)
+  {
+    const std::string query = CNameField::normalize(query_);
+    MATCH_TYPE result = std::min(
+      match_string(CNameField::normalize(station.name), query),
+      match_string(CNameField::normalize(station.yomi), query));
+    // "（函）桂川" は "桂川" とも比べる.
+    const std::string open("（"), close("）");
+    if(station.name.compare(0, open.size(), open) == 0)
+    {
+      for(size_t pos = station.name.find(close, open.size());
+          pos != std::string::npos;
+          pos = station.name.find(close, pos + close.size()))
+      {
+        result = std::min(result,
+                          match_string(CNameField::normalize(
+                                         station.name.substr(pos + close.size())),
+                                       query));
+      }
+    }
+    // CDatabase::find_stationid_with_denryaku()と同じく,
+    // 2文字以下なら先頭2文字を除いて比べる.
+    const std::vector<std::string> chars = u8split(station.denryaku);
+    if(u8strlen(query) > 2)
+    {
+      result = std::min(result, match_string(station.denryaku, query));
+    }
+    else if(chars.size() >= 2)
+    {
+      result = std::min(result,
+                        match_string(station.denryaku.substr(chars[0].size()
+                                                             + chars[1].size()),
+                                     query));
+    }
+    return result;
+  }
+
+  void CStationCompletion::add_to_pool(const station_vector & stations,
+                                       std::vector<unsigned> & indices)
+  {
+    station_vector missing;
+    for(const station_id_t station : stations)
+    {
+      if(pool_index.count(station) == 0) { missing.push_back(station); }
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    const unsigned size_before = pool.size();
+    db->get_stations(missing, pool);
+    for(unsigned i=0; i<missing.size(); ++i)
+    {
+      pool_index[missing[i]] = size_before + i;
+    }
+    for(const station_id_t station : stations)
+    {
+      indices.push_back(pool_index[station]);
+    }
+  }
+
+  void CStationCompletion::clear()
+  {
+    query.clear();
+    lengths.clear();
+    candidates.clear();
+  }
+
+  void CStationCompletion::push(const std::string & input)
+  {
+    for(const std::string & c : u8split(input))
+    {
+      query += c;
+      lengths.push_back(c.size());
+      std::vector<unsigned> found;
+      // 最初の1文字と, 電略を全体で比べ始める3文字目だけ問い合わせる.
+      if(candidates.empty())
+      {
+        station_vector stations;
+        db->find_stationid(query.c_str(), FIND_PARTIAL, stations);
+        add_to_pool(stations, found);
+      }
+      else
+      {
+        found = candidates.back();
+        if(lengths.size() == 3)
+        {
+          station_vector stations;
+          db->find_stationid_with_denryaku(query.c_str(), FIND_PARTIAL,
+                                           stations);
+          add_to_pool(stations, found);
+        }
+      }
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+      std::vector<unsigned> narrowed;
+      std::copy_if(found.begin(), found.end(), std::back_inserter(narrowed),
+                   [this](unsigned i)
+                   { return match(pool[i], query) != MATCH_NONE; });
+      candidates.push_back(std::move(narrowed));
+    }
+  }
+
+  bool CStationCompletion::pop()
+  {
+    if(lengths.empty()) { return false; }
+    query.resize(query.size() - lengths.back());
+    lengths.pop_back();
+    candidates.pop_back();
+    return true;
+  }
+
+  void CStationCompletion::top(size_t k, station_vector & result) const
+  {
+    if(candidates.empty()) { return; }
+    typedef std::pair<MATCH_TYPE, unsigned> ranked_t;
+    std::vector<ranked_t> ranked;
+    for(const unsigned i : candidates.back())
+    {
+      ranked.push_back(ranked_t(match(pool[i], query), i));
+    }
+    const auto less = [this](const ranked_t & a, const ranked_t & b)
+      {
+        if(a.first != b.first) { return a.first < b.first; }
+        const CStation & x = pool[a.second], & y = pool[b.second];
+        const size_t xlen = u8strlen(x.name), ylen = u8strlen(y.name);
+        if(xlen != ylen) { return xlen < ylen; }
+        if(x.yomi != y.yomi) { return x.yomi < y.yomi; }
+        return x.id < y.id;
+      };
+    k = std::min(k, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(), less);
+    for(size_t i=0; i<k; ++i) { result.push_back(pool[ranked[i].second].id); }
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "ares.h"
+#include "cstation.h"
+
+namespace ares
+{
+  class CDatabase;
+
+  /**
+   * @~english
+   * Incremental type-ahead completion session of station names.
+   */
+  /**
+   * @~japanese
+   * 駅名の入力補完のセッション.
+   * 1文字入力するごとに前の候補を絞り込み, データベースには問い合わせない.
+   * 最初の1文字でCDatabase::find_stationid()の部分一致で候補を集め,
+   * 以降は同じ条件(駅名, 読み, 電略の部分一致)で候補を残す.
+   * 電略は2文字以下なら先頭2文字を除いて比べるので,
+   * 3文字目を入力した時だけ電略で候補を問い合わせて加える.
+   */
+  class CStationCompletion
+  {
+  public:
+    //! 候補の一致の種類. 小さいほど上位.
+    enum MATCH_TYPE
+    {
+      MATCH_EXACT,
+      MATCH_PREFIX,
+      MATCH_PARTIAL,
+      MATCH_NONE,
+    };
+
+  private:
+    std::shared_ptr<CDatabase> db;
+    std::string query;
+    //! 入力した文字ごとの長さ. pop()で戻すのに使う.
+    std::vector<size_t> lengths;
+    //! これまでに集めた候補の駅.
+    std::vector<CStation> pool;
+    std::unordered_map<station_id_t, unsigned> pool_index;
+    //! 入力した文字ごとの候補. poolの添字の昇順.
+    std::vector<std::vector<unsigned> > candidates;
+
+    //! poolにない駅を加え, その添字を返す.
+    void add_to_pool(const station_vector & stations,
+                     std::vector<unsigned> & indices);
+
+  public:
+    /**
+     * Constructor.
+     * Constructor with existing CDatabase object.
+     */
+    explicit CStationCompletion(std::shared_ptr<CDatabase> db)
+      : db(db) {}
+
+    //! 駅が問い合わせにどのように一致するかを調べる.
+    static MATCH_TYPE match(const CStation & station, const std::string & query);
+
+    //! 入力を空にする.
+    void clear();
+
+    /**
+     * 文字を入力し, 候補を絞り込む.
+     * @param[in] input UTF-8の文字列. 複数の文字なら1文字ずつ入力する.
+     */
+    void push(const std::string & input);
+
+    /**
+     * 最後に入力した1文字を取り消し, 前の候補に戻す.
+     * @retval false 入力が空だった場合.
+     */
+    bool pop();
+
+    //! これまでの入力.
+    const std::string & get_query() const { return query; }
+
+    //! 現在の候補の数.
+    size_t size() const
+    {
+      return candidates.empty() ? 0 : candidates.back().size();
+    }
+
+    /**
+     * 上位k件の駅IDを返す.
+     * 完全一致, 前方一致, 部分一致の順に並べ,
+     * 同じ種類なら駅名の短い順, 読みの順, 駅IDの順に並べる.
+     * @param[in]  k      返す件数の上限.
+     * @param[out] result 結果を加える配列.
+     */
+    void top(size_t k, station_vector & result) const;
+  };
+}
@@ -0,0 +1,522 @@
+/* -*-coding: utf-8-*- */
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <queue>
+
+#include "util.hpp"
+#include "sqlite3_wrapper.h"
+#include "ccontractionhierarchy.h"
+
+namespace ares
+{
+  using sqlite3_wrapper::IOException;
+
+  namespace
+  {
+    const char FILE_MAGIC[8] = {'A', 'R', 'E', 'S', 'C', 'H', '\0', '\0'};
+    const std::uint32_t FILE_BYTE_ORDER = 0x01020304;
+
+    const std::uint32_t NO_VERTEX = std::numeric_limits<std::uint32_t>::max();
+    const int INFINITE = std::numeric_limits<int>::max();
+    //! 縮約で証人の経路を探す時に調べる頂点の数の上限.
+    //! 見つからなければショートカットを加えるので, 結果は変わらない.
+    const size_t MAX_WITNESS_SETTLED = 500;
+
+    //! ファイルの先頭に置くヘッダ. 駅ID, 辺の先頭, 辺の表が続く.
+    struct file_header_t
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byte_order;
+      std::uint32_t nstation;
+      std::uint32_t narc;
+      std::uint64_t fingerprint;
+    };
+
+    typedef std::pair<int, std::uint32_t> item_t;
+    typedef std::priority_queue<item_t, std::vector<item_t>,
+                                std::greater<item_t> > Queue;
+
+    //! 縮約中の辺. 頂点は縮約前の番号.
+    struct link_t
+    {
+      int hecto;
+      std::int32_t middle;
+      std::int32_t line;
+    };
+    typedef std::vector<std::map<std::uint32_t, link_t> > Links;
+
+    /**
+     * グラフを縮約する.
+     * 辺を加えて減らす辺の数と, 縮約済みの隣の頂点の数の和が小さい順に縮約する.
+     */
+    class Contractor
+    {
+      Links & links;
+      std::vector<bool> contracted;
+      std::vector<int> deleted;
+      //! 証人の探索の営業キロ. 調べた頂点だけを戻す.
+      std::vector<int> dist;
+      std::vector<std::uint32_t> touched;
+
+      struct shortcut_t
+      {
+        std::uint32_t from, to;
+        int hecto;
+      };
+
+      //! uからvを通らずに, limit以下で行ける頂点の営業キロを求める.
+      void witness(std::uint32_t u, std::uint32_t v, int limit)
+      {
+        for(const std::uint32_t i : touched) { dist[i] = INFINITE; }
+        touched.clear();
+        Queue queue;
+        dist[u] = 0;
+        touched.push_back(u);
+        queue.push(item_t(0, u));
+        for(size_t settled=0;
+            !queue.empty() && settled < MAX_WITNESS_SETTLED; ++settled)
+        {
+          const item_t item = queue.top();
+          queue.pop();
+          if(item.first > dist[item.second]) { continue; }
+          if(item.first > limit) { break; }
+          for(const auto & link : links[item.second])
+          {
+            const std::uint32_t j = link.first;
+            if(j == v || contracted[j]) { continue; }
+            const int d = item.first + link.second.hecto;
+            if(d >= dist[j]) { continue; }
+            if(dist[j] == INFINITE) { touched.push_back(j); }
+            dist[j] = d;
+            queue.push(item_t(d, j));
+          }
+        }
+      }
+
+      //! vを縮約する時に必要なショートカット.
+      void shortcuts_of(std::uint32_t v, std::vector<shortcut_t> & result)
+      {
+        result.clear();
+        std::vector<std::pair<std::uint32_t, int> > neighbors;
+        int longest = 0;
+        for(const auto & link : links[v])
+        {
+          if(contracted[link.first]) { continue; }
+          neighbors.push_back(std::make_pair(link.first, link.second.hecto));
+          longest = std::max(longest, link.second.hecto);
+        }
+        for(size_t i=0; i<neighbors.size(); ++i)
+        {
+          const std::uint32_t u = neighbors[i].first;
+          $.witness(u, v, neighbors[i].second + longest);
+          for(size_t j=i+1; j<neighbors.size(); ++j)
+          {
+            const int via = neighbors[i].second + neighbors[j].second;
+            if(dist[neighbors[j].first] > via)
+            {
+              const shortcut_t shortcut = {u, neighbors[j].first, via};
+              result.push_back(shortcut);
+            }
+          }
+        }
+      }
+
+      int priority(std::uint32_t v, std::vector<shortcut_t> & shortcuts)
+      {
+        $.shortcuts_of(v, shortcuts);
+        int degree = 0;
+        for(const auto & link : links[v])
+        {
+          if(!contracted[link.first]) { ++degree; }
+        }
+        return static_cast<int>(shortcuts.size()) - degree + deleted[v];
+      }
+
+    public:
+      explicit Contractor(Links & links)
+        : links(links), contracted(links.size(), false),
+          deleted(links.size(), 0), dist(links.size(), INFINITE) {}
+
+      //! 縮約した順の頂点.
+      std::vector<std::uint32_t> contract()
+      {
+        const std::uint32_t n = links.size();
+        std::vector<shortcut_t> shortcuts;
+        Queue queue;
+        for(std::uint32_t v=0; v<n; ++v)
+        {
+          queue.push(item_t($.priority(v, shortcuts), v));
+        }
+        std::vector<std::uint32_t> order;
+        while(!queue.empty())
+        {
+          const std::uint32_t v = queue.top().second;
+          queue.pop();
+          // 優先度は隣を縮約すると変わるので, 取り出した時に計算し直す.
+          const int p = $.priority(v, shortcuts);
+          if(!queue.empty() && p > queue.top().first)
+          {
+            queue.push(item_t(p, v));
+            continue;
+          }
+          for(const shortcut_t & shortcut : shortcuts)
+          {
+            const link_t link = {shortcut.hecto,
+                                 static_cast<std::int32_t>(v), -1};
+            for(const auto & end : {std::make_pair(shortcut.from, shortcut.to),
+                                    std::make_pair(shortcut.to, shortcut.from)})
+            {
+              const auto inserted =
+                links[end.first].insert(std::make_pair(end.second, link));
+              if(!inserted.second
+                 && shortcut.hecto < inserted.first->second.hecto)
+              {
+                inserted.first->second = link;
+              }
+            }
+          }
+          contracted[v] = true;
+          order.push_back(v);
+          for(const auto & link : links[v]) { ++deleted[link.first]; }
+        }
+        return order;
+      }
+    };
+  }
+
+  const int CContractionHierarchy::UNREACHABLE;
+
+  CContractionHierarchy::CContractionHierarchy(const station_vector & stations,
+                                               const std::vector<edge_t> & edges,
+                                               std::uint64_t fingerprint)
+    : fingerprint(fingerprint)
+  {
+    station_vector sorted(stations);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    const auto vertex = [&](station_id_t station)
+      {
+        const auto itr = std::lower_bound(sorted.begin(), sorted.end(),
+                                          station);
+        if(itr == sorted.end() || *itr != station)
+        {
+          throw std::invalid_argument("edge to unknown station "
+                                      + std::to_string(station));
+        }
+        return static_cast<std::uint32_t>(itr - sorted.begin());
+      };
+    Links links(sorted.size());
+    for(const edge_t & edge : edges)
+    {
+      if(edge.hecto < 0)
+      {
+        throw std::invalid_argument("negative kilo between stations "
+                                    + std::to_string(edge.from) + " and "
+                                    + std::to_string(edge.to));
+      }
+      const std::uint32_t a = vertex(edge.from), b = vertex(edge.to);
+      if(a == b) { continue; }
+      // 同じ駅の間に路線が複数あれば, 短い方(同じなら先の方)を使う.
+      const link_t link = {edge.hecto, -1, edge.line};
+      for(const auto & end : {std::make_pair(a, b), std::make_pair(b, a)})
+      {
+        const auto inserted =
+          links[end.first].insert(std::make_pair(end.second, link));
+        if(!inserted.second && edge.hecto < inserted.first->second.hecto)
+        {
+          inserted.first->second = link;
+        }
+      }
+    }
+
+    const std::vector<std::uint32_t> order = Contractor(links).contract();
+    std::vector<std::uint32_t> rank(order.size());
+    for(std::uint32_t r=0; r<order.size(); ++r) { rank[order[r]] = r; }
+    $.first.push_back(0);
+    for(const std::uint32_t v : order)
+    {
+      $.stations.push_back(sorted[v]);
+      const size_t begin = $.arcs.size();
+      for(const auto & link : links[v])
+      {
+        if(rank[link.first] < rank[v]) { continue; }
+        const arc_t arc = {rank[link.first], link.second.hecto,
+                           link.second.middle < 0
+                           ? -1 : static_cast<std::int32_t>(
+                             rank[link.second.middle]),
+                           link.second.line};
+        $.arcs.push_back(arc);
+      }
+      std::sort($.arcs.begin() + begin, $.arcs.end(),
+                [](const arc_t & a, const arc_t & b) { return a.to < b.to; });
+      $.first.push_back($.arcs.size());
+    }
+    $.index();
+  }
+
+  CContractionHierarchy::CContractionHierarchy(const char * filename)
+  {
+    std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+    if(!ifs)
+    {
+      throw IOException(std::string("cannot open hierarchy: ") + filename);
+    }
+    const std::string data((std::istreambuf_iterator<char>(ifs)),
+                           std::istreambuf_iterator<char>());
+    if(ifs.bad())
+    {
+      throw IOException(std::string("cannot read hierarchy: ") + filename);
+    }
+    file_header_t header;
+    if(data.size() < sizeof(header))
+    { throw InvalidHierarchy("too small file"); }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if(std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+    { throw InvalidHierarchy("bad magic"); }
+    if(header.byte_order != FILE_BYTE_ORDER)
+    { throw InvalidHierarchy("different byte order"); }
+    if(header.version != FORMAT_VERSION)
+    {
+      throw InvalidHierarchy("format version "
+                             + std::to_string(header.version)
+                             + " is not "
+                             + std::to_string(FORMAT_VERSION));
+    }
+    const std::uint64_t nstation = header.nstation;
+    if(data.size() != sizeof(header)
+       + nstation * sizeof(std::int32_t)
+       + (nstation + 1) * sizeof(std::uint32_t)
+       + static_cast<std::uint64_t>(header.narc) * sizeof(arc_t))
+    { throw InvalidHierarchy("broken header"); }
+    const char * p = data.data() + sizeof(header);
+    $.stations.resize(header.nstation);
+    $.first.resize(header.nstation + 1);
+    $.arcs.resize(header.narc);
+    std::memcpy($.stations.data(), p, $.stations.size() * sizeof(std::int32_t));
+    p += $.stations.size() * sizeof(std::int32_t);
+    std::memcpy($.first.data(), p, $.first.size() * sizeof(std::uint32_t));
+    p += $.first.size() * sizeof(std::uint32_t);
+    std::memcpy($.arcs.data(), p, $.arcs.size() * sizeof(arc_t));
+    $.fingerprint = header.fingerprint;
+    $.index();
+  }
+
+  void CContractionHierarchy::index()
+  {
+    const std::uint32_t n = $.stations.size();
+    if($.first.size() != n + 1 || $.first.front() != 0
+       || $.first.back() != $.arcs.size())
+    {
+      throw InvalidHierarchy("broken arc offsets");
+    }
+    for(std::uint32_t v=0; v<n; ++v)
+    {
+      if($.first[v] > $.first[v+1])
+      { throw InvalidHierarchy("broken arc offsets"); }
+      for(std::uint32_t i=$.first[v]; i<$.first[v+1]; ++i)
+      {
+        const arc_t & arc = $.arcs[i];
+        // 辺は順位の高い頂点へ向かい, ショートカットは順位の低い頂点を通る.
+        if(arc.to <= v || arc.to >= n || arc.hecto < 0
+           || arc.middle >= static_cast<std::int32_t>(v))
+        {
+          throw InvalidHierarchy("broken arc");
+        }
+      }
+    }
+    $.vertex_of.clear();
+    for(std::uint32_t v=0; v<n; ++v)
+    {
+      $.vertex_of.push_back(std::make_pair($.stations[v], v));
+    }
+    std::sort($.vertex_of.begin(), $.vertex_of.end());
+    for(size_t i=1; i<$.vertex_of.size(); ++i)
+    {
+      if($.vertex_of[i-1].first == $.vertex_of[i].first)
+      { throw InvalidHierarchy("duplicate station"); }
+    }
+  }
+
+  void CContractionHierarchy::write(const char * filename) const
+  {
+    file_header_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FORMAT_VERSION;
+    header.byte_order = FILE_BYTE_ORDER;
+    header.nstation = $.stations.size();
+    header.narc = $.arcs.size();
+    header.fingerprint = $.fingerprint;
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary
+                      | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>($.stations.data()),
+              $.stations.size() * sizeof(std::int32_t));
+    ofs.write(reinterpret_cast<const char *>($.first.data()),
+              $.first.size() * sizeof(std::uint32_t));
+    ofs.write(reinterpret_cast<const char *>($.arcs.data()),
+              $.arcs.size() * sizeof(arc_t));
+    ofs.close();
+    if(!ofs)
+    {
+      throw IOException(std::string("cannot write hierarchy: ") + filename);
+    }
+  }
+
+  std::uint32_t CContractionHierarchy::find_vertex(station_id_t station) const
+  {
+    typedef VertexIndex::value_type value_type;
+    const auto itr = std::lower_bound($.vertex_of.begin(), $.vertex_of.end(),
+                                      station,
+                                      liquid::KeyLess<value_type, station_id_t,
+                                      &value_type::first>());
+    if(itr == $.vertex_of.end() || itr->first != station)
+    {
+      return $.stations.size();
+    }
+    return itr->second;
+  }
+
+  int CContractionHierarchy::search(std::uint32_t from, std::uint32_t to,
+                                    std::vector<std::uint32_t> * path) const
+  {
+    if(from == to)
+    {
+      if(path) { path->assign(1, from); }
+      return 0;
+    }
+    // 0は発駅から, 1は着駅からの探索.
+    std::vector<int> dist[2];
+    std::vector<std::uint32_t> prev[2];
+    Queue queue[2];
+    const std::uint32_t source[2] = {from, to};
+    for(int side=0; side<2; ++side)
+    {
+      dist[side].assign($.stations.size(), INFINITE);
+      prev[side].assign($.stations.size(), NO_VERTEX);
+      dist[side][source[side]] = 0;
+      queue[side].push(item_t(0, source[side]));
+    }
+    int best = INFINITE;
+    std::uint32_t meet = NO_VERTEX;
+    for(;;)
+    {
+      // 両方の探索の残りがbest以上になったら終わる.
+      for(int side=0; side<2; ++side)
+      {
+        if(!queue[side].empty() && queue[side].top().first >= best)
+        {
+          queue[side] = Queue();
+        }
+      }
+      if(queue[0].empty() && queue[1].empty()) { break; }
+      const int side = queue[1].empty()
+        || (!queue[0].empty() && queue[0].top() < queue[1].top()) ? 0 : 1;
+      const item_t item = queue[side].top();
+      queue[side].pop();
+      const std::uint32_t v = item.second;
+      if(item.first > dist[side][v]) { continue; }
+      if(dist[1-side][v] != INFINITE
+         && item.first + dist[1-side][v] < best)
+      {
+        best = item.first + dist[1-side][v];
+        meet = v;
+      }
+      const arc_t * begin = $.arcs.data() + $.first[v];
+      const arc_t * end = $.arcs.data() + $.first[v+1];
+      // 順位の高い頂点からもっと短く来られるなら, vから先は調べない.
+      bool stalled = false;
+      for(const arc_t * arc=begin; arc != end && !stalled; ++arc)
+      {
+        stalled = dist[side][arc->to] != INFINITE
+          && dist[side][arc->to] + arc->hecto < item.first;
+      }
+      if(stalled) { continue; }
+      for(const arc_t * arc=begin; arc != end; ++arc)
+      {
+        const int d = item.first + arc->hecto;
+        if(d >= dist[side][arc->to]) { continue; }
+        dist[side][arc->to] = d;
+        prev[side][arc->to] = v;
+        queue[side].push(item_t(d, arc->to));
+      }
+    }
+    if(meet == NO_VERTEX) { return UNREACHABLE; }
+    if(path)
+    {
+      path->clear();
+      for(std::uint32_t v=meet; v != NO_VERTEX; v = prev[0][v])
+      {
+        path->push_back(v);
+      }
+      std::reverse(path->begin(), path->end());
+      for(std::uint32_t v=prev[1][meet]; v != NO_VERTEX; v = prev[1][v])
+      {
+        path->push_back(v);
+      }
+    }
+    return best;
+  }
+
+  const CContractionHierarchy::arc_t &
+  CContractionHierarchy::arc_between(std::uint32_t a, std::uint32_t b) const
+  {
+    if(a > b) { std::swap(a, b); }
+    const arc_t * begin = $.arcs.data() + $.first[a];
+    const arc_t * end = $.arcs.data() + $.first[a+1];
+    const arc_t * arc = std::lower_bound(begin, end, b,
+                                         [](const arc_t & arc, std::uint32_t to)
+                                         {
+                                           return arc.to < to;
+                                         });
+    if(arc == end || arc->to != b)
+    {
+      throw InvalidHierarchy("missing arc of shortcut");
+    }
+    return *arc;
+  }
+
+  void CContractionHierarchy::unpack(std::uint32_t a, std::uint32_t b,
+                                     std::vector<step_t> & steps) const
+  {
+    const arc_t & arc = $.arc_between(a, b);
+    if(arc.middle < 0)
+    {
+      const step_t step = {arc.line, $.stations[b]};
+      steps.push_back(step);
+      return;
+    }
+    $.unpack(a, arc.middle, steps);
+    $.unpack(arc.middle, b, steps);
+  }
+
+  int CContractionHierarchy::distance(station_id_t from,
+                                      station_id_t to) const
+  {
+    const std::uint32_t a = $.find_vertex(from), b = $.find_vertex(to);
+    if(a == $.stations.size() || b == $.stations.size()) { return UNREACHABLE; }
+    return $.search(a, b, nullptr);
+  }
+
+  int CContractionHierarchy::path(station_id_t from, station_id_t to,
+                                  std::vector<step_t> & steps) const
+  {
+    steps.clear();
+    const std::uint32_t a = $.find_vertex(from), b = $.find_vertex(to);
+    if(a == $.stations.size() || b == $.stations.size()) { return UNREACHABLE; }
+    std::vector<std::uint32_t> vertices;
+    const int hecto = $.search(a, b, &vertices);
+    if(hecto == UNREACHABLE) { return hecto; }
+    for(size_t i=1; i<vertices.size(); ++i)
+    {
+      $.unpack(vertices[i-1], vertices[i], steps);
+    }
+    return hecto;
+  }
+}
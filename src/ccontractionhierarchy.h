@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ares.h"
+
+namespace ares
+{
+  /**
+   * @~english
+   * Exception to represent that the hierarchy file is broken
+   * or written in other format version.
+   */
+  /**
+   * @~japanese
+   * 縮約階層のファイルが壊れているか形式が異なる時の例外.
+   */
+  class InvalidHierarchy : public std::runtime_error
+  {
+  public:
+    explicit InvalidHierarchy(const std::string & what)
+      : std::runtime_error("Invalid hierarchy: " + what) {}
+  };
+
+  /**
+   * @~english
+   * Contraction hierarchy over the station graph for fast
+   * station-to-station distance and path queries.
+   */
+  /**
+   * @~japanese
+   * 駅を頂点, 隣り合う駅の間を営業キロを重みとする辺としたグラフの縮約階層.
+   * 駅を重要でない順に縮約し, 縮約した駅を通る最短経路の代わりに
+   * ショートカットの辺を加えておく. 2駅間の営業キロは, 両方の駅から
+   * 順位の高い駅への辺だけをたどる双方向の探索で求める.
+   * 乗り換えの重みは0なので, 路線ごとの頂点を分けなくても営業キロは同じ.
+   * 使うのはCRouteFinder::distance()だけで, 運賃の計算
+   * (CRoute::calc_fare_inplace())には使わない.
+   * ファイルに書き出して次の起動で読み込める.
+   * 作った時のCRouteFinderの指紋を持ち, 指紋の違うグラフには使わない.
+   * 構築後は変更しないので, 複数のスレッドから同時に問い合わせてよい.
+   */
+  class CContractionHierarchy
+  {
+  public:
+    //! ファイルの形式のバージョン. 形式を変えたら上げること.
+    static const unsigned FORMAT_VERSION = 1;
+    //! 行けない駅までの営業キロ.
+    static const int UNREACHABLE = -1;
+
+    //! 隣り合う駅の間の辺. 向きはない.
+    struct edge_t
+    {
+      station_id_t from, to;
+      line_id_t line;
+      //! 営業キロ(10倍).
+      int hecto;
+    };
+
+    //! 経路の1区間. lineでstationまで乗る.
+    struct step_t
+    {
+      line_id_t line;
+      station_id_t station;
+    };
+
+    //! 順位の高い駅への辺. ファイルにはこのまま書く.
+    struct arc_t
+    {
+      //! 行き先の頂点(順位).
+      std::uint32_t to;
+      //! 営業キロ(10倍).
+      std::int32_t hecto;
+      //! ショートカットなら縮約した頂点, 元の辺なら-1.
+      std::int32_t middle;
+      //! 元の辺の路線. ショートカットなら-1.
+      std::int32_t line;
+    };
+
+  private:
+    //! 順位の順の駅. 縮約した順なので, 後ろほど重要な駅.
+    station_vector stations;
+    std::uint64_t fingerprint;
+    //! 頂点iから出る辺はarcs[first[i]]からarcs[first[i+1]]の手前まで.
+    std::vector<std::uint32_t> first;
+    std::vector<arc_t> arcs;
+    typedef std::vector<std::pair<station_id_t, std::uint32_t> > VertexIndex;
+    //! 駅IDと頂点の組を駅IDの順に並べたもの.
+    VertexIndex vertex_of;
+
+    //! vertex_ofを作り, 表が正しいか調べる.
+    void index();
+
+    //! 駅の頂点. なければ頂点の数.
+    std::uint32_t find_vertex(station_id_t station) const;
+
+    /**
+     * 双方向の探索で2頂点間の営業キロを求める.
+     * @param[out] path nullptrでなければ, 通る頂点をfromからtoへの順に入れる.
+     *                  隣り合う頂点の間には辺(ショートカットを含む)がある.
+     */
+    int search(std::uint32_t from, std::uint32_t to,
+               std::vector<std::uint32_t> * path) const;
+
+    //! 頂点aとbの間の辺. 順位の低い方の頂点の辺から探す.
+    const arc_t & arc_between(std::uint32_t a, std::uint32_t b) const;
+
+    //! 頂点aからbへの辺を元の辺に戻してstepsに加える.
+    void unpack(std::uint32_t a, std::uint32_t b,
+                std::vector<step_t> & steps) const;
+
+  public:
+    /**
+     * Constructor.
+     * グラフを縮約する.
+     * @param[in] stations    駅. 辺のない駅も含む.
+     * @param[in] edges       隣り合う駅の間の辺.
+     * @param[in] fingerprint グラフの指紋.
+     * @throw std::invalid_argument 辺の駅がstationsにないか,
+     *                              営業キロが負の場合.
+     */
+    CContractionHierarchy(const station_vector & stations,
+                          const std::vector<edge_t> & edges,
+                          std::uint64_t fingerprint);
+
+    /**
+     * Constructor.
+     * Read the file written by write().
+     * @param[in] filename The filename to read.
+     * @throw IOException      The file cannot be read.
+     * @throw InvalidHierarchy The file is broken or in other version.
+     */
+    explicit CContractionHierarchy(const char * filename);
+
+    /**
+     * Write the hierarchy into file.
+     * @param[in] filename The filename to write.
+     * @throw IOException  Failed to write.
+     */
+    void write(const char * filename) const;
+
+    //! 作った時のグラフの指紋.
+    std::uint64_t get_fingerprint() const { return fingerprint; }
+
+    //! 駅の数.
+    size_t size() const { return stations.size(); }
+
+    //! ショートカットを含む辺の数.
+    size_t count_arcs() const { return arcs.size(); }
+
+    /**
+     * 2駅間の最短の営業キロ(10倍).
+     * @return 行けないか, 駅がなければUNREACHABLE.
+     */
+    int distance(station_id_t from, station_id_t to) const;
+
+    /**
+     * 2駅間の最短経路.
+     * 営業キロが同じなら, どの経路になるかは縮約の順による.
+     * 乗り換えの少ない経路はCRouteFinder::distance()で求める.
+     * @param[out] steps 経路の区間. 同じ路線の区間はまとめない.
+     * @return 営業キロ(10倍). 行けないか, 駅がなければUNREACHABLE.
+     */
+    int path(station_id_t from, station_id_t to,
+             std::vector<step_t> & steps) const;
+  };
+}
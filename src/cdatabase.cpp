@@ -1,8 +1,10 @@
 /* -*-coding: utf-8-*- */
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <cstdlib>
 #include <cstring>
+#include <atomic>
 
 #include "util.hpp"
 #include "sqlite3_wrapper.h"
@@ -11,6 +13,8 @@
 #include "csegment.h"
 #include "ckilo.h"
 #include "cstation.h"
+#include "cnetworksnapshot.h"
+#include "cnameindex.h"
 
 namespace ares
 {
@@ -34,22 +38,47 @@ namespace ares
     }
 
     /**
-     * check if a <= b. 等号がつくところに注意.
-     * @retval true  aが完全にbに内包されるとき(境界含む.)
-     * @retval false それ以外.
+     * データベース全体をメモリにコピーする.
+     * @param[in] name 共有キャッシュのURI. 省略すればその接続だけのコピー.
      */
-    bool isRangeLess(const std::pair<int, int> a, const std::pair<int, int> b)
+    std::unique_ptr<SQLite> copy_to_memory(SQLite & db,
+                                           const char * name=":memory:")
     {
-      int a_max = std::max(a.first, a.second);
-      int a_min = std::min(a.first, a.second);
-      int b_max = std::max(b.first, b.second);
-      int b_min = std::min(b.first, b.second);
-      return b_min <= a_min && a_max <= b_max;
+      std::unique_ptr<SQLite> memdb(
+        new SQLite(name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
+                   | SQLITE_OPEN_URI));
+      sqlite3_wrapper::SQLiteBackup backup(*memdb, "main", db, "main");
+      backup.step(-1);
+      return memdb;
     }
 
-    int getRangeLength(const std::pair<int, int> a)
+    std::atomic<unsigned long> database_serial(0);
+
+    /**
+     * 名前をまとめて解決する. 同じ名前は一度だけ検索する.
+     * @param[in] find 名前を受け取り, 見つかったIDを加える関数.
+     */
+    template<typename F>
+    void resolve(const std::vector<std::string> & names,
+                 std::vector<resolution_t> & result,
+                 F find)
     {
-      return std::abs(a.first - a.second);
+      std::unordered_map<std::string, size_t> resolved;
+      result.reserve(result.size() + names.size());
+      for(const std::string & name : names)
+      {
+        auto itr = resolved.find(name);
+        if(itr != resolved.end())
+        {
+          result.push_back(result[itr->second]);
+          continue;
+        }
+        resolved.insert(std::make_pair(name, result.size()));
+        resolution_t r;
+        find(name.c_str(), r.candidates);
+        r.id = r.candidates.size() == 1 ? r.candidates.front() : 0;
+        result.push_back(std::move(r));
+      }
     }
   }
 
@@ -57,12 +86,14 @@ namespace ares
   CDatabase::get_denshaid(const line_id_t line,
                           const std::pair<int, int> range) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_denshaid(line, range); }
     const char sql[] =
       "SELECT station.denshaid, station.denshacircleid"
       " FROM station NATURAL JOIN kilo NATURAL JOIN line"
       " WHERE lineid=? AND kilo BETWEEN ? AND ?"
       " GROUP BY station.denshaid, station.denshacircleid";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     stmt.bind(2, range.first);
     stmt.bind(3, range.second);
@@ -89,25 +120,182 @@ namespace ares
     return std::make_pair(denshaid, circleid);
   }
 
-  CDatabase::CDatabase(const char * dbname, bool memcache)
-    : db(new SQLite(dbname, SQLITE_OPEN_READONLY))
+  struct CDatabase::Connection
+  {
+    std::unique_ptr<SQLite> db;
+    std::unique_ptr<SQLiteStmtCache> stmt_cache;
+
+    explicit Connection(const std::string & name)
+      : db(new SQLite(name.c_str(), SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX
+                      | SQLITE_OPEN_URI)),
+        stmt_cache(new SQLiteStmtCache(*db)) {}
+  };
+
+  struct CDatabase::ConnectionPool
   {
-    if(memcache)
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Connection> > connections;
+
+    Connection & add(std::unique_ptr<Connection> connection)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      connections.push_back(std::move(connection));
+      return *connections.back();
+    }
+
+    void release(const Connection * connection)
     {
-      std::unique_ptr<SQLite> memdb(new SQLite(":memory:"));
+      std::lock_guard<std::mutex> lock(mutex);
+      connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                       [connection](
+                                         const std::unique_ptr<Connection> & c)
+                                       {
+                                         return c.get() == connection;
+                                       }),
+                        connections.end());
+    }
+  };
+
+  /**
+   * スレッドが終わると, まだあるCDatabaseのそのスレッドの接続を閉じる.
+   * 破棄したCDatabaseの項目は, 次に接続を開く時に除く.
+   */
+  struct CDatabase::LocalConnections
+  {
+    struct entry_t
+    {
+      std::weak_ptr<ConnectionPool> pool;
+      Connection * connection;
+    };
+    std::unordered_map<unsigned long, entry_t> entries;
+
+    ~LocalConnections()
+    {
+      for(const auto & entry : entries)
       {
-        sqlite3_wrapper::SQLiteBackup backup(*memdb, "main",
-                                             *db, "main");
-        backup.step(-1);
+        if(const auto pool = entry.second.pool.lock())
+        {
+          pool->release(entry.second.connection);
+        }
       }
-      db = std::move(memdb);
     }
+
+    void prune()
+    {
+      for(auto itr=entries.begin(); itr != entries.end();)
+      {
+        if(itr->second.pool.expired()) { itr = entries.erase(itr); }
+        else { ++itr; }
+      }
+    }
+  };
+
+  thread_local CDatabase::LocalConnections CDatabase::local_connections;
+
+  CDatabase::CDatabase(const char * dbname,
+                       bool memcache,
+                       bool use_snapshot,
+                       bool concurrent)
+    : db(new SQLite(dbname, SQLITE_OPEN_READONLY)),
+      dbname(dbname),
+      memcache(memcache),
+      concurrent(concurrent),
+      serial(++database_serial)
+  {
+    $.open();
+    if(use_snapshot)
+    {
+      snapshot.reset(new CNetworkSnapshot(*db));
+      names.reset(new CNameIndex(snapshot));
+    }
+  }
+
+  CDatabase::CDatabase(const char * dbname,
+                       std::shared_ptr<const CNetworkSnapshot> snapshot,
+                       bool memcache,
+                       bool concurrent)
+    : db(new SQLite(dbname, SQLITE_OPEN_READONLY)),
+      snapshot(snapshot),
+      dbname(dbname),
+      memcache(memcache),
+      concurrent(concurrent),
+      serial(++database_serial)
+  {
+    $.open();
+    // 索引の表はスナップショットの中にあるので, SQLで作り直さない.
+    if(snapshot) { names.reset(new CNameIndex(snapshot)); }
+  }
+
+  void CDatabase::open()
+  {
+    connection_name = dbname;
+    if(memcache && concurrent)
+    {
+      // スレッドごとの接続が共有するコピー. この接続が開いている間だけある.
+      connection_name = "file:ares-database-" + std::to_string(serial)
+        + "?mode=memory&cache=shared";
+      db = copy_to_memory(*db, connection_name.c_str());
+    }
+    else if(memcache) { db = copy_to_memory(*db); }
+    if(concurrent) { pool = std::make_shared<ConnectionPool>(); }
+    stmt_cache.reset(new SQLiteStmtCache(*db));
+    const char sql[] =
+      "SELECT lineid, marscode FROM alias_line WHERE marscode != ''";
+    SQLiteStmt & stmt = stmt_cache->get(sql, std::strlen(sql));
+    for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+    {
+      const std::string code = static_cast<const char *>(itr[1]);
+      marscodes[CNameField::normalize(code)] = itr[0];
+    }
+  }
+
+  CDatabase::~CDatabase()
+  {
+    // 他のスレッドの項目は, 接続と共にpoolが消えたことで分かる.
+    local_connections.entries.erase(serial);
+    pool.reset();
+    stmt_cache.reset();
+  }
+
+  SQLiteStmtCache & CDatabase::get_stmt_cache() const
+  {
+    if(!concurrent) { return *stmt_cache; }
+    auto itr = local_connections.entries.find(serial);
+    if(itr != local_connections.entries.end())
+    {
+      return *itr->second.connection->stmt_cache;
+    }
+    local_connections.prune();
+    Connection & connection =
+      pool->add(std::unique_ptr<Connection>(new Connection(connection_name)));
+    const LocalConnections::entry_t entry = {pool, &connection};
+    local_connections.entries[serial] = entry;
+    return *connection.stmt_cache;
+  }
+
+  size_t CDatabase::count_connections() const
+  {
+    if(!pool) { return 0; }
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    return pool->connections.size();
+  }
+
+  size_t CDatabase::get_stmt_cache_hit() const
+  {
+    return get_stmt_cache().hit();
+  }
+
+  size_t CDatabase::get_stmt_cache_miss() const
+  {
+    return get_stmt_cache().miss();
   }
 
   std::string CDatabase::get_line_name(line_id_t line) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_line_name(line).to_string(); }
     const char sql[] = "SELECT linename FROM line WHERE lineid = ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     SQLiteStmt::iterator result=stmt.execute();
     if(!result)
@@ -121,8 +309,10 @@ namespace ares
 
   std::string CDatabase::get_station_name(station_id_t station) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_station_name(station).to_string(); }
     const char sql[] = "SELECT stationname FROM station WHERE stationid = ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, station);
     SQLiteStmt::iterator result=stmt.execute();
     if(!result)
@@ -137,8 +327,10 @@ namespace ares
 
   std::string CDatabase::get_station_yomi(station_id_t station) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_station_yomi(station).to_string(); }
     const char sql[] = "SELECT stationyomi FROM station WHERE stationid = ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, station);
     SQLiteStmt::iterator result=stmt.execute();
     if(!result)
@@ -153,8 +345,10 @@ namespace ares
 
   std::string CDatabase::get_station_denryaku(station_id_t station) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_station_denryaku(station).to_string(); }
     const char sql[] = "SELECT stationdenryaku FROM station WHERE stationid = ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, station);
     SQLiteStmt::iterator result=stmt.execute();
     if(!result)
@@ -167,24 +361,124 @@ namespace ares
     return std::string(denryaku);
   }
 
+  boost::string_ref CDatabase::intern_name(NAME_KIND kind, int id) const
+  {
+    std::lock_guard<std::mutex> lock(interned_mutex);
+    const std::pair<int, int> key(kind, id);
+    auto itr = interned.find(key);
+    if(itr == interned.end())
+    {
+      std::string name;
+      switch(kind)
+      {
+      case NAME_LINE: name = $.get_line_name(id); break;
+      case NAME_STATION: name = $.get_station_name(id); break;
+      case NAME_STATION_YOMI: name = $.get_station_yomi(id); break;
+      case NAME_STATION_DENRYAKU: name = $.get_station_denryaku(id); break;
+      }
+      itr = interned.insert(std::make_pair(key, std::move(name))).first;
+    }
+    return itr->second;
+  }
+
+  boost::string_ref CDatabase::get_line_name_view(line_id_t line) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_line_name(line); }
+    return $.intern_name(NAME_LINE, line);
+  }
+
+  boost::string_ref
+  CDatabase::get_station_name_view(station_id_t station) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_station_name(station); }
+    return $.intern_name(NAME_STATION, station);
+  }
+
+  boost::string_ref
+  CDatabase::get_station_yomi_view(station_id_t station) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_station_yomi(station); }
+    return $.intern_name(NAME_STATION_YOMI, station);
+  }
+
+  boost::string_ref
+  CDatabase::get_station_denryaku_view(station_id_t station) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_station_denryaku(station); }
+    return $.intern_name(NAME_STATION_DENRYAKU, station);
+  }
+
+  void CDatabase::get_stations(const station_vector & stations,
+                               std::vector<CStation> & result) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    const char sql[] =
+      "SELECT stationid, stationname, stationyomi, stationdenryaku"
+      " FROM station WHERE stationid = ?";
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
+    for(const station_id_t station : stations)
+    {
+      // 前の結果を読みかけのままでは束縛できないので戻す.
+      stmt.reset();
+      stmt.bind(1, station);
+      SQLiteStmt::iterator itr=stmt.execute();
+      if(!itr)
+      {
+        std::stringstream ss;
+        ss << "station id not found: " << station;
+        throw std::out_of_range(ss.str());
+      }
+      result.push_back(CStation(itr[0],
+                                std::string(itr[1]),
+                                std::string(itr[2]),
+                                std::string(itr[3].is_null() ? "" : itr[3]),
+                                0, 0));
+    }
+  }
+
   void CDatabase::get_all_lines_name(std::vector<std::pair<
                                      line_id_t, std::string> > & result) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     const char sql[] = "SELECT lineid, linename FROM line ORDER BY lineyomi";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.fill_column(result, 0, 1);
   }
 
   void CDatabase::get_stations_of_line(line_id_t line,
                                        std::vector<CStation> &result) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    {
+      const liquid::ArrayView<CNetworkSnapshot::kilo_t> kilos =
+        snapshot->get_kilos_of_line(line);
+      if(kilos.empty()) { return; }
+      const bool is_main = snapshot->is_main_line(line);
+      for(const CNetworkSnapshot::kilo_t & kilo : kilos)
+      {
+        result.push_back(CStation(
+                           kilo.station,
+                           snapshot->get_station_name(kilo.station).to_string(),
+                           snapshot->get_station_yomi(kilo.station).to_string(),
+                           snapshot->get_station_denryaku(kilo.station)
+                           .to_string(),
+                           kilo.kilo,
+                           is_main ? kilo.kilo : CKilo::real2fake(kilo.kilo)));
+      }
+      return;
+    }
     const char sql[] =
       "SELECT station.stationid, station.stationname, station.stationyomi,"
       "       station.stationdenryaku, kilo.kilo, line.is_main"
       " FROM station NATURAL JOIN kilo NATURAL JOIN line"
       " WHERE line.lineid = ?"
       " ORDER BY kilo.kilo";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
     {
@@ -203,6 +497,9 @@ namespace ares
                                             station_id_t end,
                                             station_vector & result) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    { return snapshot->get_stations_of_segment(line, begin, end, result); }
     int kilo_begin=$.get_kilo(line, begin), kilo_end=$.get_kilo(line, end);
     const char sql_[] =
       "SELECT stationid FROM kilo"
@@ -210,7 +507,7 @@ namespace ares
       " ORDER BY kilo";
     std::string sql(sql_);
     if(kilo_begin > kilo_end) { sql += " DESC"; }
-    SQLiteStmt stmt(*db, sql);
+    SQLiteStmt & stmt = get_stmt_cache().get(sql);
     stmt.bind(1, line);
     stmt.bind(2, std::min(kilo_begin, kilo_end));
     stmt.bind(3, std::max(kilo_begin, kilo_end));
@@ -225,11 +522,19 @@ namespace ares
   void CDatabase::get_lines_of_station(station_id_t station,
                                        line_vector & result) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    {
+      const liquid::ArrayView<line_id_t> lines =
+        snapshot->get_lines_of_station(station);
+      result.insert(result.end(), lines.begin(), lines.end());
+      return;
+    }
     const char sql[] =
       "SELECT lineid"
       " FROM jointkilo"
       " WHERE stationid = ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, station);
     for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
     {
@@ -241,6 +546,7 @@ namespace ares
                               const find_mode mode,
                               line_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     this->find_lineid_with_name(name, mode, list);
     this->find_lineid_with_yomi(name, mode, list);
     this->find_lineid_with_alias(name, mode, list);
@@ -250,10 +556,16 @@ namespace ares
                                         const find_mode mode,
                                         line_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(names && CNameIndex::is_searchable(name))
+    {
+      names->find_lineid_with_name(name, mode, list);
+      return;
+    }
     std::string name_(name);
     name_ = add_percent(std::move(name_), mode);
     const char sql[] = "SELECT lineid FROM line WHERE linename LIKE ?;";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, name_);
     stmt.fill_column(list, 0);
   }
@@ -262,23 +574,87 @@ namespace ares
                                         const find_mode mode,
                                         line_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(names && CNameIndex::is_searchable(name))
+    {
+      names->find_lineid_with_yomi(name, mode, list);
+      return;
+    }
     std::string name_(name);
     name_ = add_percent(std::move(name_), mode);
     const char sql[] = "SELECT lineid FROM line WHERE lineyomi LIKE ?;";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
+    stmt.bind(1, name_);
+    stmt.fill_column(list, 0);
+  }
+
+  void CDatabase::find_lineid_with_alias(const char * name,
+                                         const find_mode mode,
+                                         line_vector & list) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    if(CNameIndex::is_searchable(name))
+    {
+      // 完全一致はスナップショットがなくてもハッシュ表で答える.
+      if(mode == FIND_EXACT)
+      {
+        auto itr = marscodes.find(CNameField::normalize(name));
+        if(itr != marscodes.end()) { list.push_back(itr->second); }
+        return;
+      }
+      if(names)
+      {
+        names->find_lineid_with_alias(name, mode, list);
+        return;
+      }
+    }
+    std::string name_(name);
+    name_ = add_percent(std::move(name_), mode);
+    const char sql[] =
+      "SELECT lineid FROM alias_line"
+      " WHERE marscode LIKE ? AND marscode != ''"
+      " ORDER BY lineid;";
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, name_);
     stmt.fill_column(list, 0);
   }
 
-  void CDatabase::find_lineid_with_alias(const char *,
-                                         const find_mode,
-                                         line_vector &) const
+  void CDatabase::find_lineid_with_key(const char * name,
+                                       const find_mode mode,
+                                       line_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    const std::string key = CNameIndex::normalize_key(name);
+    if(names && CNameIndex::is_searchable(key.c_str()))
+    {
+      names->find_lineid_with_key(key.c_str(), mode, list);
+      return;
+    }
+    const std::string key_ = add_percent(key, mode);
+    const char sql[] =
+      "SELECT lineid FROM line"
+      " WHERE linenamekey LIKE ?1 OR lineyomikey LIKE ?1"
+      " ORDER BY lineid;";
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
+    stmt.bind(1, key_);
+    stmt.fill_column(list, 0);
+  }
+
+  line_id_t CDatabase::get_lineid_with_marscode(const char * code) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    auto itr = marscodes.find(CNameField::normalize(code));
+    if(itr == marscodes.end())
+    {
+      throw DoesNotExist(code);
+    }
+    return itr->second;
   }
 
   line_id_t CDatabase::get_lineid(const char * name,
                                   const find_mode mode) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     line_vector v;
     find_lineid(name, mode, v);
     if(v.empty())
@@ -292,10 +668,21 @@ namespace ares
     return v[0];
   }
 
+  void CDatabase::resolve_lines(const std::vector<std::string> & names,
+                                std::vector<resolution_t> & result,
+                                const find_mode mode) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    resolve(names, result,
+            [this, mode](const char * name, line_vector & list)
+            { find_lineid(name, mode, list); });
+  }
+
   void CDatabase::find_stationid(const char * name,
                                  const find_mode mode,
                                  station_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     this->find_stationid_with_name(name, mode, list);
     this->find_stationid_with_yomi(name, mode, list);
     this->find_stationid_with_denryaku(name, mode, list);
@@ -305,12 +692,18 @@ namespace ares
                                            const find_mode mode,
                                            station_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(names && CNameIndex::is_searchable(name))
+    {
+      names->find_stationid_with_name(name, mode, list);
+      return;
+    }
     const char sql[] = "SELECT stationid FROM station WHERE stationname LIKE ? OR stationname LIKE ?";
     std::string name_norm(name);
     std::string name_paren("（%）");
     name_norm = add_percent(std::move(name_norm), mode);
     name_paren += name_norm;
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, name_norm);
     stmt.bind(2, name_paren);
     stmt.fill_column(list, 0);
@@ -320,11 +713,17 @@ namespace ares
                                            const find_mode mode,
                                            station_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(names && CNameIndex::is_searchable(name))
+    {
+      names->find_stationid_with_yomi(name, mode, list);
+      return;
+    }
     // SELECT id FROM station WHERE yomi LIKE 'name%';
     std::string name_(name);
     name_ = add_percent(std::move(name_), mode);
     const char sql[] = "SELECT stationid FROM station WHERE stationyomi LIKE ?;";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, name_);
     stmt.fill_column(list, 0);
   }
@@ -333,12 +732,18 @@ namespace ares
                                                const find_mode mode,
                                                station_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(names && CNameIndex::is_searchable(name))
+    {
+      names->find_stationid_with_denryaku(name, mode, list);
+      return;
+    }
     // SELECT id FROM station WHERE denryaku LIKE 'name%' OR denryaku LIKE '__name%';
     std::string name_(name);
     const size_t query_length = ares::u8strlen(name_);
     name_ = add_percent(std::move(name_), mode);
     const char sql[] = "SELECT stationid FROM station WHERE stationdenryaku LIKE ?;";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     if(query_length <= 2)
     {
       std::string name_onlystation("__");
@@ -353,9 +758,31 @@ namespace ares
     }
   }
 
+  void CDatabase::find_stationid_with_key(const char * name,
+                                          const find_mode mode,
+                                          station_vector & list) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    const std::string key = CNameIndex::normalize_key(name);
+    if(names && CNameIndex::is_searchable(key.c_str()))
+    {
+      names->find_stationid_with_key(key.c_str(), mode, list);
+      return;
+    }
+    const std::string key_ = add_percent(key, mode);
+    const char sql[] =
+      "SELECT stationid FROM station"
+      " WHERE stationnamekey LIKE ?1 OR stationyomikey LIKE ?1"
+      " ORDER BY stationid;";
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
+    stmt.bind(1, key_);
+    stmt.fill_column(list, 0);
+  }
+
   station_id_t CDatabase::get_stationid(const char * name,
                                         const find_mode mode) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     station_vector v;
     find_stationid(name, mode, v);
     if(v.empty())
@@ -369,16 +796,38 @@ namespace ares
     return v[0];
   }
 
+  void CDatabase::resolve_stations(const std::vector<std::string> & names,
+                                   std::vector<resolution_t> & result,
+                                   const find_mode mode) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    resolve(names, result,
+            [this, mode](const char * name, station_vector & list)
+            { find_stationid(name, mode, list); });
+  }
+
   void CDatabase::get_connect_line(line_id_t line,
                                    connect_vector & list) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    {
+      for(const station_id_t station : snapshot->get_junctions_of_line(line))
+      {
+        for(const line_id_t other : snapshot->get_lines_of_station(station))
+        {
+          if(other != line) { list.push_back(station_fqdn_t(other, station)); }
+        }
+      }
+      return;
+    }
     const char sql[] =
       "SELECT lineid, stationid FROM jointkilo"
       " WHERE stationid IN ("
       "  SELECT K2.stationid FROM kilo AS K2 WHERE lineid = ?1"
       " ) AND lineid != ?1"
       " ORDER BY stationid, linename";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     stmt.fill_column(list, 0, 1);
   }
@@ -386,19 +835,29 @@ namespace ares
   void CDatabase::get_belong_line(station_id_t station,
                                   line_vector & result) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    {
+      const liquid::ArrayView<line_id_t> lines =
+        snapshot->get_lines_of_station(station);
+      result.insert(result.end(), lines.begin(), lines.end());
+      return;
+    }
     const char sql[] =
       "SELECT lineid FROM jointkilo"
       " WHERE stationid = ? ORDER BY linename";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, station);
     stmt.fill_column(result, 0);
   }
 
   bool CDatabase::is_belong_to_line(line_id_t line, station_id_t station) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->is_belong_to_line(line, station); }
     const char sql[] =
       "SELECT * FROM kilo WHERE lineid = ? AND stationid = ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     stmt.bind(2, station);
     SQLiteStmt::iterator result=stmt.execute();
@@ -408,6 +867,12 @@ namespace ares
   bool CDatabase::is_contains(const CSegment & range,
                               const station_id_t station) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    {
+      return snapshot->is_contains(range.line, range.begin, range.end,
+                                   station);
+    }
     const char sql[] =
       "SELECT kilo FROM kilo WHERE lineid = ?1 AND stationid = ?2"
       " AND kilo BETWEEN"
@@ -416,7 +881,7 @@ namespace ares
       "  AND"
       "  (SELECT max(kilo) FROM kilo"
       "    WHERE lineid = ?1 AND stationid IN (?3, ?4))";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, range.line);
     stmt.bind(2, station);
     stmt.bind(3, range.begin);
@@ -427,9 +892,10 @@ namespace ares
 
   company_id_t CDatabase::get_company_id(const char * name) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     const char sql[] =
       "SELECT companyid FROM company WHERE companyname LIKE ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, name);
     SQLiteStmt::iterator result = stmt.execute();
     if (result) { return result[0]; }
@@ -438,9 +904,10 @@ namespace ares
 
   std::string CDatabase::get_company_name(const company_id_t id) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     const char sql[] =
       "SELECT companyname FROM company WHERE companyid = ?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, id);
     SQLiteStmt::iterator result = stmt.execute();
     if (result) { return static_cast<const char *>(result[0]); }
@@ -453,16 +920,23 @@ namespace ares
                                 company_id_t company,
                                 int kilo) const
   {
-    const char sql[] =
-      "SELECT fare.fare FROM fare WHERE type = ?1 AND companyid = ?2"
-      " AND minkilo <= ?3"
-      " AND maxkilo >= ?3";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
-    stmt.bind(1, table);
-    stmt.bind(2, company);
-    stmt.bind(3, kilo);
-    SQLiteStmt::iterator result = stmt.execute();
-    if (result) { return result[0]; }
+    ARES_PROFILE_SCOPE(profiler);
+    boost::optional<int> fare;
+    if(snapshot) { fare = snapshot->get_fare_table(table, company, kilo); }
+    else
+    {
+      const char sql[] =
+        "SELECT fare.fare FROM fare WHERE type = ?1 AND companyid = ?2"
+        " AND minkilo <= ?3"
+        " AND maxkilo >= ?3";
+      SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
+      stmt.bind(1, table);
+      stmt.bind(2, company);
+      stmt.bind(3, kilo);
+      SQLiteStmt::iterator result = stmt.execute();
+      if (result) { fare = static_cast<int>(result[0]); }
+    }
+    if (fare) { return *fare; }
     std::stringstream ss;
     ss << "Invalid fare table: " << table
        << " company: " << $.get_company_name(company)
@@ -476,13 +950,19 @@ namespace ares
                                                          int realkilo,
                                                          int fakekilo) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    {
+      return snapshot->get_fare_country_table(table, company,
+                                              realkilo, fakekilo);
+    }
     const char sql[] =
       "SELECT fare FROM fare_country WHERE type = ?1 AND companyid = ?2"
       " AND (realkilo = ?3    AND fakekilo = ?4"
       "      OR"
       "      realkilo is NULL AND fakekilo = ?4"
       "     )";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, table);
     stmt.bind(2, company);
     stmt.bind(3, realkilo);
@@ -491,12 +971,34 @@ namespace ares
     return result ? boost::make_optional<int>(result[0]) : boost::none;
   }
 
+  void CDatabase::get_fare_country_table(
+    const char * table,
+    company_id_t company,
+    const std::vector<std::pair<int, int> > & kilos,
+    std::vector<boost::optional<int> > & result) const
+  {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot)
+    {
+      snapshot->get_fare_country_table(table, company, kilos, result);
+      return;
+    }
+    result.resize(kilos.size());
+    for(size_t i=0; i<kilos.size(); ++i)
+    {
+      result[i] = $.get_fare_country_table(table, company,
+                                           kilos[i].first, kilos[i].second);
+    }
+  }
+
   int CDatabase::get_kilo(const line_id_t line,
                           const station_id_t station) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_kilo(line, station); }
     const char sql[] =
       "SELECT kilo FROM kilo WHERE lineid=? AND stationid=?";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     stmt.bind(2, station);
     SQLiteStmt::iterator result = stmt.execute();
@@ -509,15 +1011,17 @@ namespace ares
                                                       station_id_t begin,
                                                       station_id_t end) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_special_fare(line, begin, end); }
     const char sql[] =
       "SELECT is_add, fare, beginstation, endstation FROM fare_special"
       " WHERE lineid=?1 ";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     stmt.bind(2, begin);
     stmt.bind(3, end);
     boost::optional<std::pair<bool,int> > ret;
-    int length=0;
+    int length=0, ret_begin=0;
     std::pair<int, int> q_range = $.get_range(line, begin, end);
     for(SQLiteStmt::iterator itr = stmt.execute(); itr; ++itr)
     {
@@ -527,8 +1031,16 @@ namespace ares
       if((d_begin==begin && d_end==end) || (d_end==begin && d_begin==end))
       { return curr_fare; }
       std::pair<int, int> d_range = $.get_range(line, d_begin, d_end);
-      if(isRangeLess(d_range, q_range) && length < getRangeLength(d_range))
-      { ret = curr_fare; }
+      if(!isRangeLess(d_range, q_range)) { continue; }
+      // The longest one. Ties go to the one with smaller kilo.
+      const int d_length = getRangeLength(d_range);
+      const int d_min = std::min(d_range.first, d_range.second);
+      if(length < d_length || (ret && length == d_length && d_min < ret_begin))
+      {
+        ret = curr_fare;
+        length = d_length;
+        ret_begin = d_min;
+      }
     }
     return ret;
   }
@@ -537,10 +1049,12 @@ namespace ares
                                            const station_id_t begin,
                                            const station_id_t end) const
   {
+    ARES_PROFILE_SCOPE(profiler);
+    if(snapshot) { return snapshot->get_range(line, begin, end); }
     const char sql[] =
       "SELECT min(kilo), max(kilo) FROM kilo"
       " WHERE lineid = ? AND stationid IN (?, ?)";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     stmt.bind(2, begin);
     stmt.bind(3, end);
@@ -558,13 +1072,6 @@ namespace ares
   }
 
   /**
-   * @note この実装は1路線にたかだか2会社しか入らないことを暗黙の仮定にしている。
-   * 更に言うと、2会社の境界駅は1つであることを仮定している。
-   * 仮にJR東海が運賃体系を変えるようなことが起これば大変なことになる。
-   * あとSQLのテーブルの組み方自体がlineの会社設定とkiloの会社設定の2つだけで
-   * 成り立っているので、lineで設定していない会社同士が接するような状態も
-   * 設定できない。ただ、正直どれも起こりそうにないので真面目に実装はしない。
-   * @note この実装は2会社にまたがる路線が幹線であることを仮定している。
    * @note 戻り値をboolじゃなくて結果の配列にしたい。
    */
   bool CDatabase::get_company_and_kilo(const line_id_t line,
@@ -575,6 +1082,7 @@ namespace ares
                                        DENSHA_SPECIAL_TYPE & denshaid,
                                        DENSHA_SPECIAL_TYPE & circleid) const
   {
+    ARES_PROFILE_SCOPE(profiler);
     std::pair<int, int> range = $.get_range(line, begin, end);
     {
       const std::pair<DENSHA_SPECIAL_TYPE, DENSHA_SPECIAL_TYPE>
@@ -582,57 +1090,83 @@ namespace ares
       denshaid = densha.first;
       circleid = densha.second;
     }
+    if(snapshot)
+    {
+      return snapshot->get_company_and_kilo(line, range, result, is_main);
+    }
+    // 駅から次の駅までの区間は手前の駅の会社に属する.
+    // 会社が変わる駅で区切るので, 会社がいくつあってもよい.
+    // ふつうは会社ごとの駅が続いているので, 会社ごとに集計して
+    // 最小キロの順に並べれば区切りが分かる.
     const char sql[] =
-      "SELECT MIN(kilo.kilo), MAX(kilo.kilo), "
-      "       line.linecompanyid, kilo.kilocompanyid, line.is_main"
+      "SELECT MIN(kilo.kilo), MAX(kilo.kilo),"
+      "       IFNULL(kilo.kilocompanyid, line.linecompanyid) AS company,"
+      "       line.is_main"
       " FROM kilo NATURAL JOIN line"
       " WHERE lineid=? AND kilo BETWEEN ? AND ?"
-      " GROUP BY line.linecompanyid, kilo.kilocompanyid, line.is_main";
-    SQLiteStmt stmt(*db, sql, std::strlen(sql));
+      " GROUP BY company"
+      " ORDER BY MIN(kilo.kilo)";
+    SQLiteStmt & stmt = get_stmt_cache().get(sql, std::strlen(sql));
     stmt.bind(1, line);
     stmt.bind(2, range.first);
     stmt.bind(3, range.second);
-    company_id_t comp_main=-1, comp_sub=-1;
-    // 0 means begin, 1 means end
-    int main[2]={0};
-    int sub[2]={0};
+    const size_t size_before = result.size();
     int kilo_max=0, kilo_min=INT_MAX;
+    bool interleaved = false;
     for(SQLiteStmt::iterator itr=stmt.execute(), end; itr != end; ++itr)
     {
-      const int
-        kilo_temp_max = itr[1],
-        kilo_temp_min = itr[0];
-      is_main = static_cast<int>(itr[4]);
-      kilo_max = std::max(kilo_max, kilo_temp_max);
-      kilo_min = std::min(kilo_min, kilo_temp_min);
-      // kilocompanyid exists
-      if(!itr[3].is_null())
+      const int first = itr[0], last = itr[1];
+      const company_id_t company = itr[2];
+      is_main = static_cast<int>(itr[3]);
+      // 前の会社の駅がこの会社の最初の駅より先にもある.
+      if(result.size() > size_before)
       {
-        sub[0] = kilo_temp_min;
-        sub[1] = kilo_temp_max;
-        comp_sub = itr[3];
-      }else{
-        main[0] = kilo_temp_min;
-        main[1] = kilo_temp_max;
-        comp_main = itr[2];
+        interleaved = interleaved || kilo_max > first;
+        result.back().end = first;
+      }
+      kilo_min = std::min(kilo_min, first);
+      kilo_max = std::max(kilo_max, last);
+      result.push_back({company, first, last});
+    }
+    if(interleaved)
+    {
+      // 会社の駅が交互に現れる路線は, 駅をキロ程の順にたどる.
+      const char sql_stations[] =
+        "SELECT kilo.kilo, IFNULL(kilo.kilocompanyid, line.linecompanyid),"
+        "       line.is_main"
+        " FROM kilo NATURAL JOIN line"
+        " WHERE lineid=? AND kilo BETWEEN ? AND ?"
+        " ORDER BY kilo.kilo";
+      SQLiteStmt & stmt = get_stmt_cache().get(sql_stations,
+                                               std::strlen(sql_stations));
+      stmt.bind(1, line);
+      stmt.bind(2, range.first);
+      stmt.bind(3, range.second);
+      result.resize(size_before);
+      for(SQLiteStmt::iterator itr=stmt.execute(), end; itr != end; ++itr)
+      {
+        const int kilo = itr[0];
+        const company_id_t company = itr[1];
+        if(result.size() > size_before && result.back().company == company)
+        { continue; }
+        if(result.size() > size_before) { result.back().end = kilo; }
+        result.push_back({company, kilo, kilo});
       }
     }
-    const int kilo_all = kilo_max - kilo_min;
     // Cannot get results. maybe line, begin, end are bad.
-    if(kilo_all == 0) { return false; }
-    // if kilo_main & kilo_sub exists, main[] is not correct.
-    if(comp_main != -1 && comp_sub != -1)
-    {
-      // main is near than sub.
-      if(main[0] < sub[0]) { main[1] = sub[0]; }
-      // sub is near than main. this is not probable in current JR.
-      else { main[0] = sub[1]; }
-    }
-    const int
-      kilo_main = main[1] - main[0],
-      kilo_sub  =  sub[1] -  sub[0];
-    if(kilo_main != 0) { result.push_back({comp_main, main[0], main[1]}); }
-    if(kilo_sub  != 0) { result.push_back({comp_sub ,  sub[0] , sub[1]}); }
+    if(kilo_max - kilo_min <= 0)
+    {
+      result.resize(size_before);
+      return false;
+    }
+    result.back().end = kilo_max;
+    // 同じキロ程の駅で会社が変わる所には長さ0の区間ができるので除く.
+    result.erase(std::remove_if(result.begin() + size_before, result.end(),
+                                [](const CKiloValue & value)
+                                {
+                                  return value.begin == value.end;
+                                }),
+                 result.end());
     return true;
   }
 }
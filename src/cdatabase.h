@@ -2,15 +2,22 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <unordered_map>
 #include <stdexcept>
 #include <boost/utility.hpp>
 #include <boost/optional.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/utility/string_ref.hpp>
 #include "ares.h"
+#include "cqueryprofiler.h"
 
 namespace sqlite3_wrapper
 {
   class SQLite;
+  class SQLiteStmtCache;
   class IOException;
 }
 
@@ -24,11 +31,33 @@ namespace ares
   };
 
   using sqlite3_wrapper::SQLite;
+  using sqlite3_wrapper::SQLiteStmtCache;
   typedef sqlite3_wrapper::IOException IOException;
 
   class CSegment;
   class CKiloValue;
   class CStation;
+  class CNetworkSnapshot;
+  class CNameIndex;
+
+  /**
+   * @~english
+   * Result of resolving a name by CDatabase::resolve_stations()
+   * or CDatabase::resolve_lines().
+   */
+  /**
+   * @~japanese
+   * まとめて名前を解決した結果.
+   * get_stationid()やget_lineid()と異なり,
+   * 見つからなくても複数見つかっても例外を投げずに候補を返す.
+   */
+  struct resolution_t
+  {
+    //! 1つだけ見つかればそのID. それ以外は0.
+    int id;
+    //! 見つかった全てのID.
+    std::vector<int> candidates;
+  };
 
   /**
    * @~english
@@ -66,19 +95,138 @@ namespace ares
    * Database object of ares wrapping sqlite3 object.
    * With this object, you can search station or line name,
    * get connections of lines and so on.
+   *
+   * By default an object must not be used from multiple threads at once.
+   * In the concurrent mode, each thread opens its own read-only
+   * connection and statement cache on first use, while the snapshot and
+   * the name indexes are shared, so const member functions can be called
+   * from any number of threads at the same time, e.g. by CRoute objects
+   * sharing one std::shared_ptr<CDatabase>.
+   * With memcache the database is copied into memory only once and the
+   * connections of all threads share that copy. A connection is closed
+   * when its thread exits or when the object is destroyed.
    */
   class CDatabase : boost::noncopyable
   {
   private:
     std::unique_ptr<SQLite> db;
+    //! dbに対するプリペアドステートメントのキャッシュ. dbより先に破棄する.
+    std::unique_ptr<SQLiteStmtCache> stmt_cache;
+    //! 路線網と運賃表のスナップショット. なければSQLで問い合わせる.
+    std::shared_ptr<const CNetworkSnapshot> snapshot;
+    //! 駅名と路線名の索引. スナップショットの中の表をそのまま使う.
+    std::unique_ptr<const CNameIndex> names;
+    //! MARSの路線略号から路線IDへ. 英字は小文字にする.
+    std::unordered_map<std::string, line_id_t> marscodes;
+
+    //! 並行モードでスレッドごとに開く接続とステートメントキャッシュ.
+    struct Connection;
+    //! 並行モードで開いている接続.
+    struct ConnectionPool;
+    //! スレッドごとの, CDatabaseの通し番号から接続へ.
+    struct LocalConnections;
+    const std::string dbname;
+    const bool memcache;
+    //! 並行モードならtrue.
+    const bool concurrent;
+    //! スレッドごとの接続を探すための, このオブジェクトの通し番号.
+    const unsigned long serial;
+    //! スレッドごとの接続で開くデータベース. memcacheなら共有のメモリ上のコピー.
+    std::string connection_name;
+    //! スレッドごとの接続. このオブジェクトと共に閉じる.
+    std::shared_ptr<ConnectionPool> pool;
+    static thread_local LocalConnections local_connections;
+
+    //! 問い合わせの計測. ARES_PROFILEを定義した時だけ記録する.
+    mutable CQueryProfiler profiler;
+
+    //! 名前の種類. 名前のビューをスナップショットなしで返す時に使う.
+    enum NAME_KIND
+    {
+      NAME_LINE,
+      NAME_STATION,
+      NAME_STATION_YOMI,
+      NAME_STATION_DENRYAKU,
+    };
+    mutable std::mutex interned_mutex;
+    /**
+     * スナップショットがない時に問い合わせた名前.
+     * 返したビューが無効にならないよう, 要素の動かないstd::mapに持つ.
+     */
+    mutable std::map<std::pair<int, int>, std::string> interned;
+
+    //! 名前を一度だけ問い合わせ, このオブジェクトが持つ文字列のビューを返す.
+    boost::string_ref intern_name(NAME_KIND kind, int id) const;
+
+    //! 必要ならメモリにコピーし, ステートメントキャッシュを用意する.
+    void open();
+
+    /**
+     * 問い合わせに使うステートメントキャッシュを返す.
+     * 並行モードなら呼び出したスレッドの接続のものを返し,
+     * なければ接続を開く.
+     */
+    SQLiteStmtCache & get_stmt_cache() const;
 
   public:
     /**
      * Constructor.
      * Construct a CDatabase object with database filename.
-     * @param[in] dbname The filename of SQLite database.
+     * @param[in] dbname       The filename of SQLite database.
+     * @param[in] memcache     Copy whole database into memory if true.
+     * @param[in] use_snapshot Load the network into CNetworkSnapshot if true.
+     *                         Lookups of kilo and fare are served from it,
+     *                         and names are searched with CNameIndex.
+     * @param[in] concurrent   Use the concurrent mode if true.
+     *                         With memcache, the threads share
+     *                         one copy in memory.
      */
-    CDatabase(const char * dbname, bool memcache=true);
+    CDatabase(const char * dbname,
+              bool memcache=true,
+              bool use_snapshot=false,
+              bool concurrent=false);
+
+    /**
+     * Constructor.
+     * Construct a CDatabase object sharing a snapshot already loaded,
+     * e.g. mapped from the file written by CNetworkSnapshot::write().
+     * @param[in] dbname   The filename of SQLite database.
+     * @param[in] snapshot The snapshot to serve lookups of kilo and fare.
+     *                     Names are searched with CNameIndex
+     *                     on the tables in the snapshot.
+     * @param[in] memcache Copy whole database into memory if true.
+     * @param[in] concurrent Use the concurrent mode if true.
+     */
+    CDatabase(const char * dbname,
+              std::shared_ptr<const CNetworkSnapshot> snapshot,
+              bool memcache=false,
+              bool concurrent=false);
+
+    ~CDatabase();
+
+    //! プリペアドステートメントキャッシュにヒットした回数.
+    //! 並行モードなら呼び出したスレッドの回数.
+    size_t get_stmt_cache_hit() const;
+
+    //! プリペアドステートメントキャッシュにミスした回数.
+    //! 並行モードなら呼び出したスレッドの回数.
+    size_t get_stmt_cache_miss() const;
+
+    /**
+     * 問い合わせの計測.
+     * ARES_PROFILEを定義してコンパイルし, set_enabled(true)とした後の
+     * 各問い合わせの回数, 行数, 経過時間を記録する. 並行モードでも全スレッド分.
+     */
+    CQueryProfiler & get_profiler() const { return profiler; }
+
+    //! 並行モードならtrue.
+    bool is_concurrent() const { return concurrent; }
+
+    //! 並行モードで開いているスレッドごとの接続の数.
+    size_t count_connections() const;
+
+    //! スナップショットを返す. 使っていなければnullptr.
+    const CNetworkSnapshot * get_snapshot() const { return snapshot.get(); }
 
     /**
      * Convert function from line id to name.
@@ -108,6 +256,34 @@ namespace ares
      */
     std::string get_station_denryaku(station_id_t station) const;
 
+    /**
+     * @~english
+     * Zero-copy versions of the name getters above.
+     * The returned view is valid while this object is alive.
+     */
+    /**
+     * @~japanese
+     * 上の名前の取得の, コピーしない版.
+     * スナップショットがあればその文字列をそのまま指し,
+     * なければ最初の1回だけ問い合わせてこのオブジェクトに持つ.
+     * どちらも確保も問い合わせもしないので, 経路の表示など何度も呼ぶ所で使う.
+     * 返したビューはこのオブジェクトが破棄されるまで有効.
+     * @throw std::out_of_range IDがない場合.
+     */
+    boost::string_ref get_line_name_view(line_id_t line) const;
+    boost::string_ref get_station_name_view(station_id_t station) const;
+    boost::string_ref get_station_yomi_view(station_id_t station) const;
+    boost::string_ref get_station_denryaku_view(station_id_t station) const;
+
+    /**
+     * 駅ID, 駅名, 読み, 電略をまとめて取得する.
+     * 電略がなければ空文字列, キロ程は0とする.
+     * @param[in]  stations 取得したい駅IDの配列.
+     * @param[out] result   結果を加える配列.
+     */
+    void get_stations(const station_vector & stations,
+                      std::vector<CStation> & result) const;
+
     /**
      * すべての路線名を返す.
      * @param[out] result 路線IDとUTF-8エンコードされた駅名.
@@ -137,6 +313,7 @@ namespace ares
 
     /**
      * 指定された駅の所属する路線の集合を返す.
+     * スナップショットがあればget_belong_line()と同じく路線名の順.
      * @param[in]  station 結果を得たい駅ID.
      * @param[out] result  結果を格納する配列.
      */
@@ -161,11 +338,47 @@ namespace ares
     void find_lineid_with_yomi(const char * name,
                                const find_mode mode,
                                line_vector & list) const;
-    //! Find lines from line name with alias.
+    /**
+     * Find lines from alias, the line code of MARS.
+     * FIND_EXACT is answered from the hashed index in constant time.
+     */
     void find_lineid_with_alias(const char * name,
                                 const find_mode mode,
                                 line_vector & list) const;
 
+    /**
+     * Get the line's id from the line code of MARS, such as "トホシ".
+     * @param[in] code The line code.
+     * @return line id.
+     * @throw DoesNotExist no line has the code.
+     */
+    line_id_t get_lineid_with_marscode(const char * code) const;
+
+    /**
+     * Resolve line names in one pass.
+     * Each name is searched like get_lineid(), but only once
+     * even if it appears many times in names.
+     * @param[in]  names  Line names to resolve.
+     * @param[out] result Results are added in the order of names.
+     * @param[in]  mode   Specify searching mode.
+     */
+    void resolve_lines(const std::vector<std::string> & names,
+                       std::vector<resolution_t> & result,
+                       const find_mode mode = FIND_EXACT) const;
+
+    /**
+     * Find lines from line name or yomi, without distinction of
+     * katakana and hiragana, full-width and half-width forms.
+     * The query is normalized once by CNameIndex::normalize_key()
+     * and matched against the keys precomputed by mksql.py.
+     * @param[in]  name Specify string to find.
+     * @param[in]  mode Specify searching mode.
+     * @param[out] list vector to add found line id's in the order of id.
+     */
+    void find_lineid_with_key(const char * name,
+                              const find_mode mode,
+                              line_vector & list) const;
+
     /**
      * Get the line's id from line name.
      * @param[in]  name Specify string to get.
@@ -192,6 +405,15 @@ namespace ares
                                       const find_mode mode,
                                       station_vector & list) const;
 
+    /**
+     * Find stations from station name or yomi, without distinction of
+     * katakana and hiragana, full-width and half-width forms.
+     * @see find_lineid_with_key()
+     */
+    void find_stationid_with_key(const char * name,
+                                 const find_mode mode,
+                                 station_vector & list) const;
+
     /**
      * Get the station's id from station name.
      * @param[in] name Specify string to get.
@@ -201,7 +423,25 @@ namespace ares
     station_id_t get_stationid(const char * name,
                                const find_mode mode = FIND_EXACT) const;
 
-    //! Get lines' id connecting with.
+    /**
+     * Resolve station names in one pass.
+     * Each name is searched like get_stationid(), but only once
+     * even if it appears many times in names.
+     * @param[in]  names  Station names to resolve.
+     * @param[out] result Results are added in the order of names.
+     * @param[in]  mode   Specify searching mode.
+     */
+    void resolve_stations(const std::vector<std::string> & names,
+                          std::vector<resolution_t> & result,
+                          const find_mode mode = FIND_EXACT) const;
+
+    /**
+     * Get lines' id connecting with.
+     * With the snapshot, this and get_belong_line() copy the adjacency
+     * lists built at load, CNetworkSnapshot::get_junctions_of_line() and
+     * CNetworkSnapshot::get_lines_of_station(). Use them directly to walk
+     * the network without copying.
+     */
     void get_connect_line(line_id_t line,
                           connect_vector & list) const;
 
@@ -236,6 +476,19 @@ namespace ares
                                                 int realkilo,
                                                 int fakekilo) const;
 
+    /**
+     * JR四国・九州の地方交通線特例運賃表をまとめて引く.
+     * @param[in]  table   運賃表の種別.
+     * @param[in]  company 会社ID.
+     * @param[in]  kilos   実キロと擬制キロの組の配列.
+     * @param[out] result  各組の運賃. 該当がなければ無効値.
+     */
+    void get_fare_country_table(const char * table,
+                                company_id_t company,
+                                const std::vector<std::pair<int, int> > & kilos,
+                                std::vector<boost::optional<int> > & result)
+      const;
+
     //! 加算運賃や社線運賃の表を引く
     boost::optional<
       std::pair<bool,int> > get_special_fare(line_id_t line,
@@ -0,0 +1,88 @@
+/* -*-coding: utf-8-*- */
+#include <atomic>
+
+#include "util.hpp"
+#include "cdatabase.h"
+#include "cdatabaseholder.h"
+
+namespace ares
+{
+  CDatabaseHolder::CDatabaseHolder(const char * dbname,
+                                   bool memcache,
+                                   bool use_snapshot,
+                                   bool concurrent)
+    : CDatabaseHolder(std::make_shared<CDatabase>(dbname, memcache,
+                                                  use_snapshot, concurrent),
+                      memcache, use_snapshot, concurrent)
+  {
+  }
+
+  CDatabaseHolder::CDatabaseHolder(std::shared_ptr<CDatabase> db,
+                                   bool memcache,
+                                   bool use_snapshot,
+                                   bool concurrent)
+    : state(new state_t{std::make_shared<const entry_t>(entry_t{db, 1})}),
+      memcache(memcache),
+      use_snapshot(use_snapshot),
+      concurrent(concurrent)
+  {
+  }
+
+  std::shared_ptr<const CDatabaseHolder::entry_t>
+  CDatabaseHolder::state_t::load() const
+  {
+    return std::atomic_load(&current);
+  }
+
+  unsigned long CDatabaseHolder::state_t::publish(std::shared_ptr<CDatabase> db)
+  {
+    std::shared_ptr<const entry_t> expected = $.load();
+    std::shared_ptr<const entry_t> desired;
+    // 同時に差し替えられても版が重ならないように比較して置き換える.
+    do
+    {
+      desired.reset(new entry_t{db, expected->version + 1});
+    } while(!std::atomic_compare_exchange_weak(&current, &expected, desired));
+    return desired->version;
+  }
+
+  std::shared_ptr<CDatabase> CDatabaseHolder::get() const
+  {
+    unsigned long version;
+    return $.get(version);
+  }
+
+  std::shared_ptr<CDatabase> CDatabaseHolder::get(unsigned long & version) const
+  {
+    const std::shared_ptr<const entry_t> entry = state->load();
+    version = entry->version;
+    return entry->db;
+  }
+
+  unsigned long CDatabaseHolder::get_version() const
+  {
+    return state->load()->version;
+  }
+
+  unsigned long CDatabaseHolder::publish(std::shared_ptr<CDatabase> db)
+  {
+    return state->publish(db);
+  }
+
+  std::future<unsigned long> CDatabaseHolder::reload(const std::string & dbname)
+  {
+    // thisではなく状態と引数を持つので, 入れ物が先に破棄されてもよい.
+    const std::shared_ptr<state_t> state = $.state;
+    const bool memcache = $.memcache;
+    const bool use_snapshot = $.use_snapshot;
+    const bool concurrent = $.concurrent;
+    return std::async(std::launch::async,
+                      [state, dbname, memcache, use_snapshot, concurrent]()
+      {
+        std::shared_ptr<CDatabase> db =
+          std::make_shared<CDatabase>(dbname.c_str(), memcache,
+                                      use_snapshot, concurrent);
+        return state->publish(db);
+      });
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <future>
+#include <boost/utility.hpp>
+#include "ares.h"
+
+namespace ares
+{
+  class CDatabase;
+
+  /**
+   * @~english
+   * Versioned holder of CDatabase to replace it without stopping readers.
+   */
+  /**
+   * @~japanese
+   * 運賃や路線のデータを止めずに差し替えるための, 版付きのCDatabaseの入れ物.
+   * reload()は新しいデータベースを別スレッドで読み込み,
+   * 読み込み終えてから差し替える. 差し替えはポインタの置き換えだけで,
+   * 読み出し側はロックを取らない.
+   * get()で得たポインタを持つ間は(CRouteに渡した場合も含めて)
+   * 古い版を使い続けられ, 最後の参照がなくなった時に古い版は破棄される.
+   * 複数のスレッドから使うなら並行モードのCDatabaseにすること.
+   */
+  class CDatabaseHolder : boost::noncopyable
+  {
+  private:
+    //! データベースとその版.
+    struct entry_t
+    {
+      std::shared_ptr<CDatabase> db;
+      unsigned long version;
+    };
+    /**
+     * 現在の版を持つ状態. reload()の読み込み中に入れ物が破棄されても,
+     * 読み込むスレッドが参照を持つので残る.
+     */
+    struct state_t
+    {
+      //! 現在の版. std::atomic_load()とstd::atomic_store()で読み書きする.
+      std::shared_ptr<const entry_t> current;
+
+      std::shared_ptr<const entry_t> load() const;
+
+      unsigned long publish(std::shared_ptr<CDatabase> db);
+    };
+    const std::shared_ptr<state_t> state;
+    //! reload()でCDatabaseを作る時の引数.
+    const bool memcache, use_snapshot, concurrent;
+
+  public:
+    /**
+     * Constructor.
+     * Load the first version from the database file.
+     * The options are the same as CDatabase and used also by reload().
+     */
+    CDatabaseHolder(const char * dbname,
+                    bool memcache=true,
+                    bool use_snapshot=false,
+                    bool concurrent=false);
+
+    /**
+     * 読み込み済みのCDatabaseを最初の版にする.
+     * memcache, use_snapshotとconcurrentはreload()でCDatabaseを作る時に使う.
+     */
+    CDatabaseHolder(std::shared_ptr<CDatabase> db,
+                    bool memcache,
+                    bool use_snapshot,
+                    bool concurrent);
+
+    /**
+     * 現在の版のデータベースを返す.
+     * 返したポインタを持つ間, その版は破棄されない.
+     */
+    std::shared_ptr<CDatabase> get() const;
+
+    //! 現在の版のデータベースと, その版を返す.
+    std::shared_ptr<CDatabase> get(unsigned long & version) const;
+
+    //! 現在の版. 最初は1で, 差し替えるごとに1増える.
+    unsigned long get_version() const;
+
+    /**
+     * データベースを差し替える.
+     * @return 新しい版.
+     */
+    unsigned long publish(std::shared_ptr<CDatabase> db);
+
+    /**
+     * 別スレッドでデータベースを読み込み, 読み込めたら差し替える.
+     * 読み込みに失敗したら差し替えず, 例外はfutureから投げられる.
+     * 読み込み終わる前に入れ物を破棄してもよい.
+     * @param[in] dbname 新しいデータベースのファイル名.
+     * @return 新しい版を返すfuture.
+     */
+    std::future<unsigned long> reload(const std::string & dbname);
+  };
+}
@@ -0,0 +1,128 @@
+/* -*-coding: utf-8-*- */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "util.hpp"
+#include "sqlite3_wrapper.h"
+#include "clandmarks.h"
+
+namespace ares
+{
+  using sqlite3_wrapper::IOException;
+
+  namespace
+  {
+    const char FILE_MAGIC[8] = {'A', 'R', 'E', 'S', 'A', 'L', 'T', '\0'};
+    const std::uint32_t FILE_BYTE_ORDER = 0x01020304;
+
+    //! ファイルの先頭に置くヘッダ. 目印の駅IDと営業キロの表が続く.
+    struct file_header_t
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byte_order;
+      std::uint32_t nlandmark;
+      std::uint32_t nnode;
+      std::uint64_t fingerprint;
+    };
+  }
+
+  const std::int32_t CLandmarks::UNREACHABLE;
+
+  CLandmarks::CLandmarks(const station_vector & stations,
+                         std::uint64_t fingerprint,
+                         const std::vector<std::int32_t> & table)
+    : stations(stations), fingerprint(fingerprint), table(table)
+  {
+    if(stations.empty() || table.size() % stations.size() != 0)
+    {
+      throw std::invalid_argument("landmark table does not fit stations");
+    }
+  }
+
+  CLandmarks::CLandmarks(const char * filename)
+  {
+    std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+    if(!ifs)
+    {
+      throw IOException(std::string("cannot open landmarks: ") + filename);
+    }
+    const std::string data((std::istreambuf_iterator<char>(ifs)),
+                           std::istreambuf_iterator<char>());
+    if(ifs.bad())
+    {
+      throw IOException(std::string("cannot read landmarks: ") + filename);
+    }
+    file_header_t header;
+    if(data.size() < sizeof(header))
+    { throw InvalidLandmarks("too small file"); }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if(std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+    { throw InvalidLandmarks("bad magic"); }
+    if(header.byte_order != FILE_BYTE_ORDER)
+    { throw InvalidLandmarks("different byte order"); }
+    if(header.version != FORMAT_VERSION)
+    {
+      throw InvalidLandmarks("format version "
+                             + std::to_string(header.version)
+                             + " is not "
+                             + std::to_string(FORMAT_VERSION));
+    }
+    const std::uint64_t count = header.nlandmark
+      + static_cast<std::uint64_t>(header.nlandmark) * header.nnode;
+    if(header.nlandmark == 0
+       || data.size() != sizeof(header) + count * sizeof(std::int32_t))
+    { throw InvalidLandmarks("broken header"); }
+    const char * p = data.data() + sizeof(header);
+    $.stations.resize(header.nlandmark);
+    std::memcpy(&$.stations[0], p, header.nlandmark * sizeof(std::int32_t));
+    p += header.nlandmark * sizeof(std::int32_t);
+    $.table.resize(static_cast<size_t>(header.nlandmark) * header.nnode);
+    if(!$.table.empty())
+    {
+      std::memcpy(&$.table[0], p, $.table.size() * sizeof(std::int32_t));
+    }
+    $.fingerprint = header.fingerprint;
+  }
+
+  void CLandmarks::write(const char * filename) const
+  {
+    file_header_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FORMAT_VERSION;
+    header.byte_order = FILE_BYTE_ORDER;
+    header.nlandmark = $.stations.size();
+    header.nnode = $.size();
+    header.fingerprint = $.fingerprint;
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary
+                      | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>($.stations.data()),
+              $.stations.size() * sizeof(std::int32_t));
+    ofs.write(reinterpret_cast<const char *>($.table.data()),
+              $.table.size() * sizeof(std::int32_t));
+    ofs.close();
+    if(!ofs)
+    {
+      throw IOException(std::string("cannot write landmarks: ") + filename);
+    }
+  }
+
+  int CLandmarks::lower_bound(unsigned from, unsigned to) const
+  {
+    const size_t n = $.stations.size();
+    const std::int32_t * a = &$.table[from * n];
+    const std::int32_t * b = &$.table[to * n];
+    int bound = 0;
+    for(size_t i=0; i<n; ++i)
+    {
+      if(a[i] == UNREACHABLE || b[i] == UNREACHABLE) { continue; }
+      bound = std::max(bound, std::abs(a[i] - b[i]));
+    }
+    return bound;
+  }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ares.h"
+
+namespace ares
+{
+  /**
+   * @~english
+   * Exception to represent that the landmark file is broken
+   * or written in other format version.
+   */
+  /**
+   * @~japanese
+   * 目印のファイルが壊れているか形式が異なる時の例外.
+   */
+  class InvalidLandmarks : public std::runtime_error
+  {
+  public:
+    explicit InvalidLandmarks(const std::string & what)
+      : std::runtime_error("Invalid landmarks: " + what) {}
+  };
+
+  /**
+   * @~english
+   * Precomputed distances from landmark stations for ALT search
+   * (A*, landmarks and triangle inequality).
+   */
+  /**
+   * @~japanese
+   * ALT探索(A*探索, 目印, 三角不等式)のために, いくつかの目印の駅から
+   * CRouteFinderの各頂点までの営業キロを求めておいたもの.
+   * 2頂点間の営業キロは, どの目印からの営業キロの差よりも短くならない.
+   * ファイルに書き出して次の起動で読み込める.
+   * 作った時のCRouteFinderの指紋を持ち, 指紋の違うグラフには使わない.
+   */
+  class CLandmarks
+  {
+  public:
+    //! ファイルの形式のバージョン. 形式を変えたら上げること.
+    static const unsigned FORMAT_VERSION = 1;
+    //! 目印から行けない頂点の営業キロ.
+    static const std::int32_t UNREACHABLE = -1;
+
+  private:
+    station_vector stations;
+    std::uint64_t fingerprint;
+    //! 頂点ごとに目印からの営業キロ(10倍)を目印の順に並べたもの.
+    std::vector<std::int32_t> table;
+
+  public:
+    /**
+     * Constructor.
+     * @param[in] stations    目印の駅. 1駅以上.
+     * @param[in] fingerprint グラフの指紋.
+     * @param[in] table       頂点ごとに目印からの営業キロを並べたもの.
+     * @throw std::invalid_argument 目印がないか, tableの大きさが合わない場合.
+     */
+    CLandmarks(const station_vector & stations, std::uint64_t fingerprint,
+               const std::vector<std::int32_t> & table);
+
+    /**
+     * Constructor.
+     * Read the file written by write().
+     * @param[in] filename The filename to read.
+     * @throw IOException      The file cannot be read.
+     * @throw InvalidLandmarks The file is broken or in other version.
+     */
+    explicit CLandmarks(const char * filename);
+
+    /**
+     * Write the landmarks into file.
+     * @param[in] filename The filename to write.
+     * @throw IOException  Failed to write.
+     */
+    void write(const char * filename) const;
+
+    //! 目印の駅.
+    const station_vector & get_stations() const { return stations; }
+
+    //! 作った時のグラフの指紋.
+    std::uint64_t get_fingerprint() const { return fingerprint; }
+
+    //! 頂点の数.
+    size_t size() const { return table.size() / stations.size(); }
+
+    //! i番目の目印から頂点までの営業キロ(10倍). 行けなければUNREACHABLE.
+    std::int32_t get_distance(unsigned node, size_t i) const
+    {
+      return table[node * stations.size() + i];
+    }
+
+    /**
+     * 2頂点間の営業キロ(10倍)の下界.
+     * 同じ目印から行ける2頂点について, 目印からの営業キロの差の最大.
+     */
+    int lower_bound(unsigned from, unsigned to) const;
+  };
+}
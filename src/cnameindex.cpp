@@ -0,0 +1,629 @@
+/* -*-coding: utf-8-*- */
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <tuple>
+
+#include "util.hpp"
+#include "sqlite3_wrapper.h"
+#include "aresutil.h"
+#include "cnameindex.h"
+
+namespace ares
+{
+  using sqlite3_wrapper::SQLite;
+  using sqlite3_wrapper::SQLiteStmt;
+  typedef CNetworkSnapshot::name_ref_t name_ref_t;
+  typedef CNetworkSnapshot::name_field_t name_field_t;
+  typedef CNetworkSnapshot::name_key_t name_key_t;
+  typedef CNetworkSnapshot::name_gram_t name_gram_t;
+  typedef CNetworkSnapshot::name_index_t name_index_t;
+
+  namespace
+  {
+    //! 文字を逆順にする. 1文字の中のバイトの順は変えない.
+    std::string u8reverse(const std::string & str)
+    {
+      std::vector<std::string> chars = u8split(str);
+      std::string result;
+      result.reserve(str.size());
+      for(auto itr=chars.rbegin(); itr != chars.rend(); ++itr)
+      {
+        result += *itr;
+      }
+      return result;
+    }
+
+    //! UTF-8の文字列をコードポイントの配列にする.
+    std::vector<unsigned> u8decode(const std::string & str)
+    {
+      std::vector<unsigned> result;
+      for(const std::string & c : u8split(str))
+      {
+        const unsigned char lead = c[0];
+        unsigned cp = c.size() == 1 ? lead : lead & (0x7f >> c.size());
+        for(size_t i=1; i<c.size(); ++i) { cp = (cp << 6) | (c[i] & 0x3f); }
+        result.push_back(cp);
+      }
+      return result;
+    }
+
+    //! コードポイントをUTF-8にして加える.
+    void u8append(std::string & str, unsigned cp)
+    {
+      if(cp < 0x80) { str += static_cast<char>(cp); return; }
+      if(cp < 0x800)
+      {
+        str += static_cast<char>(0xc0 | (cp >> 6));
+      }
+      else if(cp < 0x10000)
+      {
+        str += static_cast<char>(0xe0 | (cp >> 12));
+        str += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      }
+      else
+      {
+        str += static_cast<char>(0xf0 | (cp >> 18));
+        str += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        str += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      }
+      str += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+
+    /**
+     * 半角と全角の形を通常の形にする. NFKCの一部.
+     * 半角の濁点と半濁点は結合文字にする.
+     */
+    unsigned unify_width(unsigned cp)
+    {
+      // U+FF61からU+FF9Dまでの半角カナ.
+      static const std::vector<unsigned> halfwidth = u8decode(
+        "。「」、・ヲァィゥェォャュョッーアイウエオカキクケコサシスセソ"
+        "タチツテトナニヌネノハヒフヘホマミムメモヤユヨラリルレロワン");
+      if(cp == 0x3000) { return ' '; }
+      if(0xff01 <= cp && cp <= 0xff5e) { return cp - 0xfee0; }
+      if(0xff61 <= cp && cp <= 0xff9d) { return halfwidth[cp - 0xff61]; }
+      if(cp == 0xff9e) { return 0x3099; }
+      if(cp == 0xff9f) { return 0x309a; }
+      switch(cp)
+      {
+      case 0xffe0: return 0xa2;
+      case 0xffe1: return 0xa3;
+      case 0xffe2: return 0xac;
+      case 0xffe4: return 0xa6;
+      case 0xffe5: return 0xa5;
+      case 0xffe6: return 0x20a9;
+      default: return cp;
+      }
+    }
+
+    /**
+     * 仮名と結合文字の濁点か半濁点を合成する.
+     * @return 合成した文字. 合成できなければ0.
+     */
+    unsigned compose_kana(unsigned base, unsigned mark)
+    {
+      static const std::vector<unsigned> voiced = u8decode(
+        "かきくけこさしすせそたちつてとはひふへほ"
+        "カキクケコサシスセソタチツテトハヒフヘホ");
+      static const std::vector<unsigned> semivoiced = u8decode(
+        "はひふへほハヒフヘホ");
+      const auto contains = [base](const std::vector<unsigned> & chars)
+        { return std::find(chars.begin(), chars.end(), base) != chars.end(); };
+      if(mark == 0x3099)
+      {
+        if(contains(voiced)) { return base + 1; }
+        switch(base)
+        {
+        case 0x3046: return 0x3094; // う
+        case 0x30a6: return 0x30f4; // ウ
+        case 0x309d: return 0x309e; // ゝ
+        case 0x30fd: return 0x30fe; // ヽ
+        case 0x30ef: case 0x30f0: case 0x30f1: case 0x30f2:
+          return base + 8; // ワヰヱヲ
+        default: return 0;
+        }
+      }
+      if(mark == 0x309a && contains(semivoiced)) { return base + 2; }
+      return 0;
+    }
+
+    //! 2つの昇順の配列の共通部分.
+    void intersect(std::vector<unsigned> & a,
+                   const liquid::ArrayView<unsigned> & b)
+    {
+      std::vector<unsigned> result;
+      std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                            std::back_inserter(result));
+      a.swap(result);
+    }
+
+    //! 配列の範囲[begin, end)のビュー.
+    template <class T>
+    liquid::ArrayView<T> slice(const liquid::ArrayView<T> & view,
+                               unsigned begin, unsigned end)
+    {
+      return liquid::ArrayView<T>(view.begin() + begin, end - begin);
+    }
+
+    template <class T>
+    liquid::ArrayView<T> view_of(const std::vector<T> & table)
+    {
+      return liquid::ArrayView<T>(table.data(), table.size());
+    }
+
+    /**
+     * 索引の表の中の列の順.
+     * 値を変えたらCNetworkSnapshot::FORMAT_VERSIONを上げること.
+     */
+    enum FIELD_ID
+    {
+      FIELD_STATION_NAME,
+      FIELD_STATION_YOMI,
+      FIELD_STATION_DENRYAKU,
+      FIELD_STATION_DENRYAKU_TAIL,
+      FIELD_LINE_NAME,
+      FIELD_LINE_YOMI,
+      FIELD_LINE_ALIAS,
+      FIELD_STATION_KEY,
+      FIELD_LINE_KEY,
+      NFIELD,
+    };
+
+    //! 列の値とキーを集め, 索引の表に列を加える.
+    class NameFieldBuilder
+    {
+    private:
+      typedef std::pair<std::string, unsigned> key_t;
+      //! 列の値とID.
+      std::vector<std::pair<std::string, int> > entries;
+      //! 検索するキーとentriesの添字.
+      std::vector<key_t> keys;
+
+      //! 文字列を表のcharsに加える.
+      static name_ref_t add_string(CNameIndex::tables_t & t,
+                                   const std::string & str)
+      {
+        const name_ref_t ref = {
+          static_cast<unsigned>(t.chars.size()),
+          static_cast<unsigned>(str.size()),
+        };
+        t.chars.insert(t.chars.end(), str.begin(), str.end());
+        return ref;
+      }
+
+      //! キーの順に並べて表のkeysに加え, その範囲を返す.
+      static std::pair<unsigned, unsigned>
+      add_keys(CNameIndex::tables_t & t, std::vector<key_t> & keys)
+      {
+        std::sort(keys.begin(), keys.end());
+        const unsigned begin = t.keys.size();
+        for(const key_t & key : keys)
+        {
+          const name_key_t added = {add_string(t, key.first), key.second};
+          t.keys.push_back(added);
+        }
+        return std::make_pair(begin, static_cast<unsigned>(t.keys.size()));
+      }
+
+    public:
+      //! 列の値を加える. 値そのものが検索するキーになる.
+      void add(const std::string & value, int id) { $.add(value, id, value); }
+
+      //! 列の値を加える. 値の代わりにkeyで検索する.
+      void add(const std::string & value, int id, const std::string & key)
+      {
+        entries.push_back(std::make_pair(value, id));
+        keys.push_back(key_t(CNameField::normalize(key), entries.size() - 1));
+      }
+
+      //! 最後に加えた値に, 別の検索するキーを加える.
+      void add_key(const std::string & key)
+      {
+        keys.push_back(key_t(CNameField::normalize(key), entries.size() - 1));
+      }
+
+      //! 表に列を加える.
+      void build(CNameIndex::tables_t & t) const;
+    };
+
+    void NameFieldBuilder::build(CNameIndex::tables_t & t) const
+    {
+      name_field_t field;
+      // entriesを並べ替えた後の添字に付け替える.
+      std::vector<unsigned> order(entries.size());
+      for(unsigned i=0; i<order.size(); ++i) { order[i] = i; }
+      std::sort(order.begin(), order.end(),
+                [this](unsigned a, unsigned b)
+                { return entries[a] < entries[b]; });
+      std::vector<unsigned> rank(entries.size());
+      field.id_begin = t.ids.size();
+      for(unsigned i=0; i<order.size(); ++i)
+      {
+        rank[order[i]] = i;
+        t.ids.push_back(entries[order[i]].second);
+      }
+      field.id_end = t.ids.size();
+
+      std::vector<key_t> forward(keys);
+      for(key_t & key : forward) { key.second = rank[key.second]; }
+      std::tie(field.forward_begin, field.forward_end) = add_keys(t, forward);
+
+      std::vector<key_t> backward;
+      std::map<std::string, std::vector<unsigned> > grams;
+      for(unsigned i=0; i<forward.size(); ++i)
+      {
+        const std::string & key = forward[i].first;
+        backward.push_back(key_t(u8reverse(key), forward[i].second));
+        const std::vector<std::string> chars = u8split(key);
+        for(size_t j=0; j<chars.size(); ++j)
+        {
+          grams[chars[j]].push_back(i);
+          if(j+1 < chars.size()) { grams[chars[j] + chars[j+1]].push_back(i); }
+        }
+      }
+      std::tie(field.backward_begin, field.backward_end) =
+        add_keys(t, backward);
+
+      field.gram_begin = t.grams.size();
+      for(const auto & gram : grams)
+      {
+        // 同じキーに同じn-gramが何度も現れると添字が重複する.
+        const std::vector<unsigned> & postings = gram.second;
+        const unsigned begin = t.postings.size();
+        std::unique_copy(postings.begin(), postings.end(),
+                         std::back_inserter(t.postings));
+        const name_gram_t added = {
+          add_string(t, gram.first), begin,
+          static_cast<unsigned>(t.postings.size()),
+        };
+        t.grams.push_back(added);
+      }
+      field.gram_end = t.grams.size();
+      t.fields.push_back(field);
+    }
+  }
+
+  std::string CNameField::normalize(const std::string & str)
+  {
+    std::string result(str);
+    for(char & c : result)
+    {
+      if('A' <= c && c <= 'Z') { c = c - 'A' + 'a'; }
+    }
+    return result;
+  }
+
+  void CNameField::attach(const name_index_t & index,
+                          const name_field_t & field)
+  {
+    ids = slice(index.ids, field.id_begin, field.id_end);
+    forward = slice(index.keys, field.forward_begin, field.forward_end);
+    backward = slice(index.keys, field.backward_begin, field.backward_end);
+    grams = slice(index.grams, field.gram_begin, field.gram_end);
+    chars = index.chars;
+    postings = index.postings;
+  }
+
+  void CNameField::find_prefix(const liquid::ArrayView<key_t> & keys,
+                               const std::string & query,
+                               bool exact,
+                               std::vector<unsigned> & result) const
+  {
+    const boost::string_ref prefix(query);
+    auto itr = std::lower_bound(
+      keys.begin(), keys.end(), prefix,
+      [this](const key_t & key, const boost::string_ref & prefix)
+      { return get_string(key.key) < prefix; });
+    for(; itr != keys.end(); ++itr)
+    {
+      const boost::string_ref key = get_string(itr->key);
+      if(!key.starts_with(prefix)) { break; }
+      if(!exact || key.size() == prefix.size())
+      {
+        result.push_back(itr->entry);
+      }
+    }
+  }
+
+  void CNameField::find(const std::string & query_,
+                        find_mode mode,
+                        std::vector<int> & list) const
+  {
+    const std::string query = normalize(query_);
+    std::vector<unsigned> found;
+    switch(mode)
+    {
+    case FIND_EXACT:
+      find_prefix(forward, query, true, found);
+      break;
+
+    case FIND_PREFIX:
+      find_prefix(forward, query, false, found);
+      break;
+
+    case FIND_SUFFIX:
+      find_prefix(backward, u8reverse(query), false, found);
+      break;
+
+    case FIND_PARTIAL:
+    default:
+      {
+        const std::vector<std::string> chars = u8split(query);
+        if(chars.empty())
+        {
+          for(const key_t & key : forward) { found.push_back(key.entry); }
+          break;
+        }
+        // 最も短い転置リストから始めて, 残りのn-gramとの共通部分をとる.
+        std::vector<liquid::ArrayView<unsigned> > lists;
+        for(size_t j=0; j<chars.size(); ++j)
+        {
+          const boost::string_ref gram(
+            chars.size() == 1 ? chars[j] : chars[j] + chars[j+1]);
+          auto itr = std::lower_bound(
+            grams.begin(), grams.end(), gram,
+            [this](const gram_t & g, const boost::string_ref & gram)
+            { return get_string(g.gram) < gram; });
+          if(itr == grams.end() || get_string(itr->gram) != gram) { return; }
+          lists.push_back(slice(postings, itr->begin, itr->end));
+          if(j+2 >= chars.size()) { break; }
+        }
+        std::sort(lists.begin(), lists.end(),
+                  [](const liquid::ArrayView<unsigned> & a,
+                     const liquid::ArrayView<unsigned> & b)
+                  { return a.size() < b.size(); });
+        std::vector<unsigned> candidates(lists.front().begin(),
+                                         lists.front().end());
+        for(size_t j=1; j<lists.size() && !candidates.empty(); ++j)
+        {
+          intersect(candidates, lists[j]);
+        }
+        // n-gramが全て含まれても並びが違うことがあるので確かめる.
+        for(const unsigned i : candidates)
+        {
+          if(get_string(forward[i].key).find(query) != boost::string_ref::npos)
+          {
+            found.push_back(forward[i].entry);
+          }
+        }
+      }
+      break;
+    }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    for(const unsigned i : found) { list.push_back(ids[i]); }
+  }
+
+  std::string CNameIndex::normalize_key(const std::string & str)
+  {
+    std::vector<unsigned> chars;
+    for(const unsigned c : u8decode(str))
+    {
+      const unsigned cp = unify_width(c);
+      const unsigned composed =
+        chars.empty() ? 0 : compose_kana(chars.back(), cp);
+      if(composed) { chars.back() = composed; }
+      else { chars.push_back(cp); }
+    }
+    std::string result;
+    result.reserve(str.size());
+    for(unsigned cp : chars)
+    {
+      // 小さいヵとヶは駒ヶ岳のように普通の仮名として読む.
+      if(cp == 0x30f5 || cp == 0x3095) { cp = 0x304b; }
+      else if(cp == 0x30f6 || cp == 0x3096) { cp = 0x3051; }
+      else if(0x30a1 <= cp && cp <= 0x30f4) { cp -= 0x60; }
+      else if('A' <= cp && cp <= 'Z') { cp = cp - 'A' + 'a'; }
+      u8append(result, cp);
+    }
+    return result;
+  }
+
+  CNameIndex::CNameIndex(SQLite & db)
+  {
+    load(db, tables);
+    CNetworkSnapshot::name_index_t index;
+    index.fields = view_of(tables.fields);
+    index.ids = view_of(tables.ids);
+    index.chars = view_of(tables.chars);
+    index.keys = view_of(tables.keys);
+    index.grams = view_of(tables.grams);
+    index.postings = view_of(tables.postings);
+    $.attach(index);
+  }
+
+  CNameIndex::CNameIndex(std::shared_ptr<const CNetworkSnapshot> snapshot)
+    : snapshot(snapshot)
+  {
+    $.attach(snapshot->get_name_index());
+  }
+
+  void CNameIndex::attach(const CNetworkSnapshot::name_index_t & index)
+  {
+    CNameField * const fields[NFIELD] = {
+      &station_name, &station_yomi, &station_denryaku, &station_denryaku_tail,
+      &line_name, &line_yomi, &line_alias, &station_key, &line_key,
+    };
+    if(index.fields.size() != NFIELD)
+    {
+      throw InvalidSnapshot("name index has "
+                            + std::to_string(index.fields.size())
+                            + " fields");
+    }
+    for(size_t i=0; i<NFIELD; ++i)
+    {
+      fields[i]->attach(index, index.fields[i]);
+    }
+  }
+
+  void CNameIndex::load(SQLite & db, tables_t & t)
+  {
+    NameFieldBuilder fields[NFIELD];
+    NameFieldBuilder & station_name = fields[FIELD_STATION_NAME];
+    NameFieldBuilder & station_yomi = fields[FIELD_STATION_YOMI];
+    NameFieldBuilder & station_denryaku = fields[FIELD_STATION_DENRYAKU];
+    NameFieldBuilder & station_denryaku_tail =
+      fields[FIELD_STATION_DENRYAKU_TAIL];
+    NameFieldBuilder & line_name = fields[FIELD_LINE_NAME];
+    NameFieldBuilder & line_yomi = fields[FIELD_LINE_YOMI];
+    NameFieldBuilder & line_alias = fields[FIELD_LINE_ALIAS];
+    NameFieldBuilder & station_key = fields[FIELD_STATION_KEY];
+    NameFieldBuilder & line_key = fields[FIELD_LINE_KEY];
+    {
+      SQLiteStmt stmt(db, "SELECT stationid, stationname, stationyomi,"
+                      "       stationdenryaku, stationnamekey, stationyomikey"
+                      " FROM station");
+      for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+      {
+        const int id = itr[0];
+        if(!itr[1].is_null())
+        {
+          const std::string name = static_cast<const char *>(itr[1]);
+          station_name.add(name, id);
+          // LIKE '（%）name' に合うように, 括弧で始まる駅名は
+          // 閉じ括弧ごとにその後ろも加える.
+          if(name.compare(0, std::strlen("（"), "（") == 0)
+          {
+            const std::string close("）");
+            for(size_t pos = name.find(close, std::strlen("（"));
+                pos != std::string::npos;
+                pos = name.find(close, pos + close.size()))
+            {
+              station_name.add_key(name.substr(pos + close.size()));
+            }
+          }
+        }
+        if(!itr[2].is_null())
+        {
+          station_yomi.add(static_cast<const char *>(itr[2]), id);
+        }
+        if(!itr[4].is_null())
+        {
+          const std::string name = static_cast<const char *>(itr[1]);
+          station_key.add(name, id, static_cast<const char *>(itr[4]));
+          if(!itr[5].is_null())
+          {
+            station_key.add_key(static_cast<const char *>(itr[5]));
+          }
+        }
+        if(!itr[3].is_null())
+        {
+          const std::string denryaku = static_cast<const char *>(itr[3]);
+          station_denryaku.add(denryaku, id);
+          const std::vector<std::string> chars = u8split(denryaku);
+          if(chars.size() >= 2)
+          {
+            station_denryaku_tail.add(
+              denryaku, id, denryaku.substr(chars[0].size() + chars[1].size()));
+          }
+        }
+      }
+    }
+    {
+      SQLiteStmt stmt(db, "SELECT lineid, linename, lineyomi,"
+                      "       linenamekey, lineyomikey"
+                      " FROM line");
+      for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+      {
+        const int id = itr[0];
+        if(!itr[1].is_null())
+        {
+          line_name.add(static_cast<const char *>(itr[1]), id);
+          line_key.add(static_cast<const char *>(itr[1]), id,
+                       static_cast<const char *>(itr[3]));
+          if(!itr[4].is_null())
+          {
+            line_key.add_key(static_cast<const char *>(itr[4]));
+          }
+        }
+        if(!itr[2].is_null())
+        {
+          line_yomi.add(static_cast<const char *>(itr[2]), id);
+        }
+      }
+    }
+    {
+      SQLiteStmt stmt(db, "SELECT lineid, marscode FROM alias_line"
+                      " WHERE marscode != ''");
+      for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+      {
+        line_alias.add(static_cast<const char *>(itr[1]), itr[0]);
+      }
+    }
+    for(const NameFieldBuilder & field : fields) { field.build(t); }
+  }
+
+  bool CNameIndex::is_searchable(const char * name)
+  {
+    return std::strpbrk(name, "%_") == nullptr;
+  }
+
+  void CNameIndex::find_stationid_with_name(const char * name,
+                                            find_mode mode,
+                                            station_vector & list) const
+  {
+    station_name.find(name, mode, list);
+  }
+
+  void CNameIndex::find_stationid_with_yomi(const char * name,
+                                            find_mode mode,
+                                            station_vector & list) const
+  {
+    station_yomi.find(name, mode, list);
+  }
+
+  void CNameIndex::find_stationid_with_denryaku(const char * name,
+                                                find_mode mode,
+                                                station_vector & list) const
+  {
+    // 2文字以下なら電略の先頭2文字を除いた部分で探す.
+    if(u8strlen(name) <= 2) { station_denryaku_tail.find(name, mode, list); }
+    else { station_denryaku.find(name, mode, list); }
+  }
+
+  void CNameIndex::find_lineid_with_name(const char * name,
+                                         find_mode mode,
+                                         line_vector & list) const
+  {
+    line_name.find(name, mode, list);
+  }
+
+  void CNameIndex::find_lineid_with_yomi(const char * name,
+                                         find_mode mode,
+                                         line_vector & list) const
+  {
+    line_yomi.find(name, mode, list);
+  }
+
+  void CNameIndex::find_lineid_with_alias(const char * name,
+                                          find_mode mode,
+                                          line_vector & list) const
+  {
+    line_vector found;
+    line_alias.find(name, mode, found);
+    std::sort(found.begin(), found.end());
+    list.insert(list.end(), found.begin(), found.end());
+  }
+
+  void CNameIndex::find_stationid_with_key(const char * key,
+                                           find_mode mode,
+                                           station_vector & list) const
+  {
+    station_vector found;
+    station_key.find(key, mode, found);
+    std::sort(found.begin(), found.end());
+    list.insert(list.end(), found.begin(), found.end());
+  }
+
+  void CNameIndex::find_lineid_with_key(const char * key,
+                                        find_mode mode,
+                                        line_vector & list) const
+  {
+    line_vector found;
+    line_key.find(key, mode, found);
+    std::sort(found.begin(), found.end());
+    list.insert(list.end(), found.begin(), found.end());
+  }
+}
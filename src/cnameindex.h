@@ -0,0 +1,202 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "util.hpp"
+#include "ares.h"
+#include "cdatabase.h"
+#include "cnetworksnapshot.h"
+
+namespace sqlite3_wrapper
+{
+  class SQLite;
+}
+
+namespace ares
+{
+  /**
+   * @~english
+   * In-memory index of names to search without LIKE scans.
+   */
+  /**
+   * @~japanese
+   * 名前を検索するための索引の1つの列.
+   * 完全一致と前方一致は並べたキーの二分探索で,
+   * 後方一致は文字を逆順にしたキーの二分探索で,
+   * 部分一致は1文字と2文字のn-gramの転置リストの積で候補を絞ってから答える.
+   * SQLiteのLIKEと同じく英字の大文字と小文字は区別しない.
+   * 表はCNameIndexが持つか, スナップショットのイメージの中にあり,
+   * これはその範囲を指すだけなので確保もコピーもしない.
+   */
+  class CNameField
+  {
+  private:
+    typedef CNetworkSnapshot::name_key_t key_t;
+    typedef CNetworkSnapshot::name_gram_t gram_t;
+    //! 列のID. 列の値, IDの順に並べる. SQLiteの索引と同じ順.
+    liquid::ArrayView<int> ids;
+    //! 検索するキーとidsの添字. キーの順に並べる.
+    liquid::ArrayView<key_t> forward;
+    //! 文字を逆順にしたキーとidsの添字. キーの順に並べる.
+    liquid::ArrayView<key_t> backward;
+    //! n-gramとforwardの添字の昇順の転置リスト. n-gramの順に並べる.
+    liquid::ArrayView<gram_t> grams;
+    //! キーとn-gramの文字列.
+    liquid::ArrayView<char> chars;
+    //! 転置リスト.
+    liquid::ArrayView<unsigned> postings;
+
+    boost::string_ref get_string(CNetworkSnapshot::name_ref_t ref) const
+    {
+      return boost::string_ref(chars.begin() + ref.offset, ref.length);
+    }
+
+    void find_prefix(const liquid::ArrayView<key_t> & keys,
+                     const std::string & query,
+                     bool exact,
+                     std::vector<unsigned> & result) const;
+
+  public:
+    //! 検索するキーに変換する. ASCIIの英字を小文字にする.
+    static std::string normalize(const std::string & str);
+
+    //! 索引の表の中の列を指す. 範囲は検査してあること.
+    void attach(const CNetworkSnapshot::name_index_t & index,
+                const CNetworkSnapshot::name_field_t & field);
+
+    //! 加えた値の数.
+    size_t size() const { return ids.size(); }
+
+    /**
+     * キーを検索し, 一致した値のIDを値の順に重複なく加える.
+     * 並びはSQLiteが列の索引を走査した時と同じになる.
+     * @param[in]  query 検索する文字列.
+     * @param[in]  mode  検索の方法.
+     * @param[out] list  IDを加える配列.
+     */
+    void find(const std::string & query,
+              find_mode mode,
+              std::vector<int> & list) const;
+  };
+
+  /**
+   * @~english
+   * Name index of stations and lines.
+   */
+  /**
+   * @~japanese
+   * 駅名, 駅の読み, 電略, 路線名, 路線の読み, 路線の略号の索引.
+   * 各メンバ関数の結果はCDatabaseの同名の関数と同じになる.
+   * ただしLIKEのワイルドカード(%と_)を含む問い合わせには使えない.
+   * 表はスナップショットのイメージにも書き出されるので,
+   * mmapや共有メモリのスナップショットからはSQLで作り直さずに使える.
+   */
+  class CNameIndex : boost::noncopyable
+  {
+  public:
+    //! スナップショットのイメージに書き出す前の索引の表.
+    struct tables_t
+    {
+      std::vector<CNetworkSnapshot::name_field_t> fields;
+      std::vector<int> ids;
+      std::vector<char> chars;
+      std::vector<CNetworkSnapshot::name_key_t> keys;
+      std::vector<CNetworkSnapshot::name_gram_t> grams;
+      std::vector<unsigned> postings;
+    };
+
+  private:
+    //! 括弧付きの駅名 "（函）桂川" は括弧の後ろもキーにする.
+    CNameField station_name;
+    CNameField station_yomi;
+    CNameField station_denryaku;
+    //! 電略の先頭2文字を除いたもの.
+    CNameField station_denryaku_tail;
+    CNameField line_name;
+    CNameField line_yomi;
+    //! MARSの路線略号.
+    CNameField line_alias;
+    //! 駅名と読みを正規化したもの. normalize_key()を参照.
+    CNameField station_key;
+    //! 路線名と読みを正規化したもの.
+    CNameField line_key;
+    //! SQLで作った表. スナップショットの表を使う時は空.
+    tables_t tables;
+    //! 表を持つスナップショット.
+    std::shared_ptr<const CNetworkSnapshot> snapshot;
+
+    //! 各列に表の中の範囲を設定する. 列の数が違えば例外を投げる.
+    void attach(const CNetworkSnapshot::name_index_t & index);
+
+  public:
+    /**
+     * Constructor.
+     * Load names from the database.
+     * @param[in] db The database to read.
+     */
+    explicit CNameIndex(sqlite3_wrapper::SQLite & db);
+
+    /**
+     * Constructor.
+     * Use the tables in the snapshot in place, without SQL and copying.
+     * @param[in] snapshot The snapshot built or mapped with the tables.
+     * @throw InvalidSnapshot The tables are for other columns.
+     */
+    explicit CNameIndex(std::shared_ptr<const CNetworkSnapshot> snapshot);
+
+    /**
+     * データベースから索引の表を作る.
+     * CNetworkSnapshotはこれをイメージに書き出す.
+     * @param[in]  db 読み込むデータベース.
+     * @param[out] t  作った表.
+     */
+    static void load(sqlite3_wrapper::SQLite & db, tables_t & t);
+
+    //! LIKEのワイルドカードを含まず, 索引で答えられるかを調べる.
+    static bool is_searchable(const char * name);
+
+    /**
+     * 仮名と全角半角と英字の大文字小文字を区別せずに検索するキーにする.
+     * 全角の英数字と記号と空白, 半角カナをNFKCと同じく変換し,
+     * 結合文字の濁点と半濁点を仮名と合成する. それ以外の互換文字(Ⅱ, ①,
+     * ㈱, ㌔など)はそのまま残すので, NFKCとは違う.
+     * カタカナをひらがなに, 小さいヵとヶをかとけにし, ASCIIの英字を小文字にする.
+     * mksql.pyのsearch_key()も同じ変換をして, 路線と駅の表に *key 列を加える.
+     */
+    static std::string normalize_key(const std::string & str);
+
+    //! 駅の数.
+    size_t station_size() const { return station_name.size(); }
+
+    void find_stationid_with_name(const char * name,
+                                  find_mode mode,
+                                  station_vector & list) const;
+    void find_stationid_with_yomi(const char * name,
+                                  find_mode mode,
+                                  station_vector & list) const;
+    void find_stationid_with_denryaku(const char * name,
+                                      find_mode mode,
+                                      station_vector & list) const;
+    void find_lineid_with_name(const char * name,
+                               find_mode mode,
+                               line_vector & list) const;
+    void find_lineid_with_yomi(const char * name,
+                               find_mode mode,
+                               line_vector & list) const;
+    //! normalize_key()で正規化した駅名か読みで探し, 駅IDの順に返す.
+    void find_stationid_with_key(const char * key,
+                                 find_mode mode,
+                                 station_vector & list) const;
+    //! normalize_key()で正規化した路線名か読みで探し, 路線IDの順に返す.
+    void find_lineid_with_key(const char * key,
+                              find_mode mode,
+                              line_vector & list) const;
+    //! CDatabaseと同じく路線IDの順に返す.
+    void find_lineid_with_alias(const char * name,
+                                find_mode mode,
+                                line_vector & list) const;
+  };
+}
@@ -0,0 +1,1518 @@
+/* -*-coding: utf-8-*- */
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.hpp"
+#include "sqlite3_wrapper.h"
+#include "aresutil.h"
+#include "ckilo.h"
+#include "cnameindex.h"
+#include "cnetworksnapshot.h"
+
+namespace ares
+{
+  using sqlite3_wrapper::SQLite;
+  using sqlite3_wrapper::SQLiteStmt;
+  using sqlite3_wrapper::IOException;
+  typedef CNetworkSnapshot::line_t line_t;
+  typedef CNetworkSnapshot::station_t station_t;
+  typedef CNetworkSnapshot::kilo_t kilo_t;
+  typedef CNetworkSnapshot::densha_run_t densha_run_t;
+  typedef CNetworkSnapshot::company_t company_t;
+  typedef CNetworkSnapshot::company_break_t company_break_t;
+  typedef CNetworkSnapshot::fare_t fare_t;
+  typedef CNetworkSnapshot::fare_group_t fare_group_t;
+  typedef CNetworkSnapshot::fare_country_t fare_country_t;
+  typedef CNetworkSnapshot::fare_special_t fare_special_t;
+  typedef CNetworkSnapshot::name_ref_t name_ref_t;
+  typedef CNetworkSnapshot::name_field_t name_field_t;
+  typedef CNetworkSnapshot::name_key_t name_key_t;
+  typedef CNetworkSnapshot::name_gram_t name_gram_t;
+
+  namespace
+  {
+    const char IMAGE_MAGIC[8] = {'A', 'R', 'E', 'S', 'N', 'E', 'T', '\0'};
+    const std::uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+    const size_t IMAGE_ALIGN = 8;
+
+    //! イメージの先頭に置くヘッダ.
+    struct image_header_t
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byte_order;
+      std::uint32_t nsection;
+      std::uint32_t reserved;
+      std::uint64_t size;
+    };
+
+    //! ヘッダの直後に並ぶセクション表の1行.
+    struct image_section_t
+    {
+      std::uint32_t id;
+      std::uint32_t elemsize;
+      std::uint64_t offset;
+      std::uint64_t count;
+    };
+
+    //! セクションの識別子. 値を変えたらFORMAT_VERSIONを上げること.
+    enum SECTION_ID
+    {
+      SECTION_LINE = 1,
+      SECTION_STATION,
+      SECTION_KILO,
+      SECTION_KILO_HASH,
+      SECTION_COMPANY,
+      SECTION_FARE,
+      SECTION_FARE_COUNTRY,
+      SECTION_FARE_SPECIAL,
+      SECTION_FARE_GROUP,
+      SECTION_FARE_DENSE,
+      SECTION_FARE_COUNTRY_HASH,
+      SECTION_DENSHA,
+      SECTION_COMPANY_BREAK,
+      SECTION_NAMES,
+      SECTION_STATION_LINE,
+      SECTION_JUNCTION,
+      SECTION_NAME_FIELD,
+      SECTION_NAME_ID,
+      SECTION_NAME_CHARS,
+      SECTION_NAME_KEY,
+      SECTION_NAME_GRAM,
+      SECTION_NAME_POSTING,
+    };
+
+    //! イメージに書き出す前の各表.
+    struct tables_t
+    {
+      std::vector<line_t> line;
+      std::vector<station_t> station;
+      std::vector<kilo_t> kilo;
+      std::vector<densha_run_t> densha;
+      std::vector<unsigned> kilo_hash;
+      std::vector<company_t> company;
+      std::vector<company_break_t> company_break;
+      std::vector<fare_t> fare;
+      std::vector<fare_group_t> fare_group;
+      std::vector<int> fare_dense;
+      std::vector<fare_country_t> fare_country;
+      std::vector<unsigned> fare_country_hash;
+      std::vector<fare_special_t> fare_special;
+      std::vector<char> names;
+      std::vector<line_id_t> station_line;
+      std::vector<station_id_t> junction;
+      CNameIndex::tables_t name_index;
+    };
+
+    //! 名前をtables_t::namesに重複なく加える.
+    class NamePool
+    {
+    private:
+      std::vector<char> & names;
+      std::unordered_map<std::string, name_ref_t> interned;
+
+    public:
+      explicit NamePool(std::vector<char> & names) : names(names) {}
+
+      //! 列の値を加える. NULLなら長さ0.
+      name_ref_t add(SQLiteStmt::iterator & itr, int icol)
+      {
+        if(itr[icol].is_null())
+        {
+          name_ref_t empty = {0, 0};
+          return empty;
+        }
+        const std::string name = static_cast<const char *>(itr[icol]);
+        auto found = interned.find(name);
+        if(found != interned.end()) { return found->second; }
+        const name_ref_t ref = {
+          static_cast<unsigned>(names.size()),
+          static_cast<unsigned>(name.size()),
+        };
+        names.insert(names.end(), name.begin(), name.end());
+        names.push_back('\0');
+        interned.insert(std::make_pair(name, ref));
+        return ref;
+      }
+    };
+
+    //! 運賃表の種別が固定長の配列に収まるか.
+    inline bool fits_type(const char * src)
+    {
+      return src != nullptr && std::strlen(src) < sizeof(fare_t::type);
+    }
+
+    /**
+     * 運賃表の種別を固定長の配列に格納する.
+     * 収まらない種別はSQLで引いた時と同じくstd::invalid_argumentを投げる.
+     */
+    void copy_type(char (&dest)[4], const char * src)
+    {
+      if(!fits_type(src))
+      {
+        throw std::invalid_argument(std::string("too long fare type: ")
+                                    + (src ? src : "NULL"));
+      }
+      std::memset(dest, 0, sizeof(dest));
+      std::strcpy(dest, src);
+    }
+
+    inline int compare_type(const char (&a)[4], const char * b)
+    {
+      return std::strncmp(a, b, sizeof(a));
+    }
+
+    inline int column_or(SQLiteStmt::iterator & itr, int icol, int null)
+    {
+      return itr[icol].is_null() ? null : static_cast<int>(itr[icol]);
+    }
+
+    struct FareLess
+    {
+      bool operator()(const fare_t & a, const fare_t & b) const
+      {
+        const int c = compare_type(a.type, b.type);
+        if(c != 0) { return c < 0; }
+        if(a.company != b.company) { return a.company < b.company; }
+        return a.minkilo < b.minkilo;
+      }
+    };
+
+    struct FareCountryLess
+    {
+      bool operator()(const fare_country_t & a,
+                      const fare_country_t & b) const
+      {
+        const int c = compare_type(a.type, b.type);
+        if(c != 0) { return c < 0; }
+        if(a.company != b.company) { return a.company < b.company; }
+        if(a.fakekilo != b.fakekilo) { return a.fakekilo < b.fakekilo; }
+        return a.realkilo < b.realkilo;
+      }
+    };
+
+    /**
+     * 並べ替えた運賃表を種別と会社の組ごとにキロ程で引ける配列に展開する.
+     * 範囲が重なる場合はSQLと同じく最小キロの小さい行を優先する.
+     */
+    void build_fare_dense(tables_t & t)
+    {
+      auto first = t.fare.begin();
+      while(first != t.fare.end())
+      {
+        auto last = std::find_if(first, t.fare.end(),
+                                 [&first](const fare_t & fare)
+                                 {
+                                   return fare.company != first->company
+                                     || compare_type(fare.type,
+                                                     first->type) != 0;
+                                 });
+        int minkilo = INT_MAX, maxkilo = INT_MIN;
+        for(auto itr=first; itr!=last; ++itr)
+        {
+          minkilo = std::min(minkilo, itr->minkilo);
+          maxkilo = std::max(maxkilo, itr->maxkilo);
+        }
+        fare_group_t group;
+        std::memcpy(group.type, first->type, sizeof(group.type));
+        group.company = first->company;
+        group.minkilo = minkilo;
+        group.offset = t.fare_dense.size();
+        group.length = maxkilo < minkilo ? 0 : maxkilo - minkilo + 1;
+        t.fare_dense.resize(group.offset + group.length, -1);
+        const auto dense = t.fare_dense.begin() + group.offset;
+        for(auto itr=last; itr!=first; )
+        {
+          --itr;
+          if(itr->maxkilo < itr->minkilo) { continue; }
+          std::fill(dense + (itr->minkilo - minkilo),
+                    dense + (itr->maxkilo - minkilo + 1), itr->fare);
+        }
+        t.fare_group.push_back(group);
+        first = last;
+      }
+    }
+
+    //! FNV-1aの初期値.
+    const std::uint32_t FNV_OFFSET_BASIS = 2166136261u;
+
+    //! FNV-1aでvalueの4バイトを下位から順にhに混ぜる.
+    inline void fnv1a_mix(std::uint32_t & h, std::uint32_t value)
+    {
+      for(int i=0; i<4; ++i)
+      {
+        h = (h ^ (value & 0xff)) * 16777619u;
+        value >>= 8;
+      }
+    }
+
+    //! 路線IDと駅IDの組のハッシュ値. FNV-1a.
+    inline std::uint32_t hash_kilo(line_id_t line, station_id_t station)
+    {
+      std::uint32_t h = FNV_OFFSET_BASIS;
+      fnv1a_mix(h, static_cast<std::uint32_t>(line));
+      fnv1a_mix(h, static_cast<std::uint32_t>(station));
+      return h;
+    }
+
+    //! キロ程表から路線IDと駅IDの組のハッシュ表を作る.
+    void build_kilo_hash(tables_t & t)
+    {
+      size_t capacity = 8;
+      while(capacity < t.kilo.size() * 2) { capacity *= 2; }
+      t.kilo_hash.assign(capacity, 0);
+      for(size_t i=0; i<t.kilo.size(); ++i)
+      {
+        size_t slot = hash_kilo(t.kilo[i].line, t.kilo[i].station)
+          & (capacity - 1);
+        while(t.kilo_hash[slot] != 0) { slot = (slot + 1) & (capacity - 1); }
+        t.kilo_hash[slot] = i + 1;
+      }
+    }
+
+    //! 地方交通線特例運賃表のキーのハッシュ値. FNV-1a.
+    inline std::uint32_t hash_fare_country(const char (&type)[4],
+                                           company_id_t company,
+                                           int fakekilo)
+    {
+      std::uint32_t h = FNV_OFFSET_BASIS;
+      std::uint32_t t = 0;
+      std::memcpy(&t, type, sizeof(t));
+      fnv1a_mix(h, t);
+      fnv1a_mix(h, static_cast<std::uint32_t>(company));
+      fnv1a_mix(h, static_cast<std::uint32_t>(fakekilo));
+      return h;
+    }
+
+    inline bool same_fare_country(const fare_country_t & a,
+                                  const fare_country_t & b)
+    {
+      return a.company == b.company && a.fakekilo == b.fakekilo
+        && std::memcmp(a.type, b.type, sizeof(a.type)) == 0;
+    }
+
+    /**
+     * キーが一致する行から運賃を選ぶ.
+     * 実キロが一致するものを優先し, なければ実キロ指定なしのものを使う.
+     */
+    boost::optional<int>
+    select_fare_country(std::pair<const fare_country_t *,
+                                  const fare_country_t *> range,
+                        int realkilo)
+    {
+      boost::optional<int> ret;
+      for(auto itr=range.first; itr != range.second; ++itr)
+      {
+        if(itr->realkilo == realkilo) { return itr->fare; }
+        if(itr->realkilo == -1) { ret = itr->fare; }
+      }
+      return ret;
+    }
+
+    //! 並べ替えた地方交通線特例運賃表からハッシュ表を作る.
+    void build_fare_country_hash(tables_t & t)
+    {
+      size_t capacity = 8;
+      while(capacity < t.fare_country.size() * 2) { capacity *= 2; }
+      t.fare_country_hash.assign(capacity, 0);
+      for(size_t i=0; i<t.fare_country.size(); ++i)
+      {
+        const fare_country_t & fare = t.fare_country[i];
+        if(i > 0 && same_fare_country(t.fare_country[i-1], fare)) { continue; }
+        size_t slot =
+          hash_fare_country(fare.type, fare.company, fare.fakekilo)
+          & (capacity - 1);
+        while(t.fare_country_hash[slot] != 0)
+        { slot = (slot + 1) & (capacity - 1); }
+        t.fare_country_hash[slot] = i + 1;
+      }
+    }
+
+    struct FareSpecialLess
+    {
+      bool operator()(const fare_special_t & a,
+                      const fare_special_t & b) const
+      {
+        if(a.line != b.line) { return a.line < b.line; }
+        if(a.minkilo != b.minkilo) { return a.minkilo < b.minkilo; }
+        return a.maxkilo < b.maxkilo;
+      }
+    };
+
+    /**
+     * 読み込み中の表から区間のキロ程の範囲を求める.
+     * CNetworkSnapshot::get_range()と同じ結果になる.
+     */
+    std::pair<int, int> range_of(const tables_t & t, line_id_t line,
+                                 station_id_t begin, station_id_t end)
+    {
+      const auto kilo_of = [&t, line](station_id_t station) -> const kilo_t *
+        {
+          auto range = std::equal_range(t.kilo.begin(), t.kilo.end(), line,
+                                        liquid::KeyLess<kilo_t, line_id_t,
+                                        &kilo_t::line>());
+          auto itr = std::find_if(range.first, range.second,
+                                  [station](const kilo_t & kilo)
+                                  { return kilo.station == station; });
+          return itr == range.second ? nullptr : &*itr;
+        };
+      const kilo_t * b = kilo_of(begin);
+      const kilo_t * e = kilo_of(end);
+      if(b && e) { return std::minmax(b->kilo, e->kilo); }
+      if(b) { return std::make_pair(b->kilo, b->kilo); }
+      if(e) { return std::make_pair(e->kilo, e->kilo); }
+      return std::make_pair(0, 0);
+    }
+
+    /**
+     * 路線ごとに駅の電車特定区間IDと特例IDをキロ程の順に並べ,
+     * 同じ値が続く範囲を1つにまとめる.
+     */
+    void build_densha_runs(tables_t & t)
+    {
+      for(line_t & line : t.line)
+      {
+        line.densha_begin = t.densha.size();
+        unsigned none_densha = 0, none_circle = 0;
+        for(unsigned i=line.kilo_begin; i<line.kilo_end; ++i)
+        {
+          const kilo_t & kilo = t.kilo[i];
+          auto station = std::lower_bound(t.station.begin(), t.station.end(),
+                                          kilo.station,
+                                          liquid::KeyLess<station_t,
+                                          station_id_t, &station_t::id>());
+          DENSHA_SPECIAL_TYPE denshaid = DENSHA_SPECIAL_NONE;
+          DENSHA_SPECIAL_TYPE circleid = DENSHA_SPECIAL_NONE;
+          if(station != t.station.end() && station->id == kilo.station)
+          {
+            denshaid = station->denshaid;
+            circleid = station->circleid;
+          }
+          if(t.densha.size() > line.densha_begin
+             && t.densha.back().denshaid == denshaid
+             && t.densha.back().circleid == circleid)
+          {
+            t.densha.back().kilo_end = kilo.kilo;
+            continue;
+          }
+          if(denshaid == DENSHA_SPECIAL_NONE) { ++none_densha; }
+          if(circleid == DENSHA_SPECIAL_NONE) { ++none_circle; }
+          densha_run_t run = {kilo.kilo, kilo.kilo, denshaid, circleid,
+                              none_densha, none_circle};
+          t.densha.push_back(run);
+        }
+        line.densha_end = t.densha.size();
+      }
+    }
+
+    /**
+     * 路線ごとに会社が変わる駅のキロ程を並べる.
+     * 駅の会社はキロ程の会社指定, なければ路線の会社とし,
+     * 駅から次の駅までの区間は手前の駅の会社に属するものとする.
+     */
+    void build_company_breaks(tables_t & t)
+    {
+      for(line_t & line : t.line)
+      {
+        line.company_begin = t.company_break.size();
+        for(unsigned i=line.kilo_begin; i<line.kilo_end; ++i)
+        {
+          const kilo_t & kilo = t.kilo[i];
+          const company_id_t company =
+            kilo.company != -1 ? kilo.company : line.company;
+          if(t.company_break.size() > line.company_begin
+             && t.company_break.back().company == company)
+          { continue; }
+          company_break_t brk = {kilo.kilo, company};
+          t.company_break.push_back(brk);
+        }
+        line.company_end = t.company_break.size();
+      }
+    }
+
+    /**
+     * 駅から路線, 路線から接続駅への隣接リストを作る.
+     * 順序はCDatabaseのSQLと同じく, 路線は路線名の順, 接続駅は駅IDの順.
+     */
+    void build_graph(tables_t & t)
+    {
+      std::vector<std::vector<line_id_t> > lines_of(t.station.size());
+      for(const line_t & line : t.line)
+      {
+        for(unsigned i=line.kilo_begin; i<line.kilo_end; ++i)
+        {
+          auto station = std::lower_bound(t.station.begin(), t.station.end(),
+                                          t.kilo[i].station,
+                                          liquid::KeyLess<station_t,
+                                          station_id_t, &station_t::id>());
+          if(station == t.station.end() || station->id != t.kilo[i].station)
+          { continue; }
+          lines_of[station - t.station.begin()].push_back(line.id);
+        }
+      }
+      const auto name_of = [&t](line_id_t id)
+        {
+          const line_t & line =
+            *std::lower_bound(t.line.begin(), t.line.end(), id,
+                              liquid::KeyLess<line_t, line_id_t,
+                              &line_t::id>());
+          return std::make_pair(boost::string_ref(&t.names[line.name.offset],
+                                                  line.name.length), id);
+        };
+      for(size_t i=0; i<t.station.size(); ++i)
+      {
+        std::vector<line_id_t> & lines = lines_of[i];
+        std::sort(lines.begin(), lines.end(),
+                  [&name_of](line_id_t a, line_id_t b)
+                  { return name_of(a) < name_of(b); });
+        t.station[i].line_begin = t.station_line.size();
+        t.station_line.insert(t.station_line.end(), lines.begin(), lines.end());
+        t.station[i].line_end = t.station_line.size();
+      }
+      for(line_t & line : t.line)
+      {
+        line.junction_begin = t.junction.size();
+        for(unsigned i=line.kilo_begin; i<line.kilo_end; ++i)
+        {
+          auto station = std::lower_bound(t.station.begin(), t.station.end(),
+                                          t.kilo[i].station,
+                                          liquid::KeyLess<station_t,
+                                          station_id_t, &station_t::id>());
+          if(station != t.station.end() && station->id == t.kilo[i].station
+             && station->line_end - station->line_begin >= 2)
+          { t.junction.push_back(station->id); }
+        }
+        std::sort(t.junction.begin() + line.junction_begin, t.junction.end());
+        line.junction_end = t.junction.size();
+      }
+    }
+
+    //! データベースから各表を読み込み, 検索用に並べ替える.
+    void load_tables(SQLite & db, tables_t & t)
+    {
+      NamePool pool(t.names);
+      // 空の名前の位置0を'\0'にしておく.
+      t.names.push_back('\0');
+      {
+        SQLiteStmt stmt(db, "SELECT lineid, is_main, linecompanyid, linename"
+                        " FROM line");
+        for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+        {
+          line_t line = {itr[0], column_or(itr, 1, 0), column_or(itr, 2, -1),
+                         0, 0, 0, 0, 0, 0, 0, 0, pool.add(itr, 3)};
+          t.line.push_back(line);
+        }
+        std::sort(t.line.begin(), t.line.end(),
+                  [](const line_t & a, const line_t & b)
+                  { return a.id < b.id; });
+      }
+      {
+        SQLiteStmt stmt(db, "SELECT stationid, denshaid, denshacircleid,"
+                        "       stationname, stationyomi, stationdenryaku"
+                        " FROM station");
+        for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+        {
+          station_t station = {
+            itr[0],
+            DENSHA_SPECIAL_TYPE(column_or(itr, 1, DENSHA_SPECIAL_NONE)),
+            DENSHA_SPECIAL_TYPE(column_or(itr, 2, DENSHA_SPECIAL_NONE)),
+            pool.add(itr, 3), pool.add(itr, 4), pool.add(itr, 5), 0, 0,
+          };
+          t.station.push_back(station);
+        }
+        std::sort(t.station.begin(), t.station.end(),
+                  [](const station_t & a, const station_t & b)
+                  { return a.id < b.id; });
+      }
+      {
+        SQLiteStmt stmt(db, "SELECT lineid, stationid, kilo, kilocompanyid"
+                        " FROM kilo");
+        for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+        {
+          kilo_t kilo = {itr[0], itr[1], itr[2], column_or(itr, 3, -1)};
+          t.kilo.push_back(kilo);
+        }
+        std::sort(t.kilo.begin(), t.kilo.end(),
+                  [](const kilo_t & a, const kilo_t & b)
+                  {
+                    if(a.line != b.line) { return a.line < b.line; }
+                    if(a.kilo != b.kilo) { return a.kilo < b.kilo; }
+                    return a.station < b.station;
+                  });
+        build_kilo_hash(t);
+        for(line_t & line : t.line)
+        {
+          auto range = std::equal_range(t.kilo.begin(), t.kilo.end(),
+                                        line.id,
+                                        liquid::KeyLess<kilo_t, line_id_t,
+                                        &kilo_t::line>());
+          line.kilo_begin = range.first  - t.kilo.begin();
+          line.kilo_end   = range.second - t.kilo.begin();
+        }
+        build_densha_runs(t);
+        build_company_breaks(t);
+        build_graph(t);
+      }
+      {
+        SQLiteStmt stmt(db, "SELECT companyid FROM company");
+        for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+        {
+          company_t company = {itr[0]};
+          t.company.push_back(company);
+        }
+        std::sort(t.company.begin(), t.company.end(),
+                  [](const company_t & a, const company_t & b)
+                  { return a.id < b.id; });
+      }
+      {
+        SQLiteStmt stmt(db, "SELECT type, companyid, minkilo, maxkilo, fare"
+                        " FROM fare");
+        for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+        {
+          fare_t fare;
+          copy_type(fare.type, itr[0]);
+          fare.company = itr[1];
+          fare.minkilo = itr[2];
+          fare.maxkilo = itr[3];
+          fare.fare = itr[4];
+          t.fare.push_back(fare);
+        }
+        std::sort(t.fare.begin(), t.fare.end(), FareLess());
+        build_fare_dense(t);
+      }
+      {
+        SQLiteStmt stmt(db, "SELECT type, companyid, fakekilo, realkilo, fare"
+                        " FROM fare_country");
+        for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+        {
+          fare_country_t fare;
+          copy_type(fare.type, itr[0]);
+          fare.company = itr[1];
+          fare.fakekilo = itr[2];
+          fare.realkilo = column_or(itr, 3, -1);
+          fare.fare = itr[4];
+          t.fare_country.push_back(fare);
+        }
+        std::sort(t.fare_country.begin(), t.fare_country.end(),
+                  FareCountryLess());
+        build_fare_country_hash(t);
+      }
+      {
+        SQLiteStmt stmt(db, "SELECT lineid, beginstation, endstation,"
+                        "       is_add, fare"
+                        " FROM fare_special");
+        for(SQLiteStmt::iterator itr=stmt.execute(); itr; ++itr)
+        {
+          fare_special_t fare = {itr[0], itr[1], itr[2], 0, 0, itr[3], itr[4]};
+          std::tie(fare.minkilo, fare.maxkilo) =
+            range_of(t, fare.line, fare.begin, fare.end);
+          t.fare_special.push_back(fare);
+        }
+        std::sort(t.fare_special.begin(), t.fare_special.end(),
+                  FareSpecialLess());
+      }
+    }
+
+    inline size_t align_image(size_t offset)
+    {
+      return (offset + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+    }
+
+    /**
+     * 配列をセクションとしてイメージに並べる.
+     * 1回目は大きさを数え, 2回目に書き込む.
+     */
+    class ImageWriter
+    {
+    private:
+      std::vector<image_section_t> sections;
+      char * image;
+      size_t offset;
+
+    public:
+      ImageWriter(size_t nsection, char * image)
+        : image(image),
+          offset(align_image(sizeof(image_header_t)
+                             + nsection * sizeof(image_section_t))) {}
+
+      template <class T>
+      void add(SECTION_ID id, const std::vector<T> & table)
+      {
+        image_section_t section = {
+          id, sizeof(T), offset, table.size(),
+        };
+        if(image && !table.empty())
+        {
+          std::memcpy(image + offset, table.data(), sizeof(T) * table.size());
+        }
+        sections.push_back(section);
+        offset = align_image(offset + sizeof(T) * table.size());
+      }
+
+      //! ヘッダとセクション表を書き込み, イメージ全体の大きさを返す.
+      size_t finish()
+      {
+        if(image)
+        {
+          image_header_t header;
+          std::memset(&header, 0, sizeof(header));
+          std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+          header.version = CNetworkSnapshot::FORMAT_VERSION;
+          header.byte_order = IMAGE_BYTE_ORDER;
+          header.nsection = sections.size();
+          header.size = offset;
+          std::memcpy(image, &header, sizeof(header));
+          std::memcpy(image + sizeof(header), sections.data(),
+                      sizeof(image_section_t) * sections.size());
+        }
+        return offset;
+      }
+    };
+
+    const size_t IMAGE_NSECTION = 22;
+
+    size_t write_image(const tables_t & t, char * image)
+    {
+      ImageWriter writer(IMAGE_NSECTION, image);
+      writer.add(SECTION_LINE, t.line);
+      writer.add(SECTION_STATION, t.station);
+      writer.add(SECTION_KILO, t.kilo);
+      writer.add(SECTION_KILO_HASH, t.kilo_hash);
+      writer.add(SECTION_COMPANY, t.company);
+      writer.add(SECTION_FARE, t.fare);
+      writer.add(SECTION_FARE_COUNTRY, t.fare_country);
+      writer.add(SECTION_FARE_SPECIAL, t.fare_special);
+      writer.add(SECTION_FARE_GROUP, t.fare_group);
+      writer.add(SECTION_FARE_DENSE, t.fare_dense);
+      writer.add(SECTION_FARE_COUNTRY_HASH, t.fare_country_hash);
+      writer.add(SECTION_DENSHA, t.densha);
+      writer.add(SECTION_COMPANY_BREAK, t.company_break);
+      writer.add(SECTION_NAMES, t.names);
+      writer.add(SECTION_STATION_LINE, t.station_line);
+      writer.add(SECTION_JUNCTION, t.junction);
+      writer.add(SECTION_NAME_FIELD, t.name_index.fields);
+      writer.add(SECTION_NAME_ID, t.name_index.ids);
+      writer.add(SECTION_NAME_CHARS, t.name_index.chars);
+      writer.add(SECTION_NAME_KEY, t.name_index.keys);
+      writer.add(SECTION_NAME_GRAM, t.name_index.grams);
+      writer.add(SECTION_NAME_POSTING, t.name_index.postings);
+      return writer.finish();
+    }
+
+    /**
+     * イメージからセクションを探してビューにする.
+     * 要素の大きさや範囲が不正なら例外を投げる.
+     */
+    template <class T>
+    liquid::ArrayView<T> find_section(const char * image, size_t size,
+                                      SECTION_ID id)
+    {
+      const image_header_t * header =
+        reinterpret_cast<const image_header_t *>(image);
+      const image_section_t * sections =
+        reinterpret_cast<const image_section_t *>(image + sizeof(*header));
+      for(std::uint32_t i=0; i<header->nsection; ++i)
+      {
+        const image_section_t & section = sections[i];
+        if(section.id != id) { continue; }
+        if(section.elemsize != sizeof(T)
+           || section.offset % IMAGE_ALIGN != 0
+           || section.offset > size
+           || section.count > (size - section.offset) / sizeof(T))
+        {
+          throw InvalidSnapshot("broken section "
+                                + std::to_string(static_cast<int>(id)));
+        }
+        return liquid::ArrayView<T>(
+          reinterpret_cast<const T *>(image + section.offset),
+          section.count);
+      }
+      throw InvalidSnapshot("missing section "
+                            + std::to_string(static_cast<int>(id)));
+    }
+  }
+
+  CNetworkSnapshot::CNetworkSnapshot(SQLite & db)
+  {
+    tables_t t;
+    load_tables(db, t);
+    CNameIndex::load(db, t.name_index);
+    const size_t size = write_image(t, nullptr);
+    std::shared_ptr<char> buffer(new char[size](),
+                                 std::default_delete<char[]>());
+    write_image(t, buffer.get());
+    $.attach(buffer, size);
+  }
+
+  namespace
+  {
+    /**
+     * 開いたファイルを読み込み専用でmmapする. fdは閉じる.
+     * @param[in]  what 例外のメッセージに使うファイルの説明.
+     * @param[out] size 領域のバイト数.
+     */
+    std::shared_ptr<const char> map_readonly(int fd,
+                                             const std::string & what,
+                                             size_t & size)
+    {
+      struct stat st;
+      if(::fstat(fd, &st) != 0 || st.st_size <= 0)
+      {
+        ::close(fd);
+        throw IOException("cannot stat snapshot: " + what);
+      }
+      size = st.st_size;
+      void * addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if(addr == MAP_FAILED)
+      {
+        throw IOException("cannot map snapshot: " + what);
+      }
+      const size_t mapped_size = size;
+      return std::shared_ptr<const char>(
+        static_cast<const char *>(addr),
+        [mapped_size](const char * p)
+        {
+          ::munmap(const_cast<char *>(p), mapped_size);
+        });
+    }
+  }
+
+  CNetworkSnapshot::CNetworkSnapshot(const char * filename)
+  {
+    const int fd = ::open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+      throw IOException(std::string("cannot open snapshot: ") + filename);
+    }
+    size_t size = 0;
+    std::shared_ptr<const char> mapped = map_readonly(fd, filename, size);
+    $.attach(mapped, size);
+  }
+
+  CNetworkSnapshot::CNetworkSnapshot(std::shared_ptr<const char> image,
+                                     size_t size)
+  {
+    $.attach(image, size);
+  }
+
+  namespace
+  {
+    const char POINTER_MAGIC[8] = {'A', 'R', 'E', 'S', 'P', 'T', 'R', '\0'};
+
+    /**
+     * publish()した名前の共有メモリのオブジェクト.
+     * イメージは世代ごとの名前 "name.世代" のオブジェクトに書き,
+     * 書き終えてからgenerationを1回の書き込みで切り替える.
+     * このオブジェクトは削除も作り直しもしないので,
+     * open_shared()が名前のない瞬間を見ることはない.
+     */
+    struct shared_pointer_t
+    {
+      char magic[8];
+      //! 今のイメージの世代. まだなければ0.
+      std::atomic<std::uint64_t> generation;
+    };
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+                  "the generation is shared between processes");
+
+    std::string generation_name(const char * name, std::uint64_t generation)
+    {
+      return std::string(name) + "." + std::to_string(generation);
+    }
+
+    /**
+     * 名前のオブジェクトをmmapする.
+     * @param[in] oflag shm_open()のフラグ. O_CREATなら大きさを合わせる.
+     * @return オブジェクトがないか大きさが違えばnullptr.
+     */
+    std::shared_ptr<shared_pointer_t> map_pointer(const char * name,
+                                                  int oflag)
+    {
+      const int fd = ::shm_open(name, oflag, 0644);
+      if(fd < 0) { return nullptr; }
+      struct stat st;
+      bool ok = ::fstat(fd, &st) == 0;
+      if(ok && (oflag & O_CREAT) && st.st_size == 0)
+      {
+        ok = ::ftruncate(fd, sizeof(shared_pointer_t)) == 0;
+        st.st_size = sizeof(shared_pointer_t);
+      }
+      void * addr = MAP_FAILED;
+      if(ok && st.st_size == sizeof(shared_pointer_t))
+      {
+        const int prot = (oflag & O_ACCMODE) == O_RDONLY ? PROT_READ
+          : PROT_READ | PROT_WRITE;
+        addr = ::mmap(nullptr, sizeof(shared_pointer_t), prot, MAP_SHARED,
+                      fd, 0);
+      }
+      ::close(fd);
+      if(addr == MAP_FAILED) { return nullptr; }
+      return std::shared_ptr<shared_pointer_t>(
+        static_cast<shared_pointer_t *>(addr),
+        [](shared_pointer_t * p)
+        {
+          ::munmap(p, sizeof(shared_pointer_t));
+        });
+    }
+  }
+
+  std::shared_ptr<const CNetworkSnapshot>
+  CNetworkSnapshot::open_shared(const char * name)
+  {
+    std::shared_ptr<shared_pointer_t> pointer = map_pointer(name, O_RDONLY);
+    if(!pointer)
+    {
+      throw IOException(std::string("cannot open shared snapshot: ") + name);
+    }
+    if(std::memcmp(pointer->magic, POINTER_MAGIC, sizeof(POINTER_MAGIC)) != 0)
+    { throw InvalidSnapshot("not published yet"); }
+    // 読んだ世代のオブジェクトは, 開く前に次の世代に替わって
+    // 削除されることがある. その時は新しい世代を開き直す.
+    std::uint64_t generation =
+      pointer->generation.load(std::memory_order_acquire);
+    for(;;)
+    {
+      const std::string image_name = generation_name(name, generation);
+      const int fd = ::shm_open(image_name.c_str(), O_RDONLY, 0);
+      if(fd >= 0)
+      {
+        size_t size = 0;
+        std::shared_ptr<const char> mapped =
+          map_readonly(fd, image_name, size);
+        return std::shared_ptr<const CNetworkSnapshot>(
+          new CNetworkSnapshot(mapped, size));
+      }
+      const std::uint64_t current =
+        pointer->generation.load(std::memory_order_acquire);
+      if(current == generation)
+      {
+        throw IOException(std::string("cannot open shared snapshot: ")
+                          + image_name);
+      }
+      generation = current;
+    }
+  }
+
+  void CNetworkSnapshot::publish(const char * name) const
+  {
+    std::shared_ptr<shared_pointer_t> pointer =
+      map_pointer(name, O_RDWR | O_CREAT);
+    if(!pointer)
+    {
+      // 世代を使わない古い形式のオブジェクトなら作り直す.
+      ::shm_unlink(name);
+      pointer = map_pointer(name, O_RDWR | O_CREAT);
+    }
+    if(!pointer)
+    {
+      throw IOException(std::string("cannot create shared snapshot: ")
+                        + name);
+    }
+    std::memcpy(pointer->magic, POINTER_MAGIC, sizeof(POINTER_MAGIC));
+    // 次の世代の名前で新しいオブジェクトを作る.
+    // 同時にpublish()する他のプロセスとは違う世代を選ぶ.
+    std::uint64_t generation =
+      pointer->generation.load(std::memory_order_acquire);
+    std::string image_name;
+    int fd = -1;
+    while(fd < 0)
+    {
+      image_name = generation_name(name, ++generation);
+      fd = ::shm_open(image_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+      if(fd < 0 && errno != EEXIST)
+      {
+        throw IOException(std::string("cannot create shared snapshot: ")
+                          + image_name);
+      }
+    }
+    void * addr = MAP_FAILED;
+    if(::ftruncate(fd, image_size) == 0)
+    {
+      addr = ::mmap(nullptr, image_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    }
+    ::close(fd);
+    if(addr == MAP_FAILED)
+    {
+      ::shm_unlink(image_name.c_str());
+      throw IOException(std::string("cannot write shared snapshot: ")
+                        + image_name);
+    }
+    // マジックを最後に書き, 書き途中のイメージはattach()で拒まれるようにする.
+    char * p = static_cast<char *>(addr);
+    std::memcpy(p + sizeof(IMAGE_MAGIC), image.get() + sizeof(IMAGE_MAGIC),
+                image_size - sizeof(IMAGE_MAGIC));
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(p, image.get(), sizeof(IMAGE_MAGIC));
+    ::munmap(addr, image_size);
+    // 書き終えてから切り替え, 前の世代を削除する.
+    // 付けているプロセスは削除した古いオブジェクトを使い続ける.
+    const std::uint64_t previous =
+      pointer->generation.exchange(generation, std::memory_order_acq_rel);
+    if(previous != 0)
+    {
+      ::shm_unlink(generation_name(name, previous).c_str());
+    }
+  }
+
+  void CNetworkSnapshot::unpublish(const char * name)
+  {
+    std::shared_ptr<shared_pointer_t> pointer = map_pointer(name, O_RDWR);
+    if(pointer)
+    {
+      const std::uint64_t generation =
+        pointer->generation.exchange(0, std::memory_order_acq_rel);
+      if(generation != 0)
+      {
+        ::shm_unlink(generation_name(name, generation).c_str());
+      }
+    }
+    ::shm_unlink(name);
+  }
+
+  void CNetworkSnapshot::attach(std::shared_ptr<const char> image, size_t size)
+  {
+    const char * p = image.get();
+    if(size < sizeof(image_header_t))
+    { throw InvalidSnapshot("too small image"); }
+    const image_header_t * header =
+      reinterpret_cast<const image_header_t *>(p);
+    if(std::memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+    { throw InvalidSnapshot("bad magic"); }
+    if(header->byte_order != IMAGE_BYTE_ORDER)
+    { throw InvalidSnapshot("different byte order"); }
+    if(header->version != FORMAT_VERSION)
+    {
+      throw InvalidSnapshot("format version "
+                            + std::to_string(header->version)
+                            + " is not "
+                            + std::to_string(FORMAT_VERSION));
+    }
+    if(header->size != size
+       || header->nsection > (size - sizeof(image_header_t))
+                             / sizeof(image_section_t))
+    { throw InvalidSnapshot("broken header"); }
+    line_table = find_section<line_t>(p, size, SECTION_LINE);
+    station_table = find_section<station_t>(p, size, SECTION_STATION);
+    kilo_table = find_section<kilo_t>(p, size, SECTION_KILO);
+    kilo_hash = find_section<unsigned>(p, size, SECTION_KILO_HASH);
+    densha_table = find_section<densha_run_t>(p, size, SECTION_DENSHA);
+    company_table = find_section<company_t>(p, size, SECTION_COMPANY);
+    company_break_table =
+      find_section<company_break_t>(p, size, SECTION_COMPANY_BREAK);
+    fare_table = find_section<fare_t>(p, size, SECTION_FARE);
+    fare_country_table =
+      find_section<fare_country_t>(p, size, SECTION_FARE_COUNTRY);
+    fare_special_table =
+      find_section<fare_special_t>(p, size, SECTION_FARE_SPECIAL);
+    fare_group = find_section<fare_group_t>(p, size, SECTION_FARE_GROUP);
+    fare_dense = find_section<int>(p, size, SECTION_FARE_DENSE);
+    for(const fare_group_t & group : fare_group)
+    {
+      if(group.offset > fare_dense.size()
+         || group.length > fare_dense.size() - group.offset)
+      { throw InvalidSnapshot("broken fare group"); }
+    }
+    fare_country_hash =
+      find_section<unsigned>(p, size, SECTION_FARE_COUNTRY_HASH);
+    if(fare_country_hash.empty()
+       || (fare_country_hash.size() & (fare_country_hash.size() - 1)) != 0)
+    { throw InvalidSnapshot("broken fare_country hash"); }
+    for(const unsigned i : fare_country_hash)
+    {
+      if(i > fare_country_table.size())
+      { throw InvalidSnapshot("broken fare_country hash"); }
+    }
+    for(const line_t & line : line_table)
+    {
+      if(line.kilo_begin > line.kilo_end || line.kilo_end > kilo_table.size()
+         || line.densha_begin > line.densha_end
+         || line.densha_end > densha_table.size()
+         || line.company_begin > line.company_end
+         || line.company_end > company_break_table.size())
+      { throw InvalidSnapshot("broken line table"); }
+    }
+    station_line_table =
+      find_section<line_id_t>(p, size, SECTION_STATION_LINE);
+    junction_table = find_section<station_id_t>(p, size, SECTION_JUNCTION);
+    for(const line_t & line : line_table)
+    {
+      if(line.junction_begin > line.junction_end
+         || line.junction_end > junction_table.size())
+      { throw InvalidSnapshot("broken junction table"); }
+    }
+    for(const station_t & station : station_table)
+    {
+      if(station.line_begin > station.line_end
+         || station.line_end > station_line_table.size())
+      { throw InvalidSnapshot("broken station line table"); }
+    }
+    if(kilo_hash.empty() || (kilo_hash.size() & (kilo_hash.size() - 1)) != 0)
+    { throw InvalidSnapshot("broken kilo hash"); }
+    for(const unsigned i : kilo_hash)
+    {
+      if(i > kilo_table.size())
+      { throw InvalidSnapshot("broken kilo hash"); }
+    }
+    names = find_section<char>(p, size, SECTION_NAMES);
+    const auto valid_name = [this](const name_ref_t & name)
+      {
+        return name.offset < names.size()
+          && name.length < names.size() - name.offset
+          && names[name.offset + name.length] == '\0';
+      };
+    for(const line_t & line : line_table)
+    {
+      if(!valid_name(line.name))
+      { throw InvalidSnapshot("broken line name"); }
+    }
+    for(const station_t & station : station_table)
+    {
+      if(!valid_name(station.name) || !valid_name(station.yomi)
+         || !valid_name(station.denryaku))
+      { throw InvalidSnapshot("broken station name"); }
+    }
+    $.attach_name_index(p, size);
+    $.image = image;
+    $.image_size = size;
+  }
+
+  void CNetworkSnapshot::attach_name_index(const char * p, size_t size)
+  {
+    name_index_t & n = name_index;
+    n.fields = find_section<name_field_t>(p, size, SECTION_NAME_FIELD);
+    n.ids = find_section<int>(p, size, SECTION_NAME_ID);
+    n.chars = find_section<char>(p, size, SECTION_NAME_CHARS);
+    n.keys = find_section<name_key_t>(p, size, SECTION_NAME_KEY);
+    n.grams = find_section<name_gram_t>(p, size, SECTION_NAME_GRAM);
+    n.postings = find_section<unsigned>(p, size, SECTION_NAME_POSTING);
+    const auto valid_range = [](unsigned begin, unsigned end, size_t size)
+      { return begin <= end && end <= size; };
+    const auto valid_string = [&n](const name_ref_t & ref)
+      {
+        return ref.offset <= n.chars.size()
+          && ref.length <= n.chars.size() - ref.offset;
+      };
+    for(const name_field_t & field : n.fields)
+    {
+      if(!valid_range(field.id_begin, field.id_end, n.ids.size())
+         || !valid_range(field.forward_begin, field.forward_end,
+                         n.keys.size())
+         || !valid_range(field.backward_begin, field.backward_end,
+                         n.keys.size())
+         || !valid_range(field.gram_begin, field.gram_end, n.grams.size()))
+      { throw InvalidSnapshot("broken name field"); }
+      const unsigned nid = field.id_end - field.id_begin;
+      const unsigned nkey = field.forward_end - field.forward_begin;
+      const auto check_keys = [&](unsigned begin, unsigned end)
+        {
+          for(unsigned i=begin; i<end; ++i)
+          {
+            if(!valid_string(n.keys[i].key) || n.keys[i].entry >= nid)
+            { throw InvalidSnapshot("broken name key"); }
+          }
+        };
+      check_keys(field.forward_begin, field.forward_end);
+      check_keys(field.backward_begin, field.backward_end);
+      for(unsigned i=field.gram_begin; i<field.gram_end; ++i)
+      {
+        const name_gram_t & gram = n.grams[i];
+        if(!valid_string(gram.gram)
+           || !valid_range(gram.begin, gram.end, n.postings.size()))
+        { throw InvalidSnapshot("broken name gram"); }
+        for(unsigned j=gram.begin; j<gram.end; ++j)
+        {
+          if(n.postings[j] >= nkey)
+          { throw InvalidSnapshot("broken name posting"); }
+        }
+      }
+    }
+  }
+
+  void CNetworkSnapshot::write(const char * filename) const
+  {
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary
+                      | std::ios::trunc);
+    ofs.write(image.get(), image_size);
+    ofs.close();
+    if(!ofs)
+    {
+      throw IOException(std::string("cannot write snapshot: ") + filename);
+    }
+  }
+
+  const CNetworkSnapshot::line_t *
+  CNetworkSnapshot::find_line(line_id_t line) const
+  {
+    auto itr = std::lower_bound(line_table.begin(), line_table.end(), line,
+                                liquid::KeyLess<line_t, line_id_t,
+                                &line_t::id>());
+    if(itr == line_table.end() || itr->id != line) { return nullptr; }
+    return &*itr;
+  }
+
+  const CNetworkSnapshot::station_t *
+  CNetworkSnapshot::find_station(station_id_t station) const
+  {
+    auto itr = std::lower_bound(station_table.begin(), station_table.end(),
+                                station,
+                                liquid::KeyLess<station_t, station_id_t,
+                                &station_t::id>());
+    if(itr == station_table.end() || itr->id != station) { return nullptr; }
+    return &*itr;
+  }
+
+  const CNetworkSnapshot::station_t &
+  CNetworkSnapshot::get_station(station_id_t station) const
+  {
+    const station_t * s = $.find_station(station);
+    if(s == nullptr)
+    {
+      throw std::out_of_range("station id not found: "
+                              + std::to_string(station));
+    }
+    return *s;
+  }
+
+  boost::string_ref CNetworkSnapshot::get_line_name(line_id_t line) const
+  {
+    const line_t * l = $.find_line(line);
+    if(l == nullptr)
+    {
+      throw std::out_of_range("line id not found: " + std::to_string(line));
+    }
+    return $.get_name(l->name);
+  }
+
+  boost::string_ref
+  CNetworkSnapshot::get_station_name(station_id_t station) const
+  {
+    return $.get_name($.get_station(station).name);
+  }
+
+  boost::string_ref
+  CNetworkSnapshot::get_station_yomi(station_id_t station) const
+  {
+    return $.get_name($.get_station(station).yomi);
+  }
+
+  boost::string_ref
+  CNetworkSnapshot::get_station_denryaku(station_id_t station) const
+  {
+    return $.get_name($.get_station(station).denryaku);
+  }
+
+  liquid::ArrayView<line_id_t>
+  CNetworkSnapshot::get_lines_of_station(station_id_t station) const
+  {
+    const station_t * s = $.find_station(station);
+    if(s == nullptr) { return liquid::ArrayView<line_id_t>(); }
+    return liquid::ArrayView<line_id_t>(
+      station_line_table.begin() + s->line_begin, s->line_end - s->line_begin);
+  }
+
+  liquid::ArrayView<CNetworkSnapshot::kilo_t>
+  CNetworkSnapshot::get_kilos_of_line(line_id_t line) const
+  {
+    const line_t * l = $.find_line(line);
+    if(l == nullptr) { return liquid::ArrayView<kilo_t>(); }
+    return liquid::ArrayView<kilo_t>(kilo_table.begin() + l->kilo_begin,
+                                     l->kilo_end - l->kilo_begin);
+  }
+
+  liquid::ArrayView<station_id_t>
+  CNetworkSnapshot::get_junctions_of_line(line_id_t line) const
+  {
+    const line_t * l = $.find_line(line);
+    if(l == nullptr) { return liquid::ArrayView<station_id_t>(); }
+    return liquid::ArrayView<station_id_t>(
+      junction_table.begin() + l->junction_begin,
+      l->junction_end - l->junction_begin);
+  }
+
+  bool CNetworkSnapshot::is_main_line(line_id_t line) const
+  {
+    const line_t * l = $.find_line(line);
+    if(l == nullptr)
+    {
+      throw std::out_of_range("line id not found: " + std::to_string(line));
+    }
+    return l->is_main != 0;
+  }
+
+  const CNetworkSnapshot::kilo_t *
+  CNetworkSnapshot::find_kilo(line_id_t line, station_id_t station) const
+  {
+    const size_t mask = kilo_hash.size() - 1;
+    for(size_t slot = hash_kilo(line, station) & mask; kilo_hash[slot] != 0;
+        slot = (slot + 1) & mask)
+    {
+      const kilo_t & kilo = kilo_table[kilo_hash[slot] - 1];
+      if(kilo.line == line && kilo.station == station) { return &kilo; }
+    }
+    return nullptr;
+  }
+
+  int CNetworkSnapshot::get_kilo(line_id_t line, station_id_t station) const
+  {
+    const kilo_t * k = $.find_kilo(line, station);
+    return k ? k->kilo : -1;
+  }
+
+  std::pair<int, int> CNetworkSnapshot::get_range(line_id_t line,
+                                                  station_id_t begin,
+                                                  station_id_t end) const
+  {
+    // SQLのmin(), max()と同じく, 見つからない駅は無視し全くなければ0とする.
+    const kilo_t * b = $.find_kilo(line, begin);
+    const kilo_t * e = $.find_kilo(line, end);
+    if(b && e) { return std::minmax(b->kilo, e->kilo); }
+    if(b) { return std::make_pair(b->kilo, b->kilo); }
+    if(e) { return std::make_pair(e->kilo, e->kilo); }
+    return std::make_pair(0, 0);
+  }
+
+  bool CNetworkSnapshot::is_belong_to_line(line_id_t line,
+                                           station_id_t station) const
+  {
+    return $.find_kilo(line, station) != nullptr;
+  }
+
+  bool CNetworkSnapshot::is_contains(line_id_t line,
+                                     station_id_t begin,
+                                     station_id_t end,
+                                     station_id_t station) const
+  {
+    const kilo_t * s = $.find_kilo(line, station);
+    if(s == nullptr) { return false; }
+    const kilo_t * b = $.find_kilo(line, begin);
+    const kilo_t * e = $.find_kilo(line, end);
+    // 始点も終点も路線上になければ区間はNULLになる.
+    if(!b && !e) { return false; }
+    const int lo = std::min(b ? b->kilo : e->kilo, e ? e->kilo : b->kilo);
+    const int hi = std::max(b ? b->kilo : e->kilo, e ? e->kilo : b->kilo);
+    return lo <= s->kilo && s->kilo <= hi;
+  }
+
+  size_t CNetworkSnapshot::get_stations_of_segment(line_id_t line,
+                                                   station_id_t begin,
+                                                   station_id_t end,
+                                                   station_vector & result) const
+  {
+    const line_t * l = $.find_line(line);
+    if(l == nullptr) { return 0; }
+    const int kilo_begin = $.get_kilo(line, begin);
+    const int kilo_end   = $.get_kilo(line, end);
+    const int kilo_min = std::min(kilo_begin, kilo_end);
+    const int kilo_max = std::max(kilo_begin, kilo_end);
+    const size_t size_before = result.size();
+    for(unsigned i=l->kilo_begin; i<l->kilo_end; ++i)
+    {
+      const kilo_t & k = kilo_table[i];
+      if(kilo_min <= k.kilo && k.kilo <= kilo_max)
+      { result.push_back(k.station); }
+    }
+    if(kilo_begin > kilo_end)
+    { std::reverse(result.begin() + size_before, result.end()); }
+    return result.size() - size_before;
+  }
+
+  std::pair<DENSHA_SPECIAL_TYPE, DENSHA_SPECIAL_TYPE>
+  CNetworkSnapshot::get_denshaid(line_id_t line,
+                                 std::pair<int, int> range) const
+  {
+    const auto none = std::make_pair(DENSHA_SPECIAL_NONE, DENSHA_SPECIAL_NONE);
+    const line_t * l = $.find_line(line);
+    if(l == nullptr) { return none; }
+    const densha_run_t * begin = densha_table.begin() + l->densha_begin;
+    const densha_run_t * end = densha_table.begin() + l->densha_end;
+    // 範囲に駅を含む最初と最後のまとまり.
+    const densha_run_t * first =
+      std::partition_point(begin, end, [&range](const densha_run_t & run)
+                           { return run.kilo_end < range.first; });
+    const densha_run_t * last =
+      std::partition_point(first, end, [&range](const densha_run_t & run)
+                           { return run.kilo_begin <= range.second; });
+    if(first == last) { return none; }
+    --last;
+    // 累積数が増えていれば途中に特定区間外のまとまりがある.
+    const bool densha = first->denshaid != DENSHA_SPECIAL_NONE
+      && first->none_densha == last->none_densha;
+    if(!densha) { return none; }
+    const bool circle = first->circleid != DENSHA_SPECIAL_NONE
+      && first->none_circle == last->none_circle;
+    return std::make_pair(std::max(first->denshaid, last->denshaid),
+                          circle ? std::max(first->circleid, last->circleid)
+                          : DENSHA_SPECIAL_NONE);
+  }
+
+  bool CNetworkSnapshot::get_company_and_kilo(line_id_t line,
+                                              std::pair<int, int> range,
+                                              std::vector<CKiloValue> & result,
+                                              bool & is_main) const
+  {
+    const line_t * l = $.find_line(line);
+    if(l == nullptr) { return false; }
+    is_main = l->is_main;
+    if(range.second <= range.first) { return false; }
+    const company_break_t * begin =
+      company_break_table.begin() + l->company_begin;
+    const company_break_t * end =
+      company_break_table.begin() + l->company_end;
+    // 範囲の始点を含む区切りから, 終点より手前の区切りまで.
+    const company_break_t * itr =
+      std::partition_point(begin, end, [&range](const company_break_t & brk)
+                           { return brk.kilo <= range.first; });
+    if(itr != begin) { --itr; }
+    for(; itr != end && itr->kilo < range.second; ++itr)
+    {
+      const int kilo_begin = std::max(itr->kilo, range.first);
+      const int kilo_end = (itr + 1 != end)
+        ? std::min((itr + 1)->kilo, range.second) : range.second;
+      result.push_back({itr->company, kilo_begin, kilo_end});
+    }
+    return true;
+  }
+
+  boost::optional<int> CNetworkSnapshot::get_fare_table(const char * table,
+                                                        company_id_t company,
+                                                        int kilo) const
+  {
+    // 収まらない種別の運賃表はない.
+    if(!fits_type(table)) { return boost::none; }
+    fare_group_t key;
+    copy_type(key.type, table);
+    key.company = company;
+    auto itr = std::lower_bound(fare_group.begin(), fare_group.end(), key,
+                                [](const fare_group_t & a,
+                                   const fare_group_t & b)
+                                {
+                                  const int c = compare_type(a.type, b.type);
+                                  if(c != 0) { return c < 0; }
+                                  return a.company < b.company;
+                                });
+    if(itr == fare_group.end() || itr->company != company
+       || compare_type(itr->type, table) != 0)
+    { return boost::none; }
+    if(kilo < itr->minkilo
+       || static_cast<unsigned>(kilo - itr->minkilo) >= itr->length)
+    { return boost::none; }
+    const int fare = fare_dense[itr->offset + (kilo - itr->minkilo)];
+    if(fare < 0) { return boost::none; }
+    return fare;
+  }
+
+  std::pair<const fare_country_t *, const fare_country_t *>
+  CNetworkSnapshot::find_fare_country(const char (&type)[4],
+                                      company_id_t company,
+                                      int fakekilo) const
+  {
+    const size_t mask = fare_country_hash.size() - 1;
+    size_t slot = hash_fare_country(type, company, fakekilo) & mask;
+    for(; fare_country_hash[slot] != 0; slot = (slot + 1) & mask)
+    {
+      const fare_country_t * first =
+        &fare_country_table[fare_country_hash[slot] - 1];
+      if(first->company != company || first->fakekilo != fakekilo
+         || std::memcmp(first->type, type, sizeof(type)) != 0)
+      { continue; }
+      const fare_country_t * last = first + 1;
+      while(last != fare_country_table.end() && same_fare_country(*first, *last))
+      { ++last; }
+      return std::make_pair(first, last);
+    }
+    return std::make_pair(nullptr, nullptr);
+  }
+
+  boost::optional<int>
+  CNetworkSnapshot::get_fare_country_table(const char * table,
+                                           company_id_t company,
+                                           int realkilo,
+                                           int fakekilo) const
+  {
+    if(!fits_type(table)) { return boost::none; }
+    char type[4];
+    copy_type(type, table);
+    return select_fare_country($.find_fare_country(type, company, fakekilo),
+                               realkilo);
+  }
+
+  void CNetworkSnapshot::get_fare_country_table(
+    const char * table,
+    company_id_t company,
+    const std::vector<std::pair<int, int> > & kilos,
+    std::vector<boost::optional<int> > & result) const
+  {
+    if(!fits_type(table))
+    {
+      result.assign(kilos.size(), boost::none);
+      return;
+    }
+    char type[4];
+    copy_type(type, table);
+    result.resize(kilos.size());
+    for(size_t i=0; i<kilos.size(); ++i)
+    {
+      result[i] = select_fare_country(
+        $.find_fare_country(type, company, kilos[i].second), kilos[i].first);
+    }
+  }
+
+  boost::optional<
+    std::pair<bool,int> > CNetworkSnapshot::get_special_fare(line_id_t line,
+                                                             station_id_t begin,
+                                                             station_id_t end) const
+  {
+    auto range = std::equal_range(fare_special_table.begin(),
+                                  fare_special_table.end(),
+                                  line,
+                                  liquid::KeyLess<fare_special_t, line_id_t,
+                                  &fare_special_t::line>());
+    const std::pair<int, int> q_range = $.get_range(line, begin, end);
+    fare_special_t key;
+    key.line = line;
+    key.minkilo = q_range.first;
+    key.maxkilo = q_range.second;
+    // 始点と終点が一致する行は範囲も一致するので, その中から探す.
+    auto exact = std::equal_range(range.first, range.second,
+                                  key, FareSpecialLess());
+    for(auto itr=exact.first; itr != exact.second; ++itr)
+    {
+      if((itr->begin==begin && itr->end==end)
+         || (itr->end==begin && itr->begin==end))
+      { return std::make_pair(itr->is_add != 0, itr->fare); }
+    }
+    // 最小キロが区間内にある行のうち, 最大キロも区間内で最も長いもの.
+    key.maxkilo = INT_MIN;
+    auto first = std::lower_bound(range.first, range.second,
+                                  key, FareSpecialLess());
+    const fare_special_t * longest = nullptr;
+    for(auto itr=first;
+        itr != range.second && itr->minkilo <= q_range.second; ++itr)
+    {
+      // 後の行は最小キロが大きいので, 区間に含まれても今の最長より短い.
+      if(longest && q_range.second - itr->minkilo
+         <= longest->maxkilo - longest->minkilo)
+      { break; }
+      const int length = itr->maxkilo - itr->minkilo;
+      if(itr->maxkilo <= q_range.second && 0 < length
+         && (!longest || longest->maxkilo - longest->minkilo < length))
+      { longest = itr; }
+    }
+    if(!longest) { return boost::none; }
+    return std::make_pair(longest->is_add != 0, longest->fare);
+  }
+}
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <boost/utility.hpp>
+#include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "util.hpp"
+#include "ares.h"
+
+namespace sqlite3_wrapper
+{
+  class SQLite;
+}
+
+namespace ares
+{
+  struct CKiloValue;
+
+  /**
+   * @~english
+   * Exception to represent that the snapshot image is broken
+   * or written in other format version.
+   */
+  /**
+   * @~japanese
+   * スナップショットのイメージが壊れているか形式が異なる時の例外.
+   */
+  class InvalidSnapshot : public std::runtime_error
+  {
+  public:
+    explicit InvalidSnapshot(const std::string & what)
+      : std::runtime_error("Invalid snapshot: " + what) {}
+  };
+
+  /**
+   * @~english
+   * Immutable in-memory copy of the rail network and fare tables.
+   */
+  /**
+   * @~japanese
+   * 路線網と運賃表を読み込んだ変更不可能なスナップショット.
+   * 構築時にline, station, kilo, company, fare, fare_country, fare_specialの
+   * 各表を一度だけ読み込み, ソート済みの配列として保持する.
+   * 以降の問い合わせはSQLを使わずに配列の参照や二分探索で答える.
+   * 各メンバ関数の結果はCDatabaseの同名の関数と同じになる.
+   * 駅名と路線名の索引(CNameIndex)の表も構築時に作っておく.
+   *
+   * すべての表は1つの連続した領域(イメージ)の中に置かれる.
+   * イメージはそのままファイルに書き出すことができ,
+   * 書き出したファイルはmmapして解析もコピーもせずに使える.
+   * 共有メモリに置けば, 同じホストの複数のプロセスが1つのイメージを共有できる.
+   * イメージはヘッダ, セクション表, 各セクションの配列からなり,
+   * 記録された形式のバージョンと各要素の大きさが一致しなければ読み込まない.
+   */
+  class CNetworkSnapshot : boost::noncopyable
+  {
+  public:
+    //! イメージの形式のバージョン. 形式を変えたら上げること.
+    static const unsigned FORMAT_VERSION = 10;
+
+    //! 名前の表の中の文字列の位置. 名前がなければ長さ0.
+    struct name_ref_t
+    {
+      unsigned offset, length;
+    };
+
+    //! 路線表の1行.
+    struct line_t
+    {
+      line_id_t id;
+      int is_main;
+      company_id_t company;
+      //! kilo_tableの中のこの路線の範囲[kilo_begin, kilo_end).
+      unsigned kilo_begin, kilo_end;
+      //! densha_tableの中のこの路線の範囲[densha_begin, densha_end).
+      unsigned densha_begin, densha_end;
+      //! company_tableの中のこの路線の範囲[company_begin, company_end).
+      unsigned company_begin, company_end;
+      //! junction_tableの中のこの路線の範囲[junction_begin, junction_end).
+      unsigned junction_begin, junction_end;
+      name_ref_t name;
+    };
+
+    //! 駅表の1行. 電車特定区間でなければDENSHA_SPECIAL_NONE.
+    struct station_t
+    {
+      station_id_t id;
+      DENSHA_SPECIAL_TYPE denshaid, circleid;
+      name_ref_t name, yomi, denryaku;
+      //! station_line_tableの中のこの駅の範囲[line_begin, line_end).
+      unsigned line_begin, line_end;
+    };
+
+    //! キロ程表の1行. 路線ID, キロ程の順に並べる. 会社指定がなければ-1.
+    struct kilo_t
+    {
+      line_id_t line;
+      station_id_t station;
+      int kilo;
+      company_id_t company;
+    };
+
+    /**
+     * 路線上で電車特定区間IDと山手・大阪環状特例IDが同じ駅が続く範囲.
+     * 路線ごとにキロ程の順に並べ, 先頭からの特定区間外の数を累積しておく.
+     */
+    struct densha_run_t
+    {
+      //! 範囲の最初と最後の駅のキロ程.
+      int kilo_begin, kilo_end;
+      DENSHA_SPECIAL_TYPE denshaid, circleid;
+      //! 路線の先頭からこの範囲までの, 電車特定区間外・特例外の範囲の数.
+      unsigned none_densha, none_circle;
+    };
+
+    /**
+     * 路線上で会社が変わるキロ程.
+     * このキロ程の駅から次の区切りの駅までの区間がcompanyに属する.
+     */
+    struct company_break_t
+    {
+      int kilo;
+      company_id_t company;
+    };
+
+    //! 会社表の1行.
+    struct company_t
+    {
+      company_id_t id;
+    };
+
+    //! 運賃表の1行. 種別, 会社, 最小キロの順に並べる.
+    struct fare_t
+    {
+      char type[4];
+      company_id_t company;
+      int minkilo, maxkilo, fare;
+    };
+
+    /**
+     * 運賃表の種別と会社の組ごとに, キロ程で直接引ける密な配列の位置.
+     * fare_denseの[offset, offset+length)がキロ程minkilo以降の運賃で,
+     * 該当する行がなければ-1が入る.
+     */
+    struct fare_group_t
+    {
+      char type[4];
+      company_id_t company;
+      int minkilo;
+      unsigned offset, length;
+    };
+
+    //! 地方交通線特例運賃表の1行. 実キロの指定がなければ-1.
+    struct fare_country_t
+    {
+      char type[4];
+      company_id_t company;
+      int fakekilo, realkilo, fare;
+    };
+
+    /**
+     * 加算運賃・社線運賃表の1行.
+     * 始点と終点のキロ程の範囲[minkilo, maxkilo]を構築時に求めておき,
+     * 路線, 最小キロ, 最大キロの順に並べる.
+     */
+    struct fare_special_t
+    {
+      line_id_t line;
+      station_id_t begin, end;
+      int minkilo, maxkilo;
+      int is_add, fare;
+    };
+
+    /**
+     * CNameIndexの1つの列の索引.
+     * 各範囲はname_index_tの同名の配列の中の[begin, end).
+     */
+    struct name_field_t
+    {
+      //! idsの中の, 値の順に並べた列のID.
+      unsigned id_begin, id_end;
+      //! keysの中の, キーの順に並べたキー.
+      unsigned forward_begin, forward_end;
+      //! keysの中の, 文字を逆順にしたキーの順に並べたキー.
+      unsigned backward_begin, backward_end;
+      //! gramsの中の, n-gramの順に並べたn-gram.
+      unsigned gram_begin, gram_end;
+    };
+
+    //! 索引のキー. 文字列はname_index_t::charsの中, entryは列のidsの添字.
+    struct name_key_t
+    {
+      name_ref_t key;
+      unsigned entry;
+    };
+
+    /**
+     * n-gramと転置リスト.
+     * 文字列はname_index_t::charsの中, 転置リストはpostingsの[begin, end)で,
+     * 列のforwardの添字を昇順に並べたもの.
+     */
+    struct name_gram_t
+    {
+      name_ref_t gram;
+      unsigned begin, end;
+    };
+
+    //! CNameIndexがイメージの中のまま使う名前の索引.
+    struct name_index_t
+    {
+      liquid::ArrayView<name_field_t> fields;
+      liquid::ArrayView<int> ids;
+      liquid::ArrayView<char> chars;
+      liquid::ArrayView<name_key_t> keys;
+      liquid::ArrayView<name_gram_t> grams;
+      liquid::ArrayView<unsigned> postings;
+    };
+
+  private:
+    //! すべての表を格納するイメージ. ヒープ上かmmapした領域.
+    std::shared_ptr<const char> image;
+    size_t image_size;
+
+    liquid::ArrayView<line_t> line_table;
+    liquid::ArrayView<station_t> station_table;
+    liquid::ArrayView<kilo_t> kilo_table;
+    liquid::ArrayView<densha_run_t> densha_table;
+    /**
+     * 路線ID, 駅IDをキーとする開番地法のハッシュ表.
+     * 大きさは2の冪で, 各要素はkilo_tableの添字に1を足した値. 空きは0.
+     * get_kilo(), is_belong_to_line(), is_contains()はこれを引くだけで答える.
+     */
+    liquid::ArrayView<unsigned> kilo_hash;
+    liquid::ArrayView<company_t> company_table;
+    //! 路線ごとにキロ程の順に並べた会社の区切り.
+    liquid::ArrayView<company_break_t> company_break_table;
+    liquid::ArrayView<fare_t> fare_table;
+    //! 種別, 会社の順に並べた密な運賃表の索引.
+    liquid::ArrayView<fare_group_t> fare_group;
+    liquid::ArrayView<int> fare_dense;
+    liquid::ArrayView<fare_country_t> fare_country_table;
+    /**
+     * 種別, 会社, 擬制キロをキーとする開番地法のハッシュ表.
+     * 大きさは2の冪で, 各要素はfare_country_tableでキーが同じ行の
+     * 先頭の添字に1を足した値. 空きは0.
+     */
+    liquid::ArrayView<unsigned> fare_country_hash;
+    liquid::ArrayView<fare_special_t> fare_special_table;
+    /**
+     * 路線名, 駅名, 読み, 電略を重複なく並べた文字列.
+     * 各文字列の後ろには'\0'を置く.
+     */
+    liquid::ArrayView<char> names;
+    /**
+     * 駅ごとに, 駅の属する路線IDを路線名の順に並べたもの.
+     * station_tと合わせて駅から路線への隣接リスト(CSR)になる.
+     */
+    liquid::ArrayView<line_id_t> station_line_table;
+    /**
+     * 路線ごとに, 他の路線と接続する駅のIDを昇順に並べたもの.
+     * line_tと合わせて路線から接続駅への隣接リスト(CSR)になる.
+     */
+    liquid::ArrayView<station_id_t> junction_table;
+    //! 駅名と路線名の索引. CNameIndex::load()で作る.
+    name_index_t name_index;
+
+    //! イメージを検査して各表のビューを設定する.
+    void attach(std::shared_ptr<const char> image, size_t size);
+    //! イメージを検査して名前の索引のビューを設定する.
+    void attach_name_index(const char * image, size_t size);
+
+    //! 既にあるイメージを検査して使う.
+    CNetworkSnapshot(std::shared_ptr<const char> image, size_t size);
+
+    const line_t * find_line(line_id_t line) const;
+    const station_t * find_station(station_id_t station) const;
+    //! 駅IDの駅. なければ例外を投げる.
+    const station_t & get_station(station_id_t station) const;
+    boost::string_ref get_name(name_ref_t name) const
+    {
+      return boost::string_ref(names.begin() + name.offset, name.length);
+    }
+    const kilo_t * find_kilo(line_id_t line, station_id_t station) const;
+    //! 地方交通線特例運賃表でキーが一致する行の範囲.
+    std::pair<const fare_country_t *, const fare_country_t *>
+    find_fare_country(const char (&type)[4], company_id_t company,
+                      int fakekilo) const;
+
+  public:
+    /**
+     * Constructor.
+     * Load all tables from the database.
+     * @param[in] db The database to read.
+     */
+    explicit CNetworkSnapshot(sqlite3_wrapper::SQLite & db);
+
+    /**
+     * Constructor.
+     * Map the image file written by write() without copying.
+     * @param[in] filename The filename of the image.
+     * @throw IOException     The file cannot be opened or mapped.
+     * @throw InvalidSnapshot The file is broken or in other version.
+     */
+    explicit CNetworkSnapshot(const char * filename);
+
+    /**
+     * Write the image into file.
+     * @param[in] filename The filename to write.
+     * @throw IOException  Failed to write.
+     */
+    void write(const char * filename) const;
+
+    /**
+     * Publish the image into a POSIX shared memory object,
+     * so that other processes on the host attach it by open_shared()
+     * and hold one copy of the data between them.
+     * The image is written into an object named after the name and
+     * a generation number, e.g. "/ares.2", and then the small object
+     * with the name itself is switched to it in one atomic store.
+     * An image already published with the name is replaced, and
+     * open_shared() finds either the old or the new image at any moment;
+     * processes attached to the old one keep it until they release it.
+     * The objects remain after this process exits, until unpublish().
+     * @param[in] name The name of the object, such as "/ares".
+     * @throw IOException Failed to create or write the object.
+     */
+    void publish(const char * name) const;
+
+    /**
+     * Attach the image published by publish() read-only, without copying.
+     * The name index in the image is shared too, see CNameIndex.
+     * @param[in] name The name of the object.
+     * @throw IOException     No object has the name.
+     * @throw InvalidSnapshot The object is broken, in other version,
+     *                        or still being written.
+     */
+    static std::shared_ptr<const CNetworkSnapshot>
+    open_shared(const char * name);
+
+    //! publish()した共有メモリのオブジェクトを今のイメージと共に削除する.
+    static void unpublish(const char * name);
+
+    //! イメージの先頭.
+    const char * data() const { return image.get(); }
+
+    //! イメージのバイト数.
+    size_t size() const { return image_size; }
+
+    //! 読み込んだ表の大きさ.
+    size_t line_size() const { return line_table.size(); }
+    size_t station_size() const { return station_table.size(); }
+    size_t kilo_size() const { return kilo_table.size(); }
+    size_t company_size() const { return company_table.size(); }
+    size_t fare_size() const { return fare_table.size(); }
+    size_t fare_country_size() const { return fare_country_table.size(); }
+    size_t fare_special_size() const { return fare_special_table.size(); }
+
+    /**
+     * 路線名, 駅名, 読み, 電略.
+     * 文字列はイメージの中にあり, 確保も問い合わせもしない.
+     * スナップショットより長く使ってはいけない.
+     * IDがなければstd::out_of_rangeを投げる. 名前がなければ空文字列.
+     */
+    boost::string_ref get_line_name(line_id_t line) const;
+    boost::string_ref get_station_name(station_id_t station) const;
+    boost::string_ref get_station_yomi(station_id_t station) const;
+    boost::string_ref get_station_denryaku(station_id_t station) const;
+
+    /**
+     * 路線と駅の接続.
+     * 構築時に隣接リストを作っておき, 問い合わせも確保もせずに配列を返す.
+     * 路線や駅がなければ空の配列を返す.
+     */
+    //! 駅の属する路線. 路線名の順.
+    liquid::ArrayView<line_id_t>
+    get_lines_of_station(station_id_t station) const;
+    //! 路線の駅とキロ程. キロ程の順.
+    liquid::ArrayView<kilo_t> get_kilos_of_line(line_id_t line) const;
+    //! 路線の駅のうち, 他の路線にも属する駅. 駅IDの順.
+    liquid::ArrayView<station_id_t>
+    get_junctions_of_line(line_id_t line) const;
+
+    /**
+     * 駅名と路線名の索引の表.
+     * CNameIndexはSQLで作り直さずにこれを使う.
+     * スナップショットより長く使ってはいけない.
+     */
+    const name_index_t & get_name_index() const { return name_index; }
+
+    //! 幹線ならtrue. 路線がなければstd::out_of_rangeを投げる.
+    bool is_main_line(line_id_t line) const;
+
+    //! 駅の路線上のキロ程. 路線に属さなければ-1.
+    int get_kilo(line_id_t line, station_id_t station) const;
+
+    //! 区間のキロ程の小さい値と大きい値のペア.
+    std::pair<int, int> get_range(line_id_t line,
+                                  station_id_t begin,
+                                  station_id_t end) const;
+
+    //! 駅が路線に属するかを調べる.
+    bool is_belong_to_line(line_id_t line, station_id_t station) const;
+
+    //! 駅が区間[begin, end]に含まれるかを調べる.
+    bool is_contains(line_id_t line,
+                     station_id_t begin,
+                     station_id_t end,
+                     station_id_t station) const;
+
+    //! 区間の駅を始点から終点の順に加える.
+    size_t get_stations_of_segment(line_id_t line,
+                                   station_id_t begin,
+                                   station_id_t end,
+                                   station_vector & result) const;
+
+    /**
+     * 路線のキロ程の範囲[first, second]の電車特定区間IDと山手・大阪環状特例ID.
+     * 範囲の駅に1つでも特定区間外があればDENSHA_SPECIAL_NONEになる.
+     */
+    std::pair<DENSHA_SPECIAL_TYPE, DENSHA_SPECIAL_TYPE>
+    get_denshaid(line_id_t line, std::pair<int, int> range) const;
+
+    /**
+     * 路線のキロ程の範囲[first, second]を会社ごとに分けて結果に加える.
+     * 区間の長さが0なら何も加えずにfalseを返す.
+     * @param[in]  line    路線ID.
+     * @param[in]  range   キロ程の範囲.
+     * @param[out] result  会社ごとのキロ程の範囲を加える配列.
+     * @param[out] is_main 幹線ならtrue, 地方交通線ならfalse.
+     */
+    bool get_company_and_kilo(line_id_t line,
+                              std::pair<int, int> range,
+                              std::vector<CKiloValue> & result,
+                              bool & is_main) const;
+
+    //! 運賃表を引く. 該当がなければ無効値.
+    boost::optional<int> get_fare_table(const char * table,
+                                        company_id_t company,
+                                        int kilo) const;
+
+    //! JR四国・九州の地方交通線特例運賃表を引く.
+    boost::optional<int> get_fare_country_table(const char * table,
+                                                company_id_t company,
+                                                int realkilo,
+                                                int fakekilo) const;
+
+    /**
+     * 地方交通線特例運賃表をまとめて引く.
+     * @param[in]  table   運賃表の種別.
+     * @param[in]  company 会社ID.
+     * @param[in]  kilos   実キロと擬制キロの組の配列.
+     * @param[out] result  各組の運賃. 該当がなければ無効値.
+     */
+    void get_fare_country_table(const char * table,
+                                company_id_t company,
+                                const std::vector<std::pair<int, int> > & kilos,
+                                std::vector<boost::optional<int> > & result)
+      const;
+
+    /**
+     * 加算運賃や社線運賃の表を引く.
+     * 始点と終点が一致する行があればその運賃,
+     * なければ区間に含まれる最も長い範囲の運賃を返す.
+     * 長さが同じなら最小キロの小さい方を選ぶ.
+     * 一致する行は二分探索で引く. 含まれる範囲は, 最小キロが区間内にある行を
+     * 最小キロの順に調べ, 残りの行が今の最長より長くなりえなければ止める.
+     * 最悪はその路線の行の数に比例する(今の表では1路線に高々数行).
+     */
+    boost::optional<
+      std::pair<bool,int> > get_special_fare(line_id_t line,
+                                             station_id_t begin,
+                                             station_id_t end) const;
+  };
+}
@@ -0,0 +1,174 @@
+/* -*-coding: utf-8-*- */
+#include <algorithm>
+#include <iomanip>
+
+#include "util.hpp"
+#include "sqlite3_wrapper.h"
+#include "cqueryprofiler.h"
+
+namespace ares
+{
+  namespace
+  {
+    //! 経過時間の階級.
+    size_t bucket_of(std::chrono::nanoseconds elapsed)
+    {
+      const std::chrono::microseconds::rep us =
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+      size_t i = 0;
+      for(std::chrono::microseconds::rep upper = 1;
+          i + 1 < CQueryProfiler::NBUCKET && us >= upper; upper *= 2)
+      { ++i; }
+      return i;
+    }
+
+    //! JSONの文字列として出力する.
+    void write_json_string(std::ostream & ost, const std::string & str)
+    {
+      ost << '"';
+      for(const char c : str)
+      {
+        if(c == '"' || c == '\\') { ost << '\\'; }
+        ost << c;
+      }
+      ost << '"';
+    }
+  }
+
+  CQueryProfiler::Scope::Scope(CQueryProfiler & profiler, const char * name)
+    : profiler(profiler), name(name), active(profiler.is_enabled()), rows(0)
+  {
+    if(!active) { return; }
+    rows = sqlite3_wrapper::rows_stepped();
+    start = std::chrono::steady_clock::now();
+  }
+
+  CQueryProfiler::Scope::~Scope()
+  {
+    if(!active) { return; }
+    profiler.record(name, sqlite3_wrapper::rows_stepped() - rows,
+                    std::chrono::steady_clock::now() - start);
+  }
+
+  bool CQueryProfiler::is_compiled()
+  {
+#ifdef ARES_PROFILE
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void CQueryProfiler::record(const char * name, unsigned long rows,
+                              std::chrono::nanoseconds elapsed)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto itr = stats.find(name);
+    if(itr == stats.end())
+    {
+      itr = stats.insert(std::make_pair(name, stat_t())).first;
+    }
+    stat_t & stat = itr->second;
+    ++stat.calls;
+    stat.rows += rows;
+    stat.total_ns += elapsed.count();
+    stat.max_ns = std::max(stat.max_ns, elapsed.count());
+    ++stat.histogram[bucket_of(elapsed)];
+  }
+
+  void CQueryProfiler::clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.clear();
+  }
+
+  std::vector<std::pair<std::string, CQueryProfiler::stat_t> >
+  CQueryProfiler::get_stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<std::string, stat_t> > result;
+    for(const auto & stat : stats)
+    {
+      result.push_back(std::make_pair(std::string(stat.first), stat.second));
+    }
+    return result;
+  }
+
+  CQueryProfiler::stat_t CQueryProfiler::get_stat(const char * name) const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto itr = stats.find(name);
+    return itr != stats.end() ? itr->second : stat_t();
+  }
+
+  unsigned long CQueryProfiler::bucket_upper_us(size_t i)
+  {
+    return i + 1 < NBUCKET ? 1ul << i : 0;
+  }
+
+  void CQueryProfiler::dump_text(std::ostream & ost) const
+  {
+    const std::vector<std::pair<std::string, stat_t> > stats = $.get_stats();
+    size_t width = 6;
+    for(const auto & stat : stats)
+    {
+      width = std::max(width, stat.first.size());
+    }
+    const std::ios::fmtflags flags = ost.flags();
+    ost << std::left << std::setw(width) << "method" << std::right
+        << std::setw(10) << "calls" << std::setw(10) << "rows"
+        << std::setw(14) << "total_us" << std::setw(12) << "mean_us"
+        << std::setw(12) << "max_us" << std::endl;
+    ost << std::fixed << std::setprecision(1);
+    for(const auto & stat : stats)
+    {
+      const stat_t & s = stat.second;
+      ost << std::left << std::setw(width) << stat.first << std::right
+          << std::setw(10) << s.calls << std::setw(10) << s.rows
+          << std::setw(14) << s.total_ns / 1000.0
+          << std::setw(12) << s.total_ns / 1000.0 / s.calls
+          << std::setw(12) << s.max_ns / 1000.0 << std::endl;
+      ost << "  us:";
+      for(size_t i=0; i<NBUCKET; ++i)
+      {
+        if(s.histogram[i] == 0) { continue; }
+        if(i + 1 < NBUCKET) { ost << " <" << bucket_upper_us(i); }
+        else { ost << " >=" << bucket_upper_us(i - 1); }
+        ost << ":" << s.histogram[i];
+      }
+      ost << std::endl;
+    }
+    ost.flags(flags);
+  }
+
+  void CQueryProfiler::dump_json(std::ostream & ost) const
+  {
+    const std::vector<std::pair<std::string, stat_t> > stats = $.get_stats();
+    ost << "{\"buckets_us\":[";
+    for(size_t i=0; i<NBUCKET; ++i)
+    {
+      if(i > 0) { ost << ","; }
+      if(i + 1 < NBUCKET) { ost << bucket_upper_us(i); }
+      else { ost << "null"; }
+    }
+    ost << "],\"methods\":{";
+    for(size_t i=0; i<stats.size(); ++i)
+    {
+      const stat_t & s = stats[i].second;
+      if(i > 0) { ost << ","; }
+      write_json_string(ost, stats[i].first);
+      ost << ":{\"calls\":" << s.calls
+          << ",\"rows\":" << s.rows
+          << ",\"total_ns\":" << s.total_ns
+          << ",\"max_ns\":" << s.max_ns
+          << ",\"histogram\":[";
+      for(size_t j=0; j<NBUCKET; ++j)
+      {
+        if(j > 0) { ost << ","; }
+        ost << s.histogram[j];
+      }
+      ost << "]}";
+    }
+    ost << "}}";
+  }
+}
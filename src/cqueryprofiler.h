@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/utility.hpp>
+
+/**
+ * @~japanese
+ * 関数の呼び出しを計測する.
+ * ARES_PROFILEを定義してコンパイルした時だけ計測のコードが入り,
+ * さらにCQueryProfiler::set_enabled()で有効にした時だけ記録する.
+ * 関数名は__func__なので, 多重定義は1つにまとめて記録する.
+ */
+#ifdef ARES_PROFILE
+#define ARES_PROFILE_SCOPE(profiler)                                    \
+  ::ares::CQueryProfiler::Scope ares_profile_scope_((profiler), __func__)
+#else
+#define ARES_PROFILE_SCOPE(profiler) ((void)0)
+#endif
+
+namespace ares
+{
+  /**
+   * @~english
+   * Per-method call counts, rows stepped and latency histograms.
+   */
+  /**
+   * @~japanese
+   * 関数ごとの呼び出し回数, SQLiteで読んだ行数, 経過時間のヒストグラム.
+   * 経過時間は入れ子の呼び出しを含む.
+   * スナップショットで答えた呼び出しは行数が0になる.
+   * 複数のスレッドから記録してよい.
+   */
+  class CQueryProfiler : boost::noncopyable
+  {
+  public:
+    /**
+     * ヒストグラムの階級の数.
+     * 階級0は1マイクロ秒未満, 階級i(1 <= i < NBUCKET-1)は
+     * [2^(i-1), 2^i)マイクロ秒, 最後の階級はそれ以上.
+     */
+    static const size_t NBUCKET = 24;
+
+    //! 1つの関数の記録.
+    struct stat_t
+    {
+      unsigned long calls, rows;
+      std::chrono::nanoseconds::rep total_ns, max_ns;
+      unsigned long histogram[NBUCKET];
+    };
+
+    //! 計測する範囲. 構築から破棄までを1回の呼び出しとして記録する.
+    class Scope : boost::noncopyable
+    {
+    private:
+      CQueryProfiler & profiler;
+      const char * const name;
+      const bool active;
+      unsigned long rows;
+      std::chrono::steady_clock::time_point start;
+
+    public:
+      Scope(CQueryProfiler & profiler, const char * name);
+      ~Scope();
+    };
+
+  private:
+    struct NameLess
+    {
+      bool operator()(const char * a, const char * b) const
+      {
+        return std::strcmp(a, b) < 0;
+      }
+    };
+
+    std::atomic<bool> enabled;
+    mutable std::mutex mutex;
+    //! 関数名から記録へ. 関数名は__func__などの静的な文字列.
+    std::map<const char *, stat_t, NameLess> stats;
+
+  public:
+    CQueryProfiler() : enabled(false) {}
+
+    //! ARES_PROFILEを定義してライブラリをコンパイルしたならtrue.
+    static bool is_compiled();
+
+    //! 記録するかどうかを切り替える.
+    void set_enabled(bool enable) { enabled = enable; }
+
+    bool is_enabled() const { return enabled; }
+
+    /**
+     * 1回の呼び出しを記録する.
+     * @param[in] name    関数名. 記録を消すまで有効な文字列であること.
+     * @param[in] rows    読んだ行数.
+     * @param[in] elapsed 経過時間.
+     */
+    void record(const char * name, unsigned long rows,
+                std::chrono::nanoseconds elapsed);
+
+    //! 記録を消す.
+    void clear();
+
+    //! 関数名の順に並べた記録.
+    std::vector<std::pair<std::string, stat_t> > get_stats() const;
+
+    //! 関数の記録. なければすべて0.
+    stat_t get_stat(const char * name) const;
+
+    //! 階級iの上限のマイクロ秒. 最後の階級は上限がないので0.
+    static unsigned long bucket_upper_us(size_t i);
+
+    //! 表形式で出力する.
+    void dump_text(std::ostream & ost) const;
+
+    /**
+     * JSONで出力する.
+     * {"buckets_us": [各階級の上限], "methods": {関数名: {"calls",
+     * "rows", "total_ns", "max_ns", "histogram": [各階級の回数]}}}
+     */
+    void dump_json(std::ostream & ost) const;
+  };
+}
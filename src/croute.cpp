@@ -69,16 +69,16 @@ namespace ares
     {
       if(i==0)
       {
-        ost << route.db->get_station_name(route.way[i].begin);
+        ost << route.db->get_station_name_view(route.way[i].begin);
       }
       else
       {
-        ost << "[" << route.db->get_station_name(route.way[i].begin) << "]";
+        ost << "[" << route.db->get_station_name_view(route.way[i].begin) << "]";
       }
       ost << ",";
-      ost << route.db->get_line_name(route.way[i].line) << ",";
+      ost << route.db->get_line_name_view(route.way[i].line) << ",";
     }
-    ost << route.db->get_station_name(route.way.back().end);
+    ost << route.db->get_station_name_view(route.way.back().end);
     return ost;
   }
 
@@ -239,19 +239,23 @@ namespace ares
    */
   int CRoute::calc_fare_inplace()
   {
-    using namespace std::placeholders;
     // Error checking, returning -1 is not good, boost::optional is better.
     if(!$.is_valid()) { return -1; }
     // Canonicalize route.
     $.canonicalize();
     // Rewrite Route: shinkansen / route-variant
     // Get Kilo: Additional fare should included in CKilo
-    CFare fare = $.accum();
+    return calc_fare(*$.db, $.accum());
+  }
+
+  int CRoute::calc_fare(const CDatabase & db, CFare fare)
+  {
+    using namespace std::placeholders;
     const CKilo & kilo = fare.kilo;
     if(!kilo.is_zero(COMPANY_KTR))
     {
-      fare.other += $.db->get_fare_table("Z", COMPANY_KTR,
-                                         kilo.get(COMPANY_KTR, true));
+      fare.other += db.get_fare_table("Z", COMPANY_KTR,
+                                      kilo.get(COMPANY_KTR, true));
     }
     // 0キロ
     if(kilo.is_all_JR_zero()) { return fare; }
@@ -266,68 +270,68 @@ namespace ares
       // only 幹線
       if(hecto_local == 0)
       {
-        fare.JR += $.db->get_fare_table("C1", *only, hecto_main);
+        fare.JR += db.get_fare_table("C1", *only, hecto_main);
         return fare;
       }
       // only 地方交通線
       else if(hecto_main == 0)
       {
         boost::optional<int> special_fare =
-          $.db->get_fare_country_table("C2", *only, hecto_local, hecto_lfake);
+          db.get_fare_country_table("C2", *only, hecto_local, hecto_lfake);
         if(special_fare)
         {
           fare.JR += *special_fare;
           return fare;
         }
-        fare.JR += $.db->get_fare_table("C1", *only, hecto_lfake);
+        fare.JR += db.get_fare_table("C1", *only, hecto_lfake);
         return fare;
       }
       else
       {
         boost::optional<int> special_fare =
-          $.db->get_fare_country_table("C3", *only,
-                                       hecto_main + hecto_local,
-                                       hecto_main + hecto_lfake);
+          db.get_fare_country_table("C3", *only,
+                                    hecto_main + hecto_local,
+                                    hecto_main + hecto_lfake);
         if(special_fare)
         {
           fare.JR += *special_fare;
           return fare;
         }
-        fare.JR += $.db->get_fare_table("C1", *only, hecto_main + hecto_lfake);
+        fare.JR += db.get_fare_table("C1", *only, hecto_main + hecto_lfake);
         return fare;
       }
     }
     // JR北海道
     else if(only && (*only == JR_COMPANY_HOKKAIDO))
     {
-      fare.JR += calc_fare_as_honshu(*db, kilo,
+      fare.JR += calc_fare_as_honshu(db, kilo,
                                      JR_COMPANY_HOKKAIDO,
                                      std::bind(&CDatabase::get_fare_table,
-                                               $.db, "C1", COMPANY_HOKKAIDO, _1),
+                                               &db, "C1", COMPANY_HOKKAIDO, _1),
                                      std::bind(&CDatabase::get_fare_table,
-                                               $.db, "B1", COMPANY_HOKKAIDO, _1));
+                                               &db, "B1", COMPANY_HOKKAIDO, _1));
       return fare;
     }
     // 本州含み
     else
     {
       const int base_fare =
-        calc_fare_as_honshu(*db, kilo,
+        calc_fare_as_honshu(db, kilo,
                             boost::none,
                             std::bind(CRoute::calc_honshu_main, _1),
                             std::bind(&CDatabase::get_fare_table,
-                                      $.db, "B1", COMPANY_HONSHU, _1));
+                                      &db, "B1", COMPANY_HONSHU, _1));
       int add_fare = 0;
       for(size_t i=JR_COMPANY_HOKKAIDO; i < MAX_JR_COMPANY_TYPE; ++i)
       {
         if(!kilo.is_zero(i))
           add_fare +=
-            calc_fare_as_honshu(*db, kilo,
+            calc_fare_as_honshu(db, kilo,
                                 JR_COMPANY_TYPE(i),
                                 std::bind(&CDatabase::get_fare_table,
-                                          $.db, "A2", i, _1),
+                                          &db, "A2", i, _1),
                                 std::bind(&CDatabase::get_fare_table,
-                                          $.db, "B2", i, _1));
+                                          &db, "B2", i, _1));
       }
       fare.JR += base_fare + add_fare;
       return fare;
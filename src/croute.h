@@ -156,6 +156,14 @@ namespace ares
      */
     int calc_fare_inplace();
 
+    /**
+     * 集計した営業キロから運賃を計算する.
+     * @param[in] db   運賃表を引くデータベース.
+     * @param[in] fare accum()の結果.
+     * @return         運賃.
+     */
+    static int calc_fare(const CDatabase & db, CFare fare);
+
     /**
      * Function to calc fare of Honshu main line from kilo.
      */
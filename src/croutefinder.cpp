@@ -0,0 +1,1083 @@
+/* -*-coding: utf-8-*- */
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "util.hpp"
+#include "sqlite3_wrapper.h"
+#include "cdatabase.h"
+#include "cstation.h"
+#include "clandmarks.h"
+#include "ccontractionhierarchy.h"
+#include "croutefinder.h"
+
+namespace ares
+{
+  namespace
+  {
+    //! 経路の費用. 営業キロ, 乗り換えの回数の順に比べる.
+    typedef std::pair<int, int> cost_t;
+    typedef std::pair<cost_t, unsigned> queue_item_t;
+
+    const unsigned NO_NODE = std::numeric_limits<unsigned>::max();
+    //! 行けない頂点までの営業キロ.
+    const int UNREACHABLE = std::numeric_limits<int>::max();
+
+    //! 運賃が最安の経路を探す時の, 頂点に着くまでの部分経路.
+    struct label_t
+    {
+      unsigned node;
+      //! 1つ前のラベルの添字.
+      unsigned parent;
+      CKilo kilo;
+      //! 特定運賃のある路線を除いたキロ. 運賃の下界に使う.
+      CKilo bound;
+      //! 営業キロ(10倍)の合計.
+      int hecto;
+      //! 着駅までの運賃の下界.
+      int fare;
+      //! 他のラベルに支配された.
+      bool dead;
+    };
+    typedef std::pair<int, unsigned> label_item_t;
+
+    //! JRの幹線の営業キロと地方交通線の擬制キロの和(10倍).
+    int converted_hecto(const CKilo & kilo)
+    {
+      int hecto = 0;
+      for(size_t i=0; i<MAX_JR_COMPANY_TYPE; ++i)
+      {
+        hecto += kilo.get_rawhecto(i, true)
+          + kilo.get_rawhecto(i, false, false);
+      }
+      return hecto;
+    }
+
+    /**
+     * 本州を含み, JRの幹線と地方交通線の両方を通る.
+     * この後キロが増えてもそのままで,
+     * 本州の運賃はconverted_hecto()だけで決まる.
+     */
+    bool is_mixed_honshu(const CKilo & kilo)
+    {
+      int main = 0, local = 0;
+      for(size_t i=0; i<MAX_JR_COMPANY_TYPE; ++i)
+      {
+        main += kilo.get_rawhecto(i, true);
+        local += kilo.get_rawhecto(i, false);
+      }
+      return !kilo.is_zero(COMPANY_HONSHU) && main > 0 && local > 0
+        && CHecto(main) + CHecto(local) > 10;
+    }
+
+    /**
+     * aのキロがどの会社・線区の種別でもb以下で, 電車特定区間の状態が同じ.
+     * 両方ともis_mixed_honshu()なら, 本州の会社ごとのキロの代わりに
+     * converted_hecto()を比べる.
+     * 営業キロの合計を先に比べて, ほとんどの組をすぐに除く.
+     */
+    bool dominates(const CKilo & a, int a_hecto, const CKilo & b, int b_hecto)
+    {
+      if(a_hecto > b_hecto
+         || a.get_denshaid() != b.get_denshaid()
+         || a.get_circleid() != b.get_circleid())
+      {
+        return false;
+      }
+      const bool mixed = is_mixed_honshu(a) && is_mixed_honshu(b);
+      if(mixed && converted_hecto(a) > converted_hecto(b)) { return false; }
+      for(size_t i=0; i<MAX_COMPANY_TYPE; ++i)
+      {
+        if(mixed && i == COMPANY_HONSHU) { continue; }
+        if(a.get_rawhecto(i, true) > b.get_rawhecto(i, true)
+           || a.get_rawhecto(i, false) > b.get_rawhecto(i, false)
+           || a.get_rawhecto(i, false, false) > b.get_rawhecto(i, false, false))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+
+  CRouteFinder::CRouteFinder(std::shared_ptr<CDatabase> db)
+    : db(db)
+  {
+    std::vector<std::pair<line_id_t, std::string> > lines;
+    db->get_all_lines_name(lines);
+    std::sort(lines.begin(), lines.end());
+    for(const auto & line : lines)
+    {
+      std::vector<CStation> stations;
+      db->get_stations_of_line(line.first, stations);
+      for(const CStation & station : stations)
+      {
+        const node_t node = {station.id, line.first,
+                             station.realkilo.get_hecto()};
+        station_nodes.push_back(std::make_pair(station.id, nodes.size()));
+        nodes.push_back(node);
+      }
+    }
+    std::sort(station_nodes.begin(), station_nodes.end());
+  }
+
+  std::pair<CRouteFinder::StationNodes::const_iterator,
+            CRouteFinder::StationNodes::const_iterator>
+  CRouteFinder::nodes_of(station_id_t station) const
+  {
+    typedef StationNodes::value_type value_type;
+    return std::equal_range(station_nodes.begin(), station_nodes.end(),
+                            station,
+                            liquid::KeyLess<value_type, station_id_t,
+                            &value_type::first>());
+  }
+
+  unsigned CRouteFinder::node_on_line(station_id_t station,
+                                      line_id_t line) const
+  {
+    const auto range = nodes_of(station);
+    for(auto itr=range.first; itr != range.second; ++itr)
+    {
+      if(nodes[itr->second].line == line) { return itr->second; }
+    }
+    return NO_NODE;
+  }
+
+  template<class Function>
+  void CRouteFinder::for_each_neighbor(unsigned i, Function f) const
+  {
+    const node_t & node = nodes[i];
+    // 同じ路線の隣の駅へ.
+    for(const unsigned j : {i - 1, i + 1})
+    {
+      if(j >= nodes.size() || nodes[j].line != node.line) { continue; }
+      f(j, false);
+    }
+    // 同じ駅で他の路線へ.
+    const auto range = nodes_of(node.station);
+    for(auto itr=range.first; itr != range.second; ++itr)
+    {
+      if(itr->second != i) { f(itr->second, true); }
+    }
+  }
+
+  std::vector<unsigned> CRouteFinder::search(station_id_t begin,
+                                             station_id_t end,
+                                             size_t & reached) const
+  {
+    const cost_t infinity(std::numeric_limits<int>::max(), 0);
+    std::vector<cost_t> cost(nodes.size(), infinity);
+    std::vector<unsigned> prev(nodes.size(), NO_NODE);
+    std::priority_queue<queue_item_t, std::vector<queue_item_t>,
+                        std::greater<queue_item_t> > queue;
+    // 目印があれば, 着駅までの営業キロの下界を足して調べる順を決める.
+    const auto last = nodes_of(end);
+    const unsigned target = landmarks && last.first != last.second
+      ? last.first->second : NO_NODE;
+    const auto estimate = [&](unsigned i, cost_t c)
+      {
+        if(target != NO_NODE) { c.first += landmarks->lower_bound(i, target); }
+        return c;
+      };
+    const auto relax = [&](unsigned from, unsigned to, cost_t c)
+      {
+        if(!(c < cost[to])) { return; }
+        cost[to] = c;
+        prev[to] = from;
+        queue.push(queue_item_t(estimate(to, c), to));
+      };
+    const auto first = nodes_of(begin);
+    for(auto itr=first.first; itr != first.second; ++itr)
+    {
+      relax(NO_NODE, itr->second, cost_t(0, 0));
+    }
+    unsigned goal = NO_NODE;
+    while(!queue.empty())
+    {
+      const unsigned i = queue.top().second;
+      const bool stale = estimate(i, cost[i]) < queue.top().first;
+      queue.pop();
+      if(stale) { continue; }
+      const node_t & node = nodes[i];
+      if(node.station == end) { goal = i; break; }
+      const cost_t c = cost[i];
+      $.for_each_neighbor(i, [&](unsigned j, bool transfer)
+        {
+          if(transfer)
+          {
+            relax(i, j, cost_t(c.first, c.second + 1));
+          }
+          else
+          {
+            relax(i, j, cost_t(c.first + std::abs(nodes[j].kilo - node.kilo),
+                               c.second));
+          }
+        });
+    }
+    std::vector<unsigned> path;
+    if(goal == NO_NODE)
+    {
+      station_vector stations;
+      for(size_t i=0; i<nodes.size(); ++i)
+      {
+        if(cost[i] != infinity) { stations.push_back(nodes[i].station); }
+      }
+      std::sort(stations.begin(), stations.end());
+      reached = std::unique(stations.begin(), stations.end())
+        - stations.begin();
+      return path;
+    }
+    for(unsigned i=goal; i != NO_NODE; i = prev[i]) { path.push_back(i); }
+    std::reverse(path.begin(), path.end());
+    return path;
+  }
+
+  const std::vector<CRouteFinder::edge_t> & CRouteFinder::get_edges() const
+  {
+    std::call_once(edges_once, [this]()
+      {
+        edges.resize(nodes.size());
+        bool special = false;
+        for(size_t i=0; i+1<nodes.size(); ++i)
+        {
+          // 路線全体の区間が特定運賃の区間を含めば, 特定運賃のある路線.
+          if(i == 0 || nodes[i-1].line != nodes[i].line)
+          {
+            size_t last = i;
+            while(last + 1 < nodes.size()
+                  && nodes[last+1].line == nodes[i].line)
+            {
+              ++last;
+            }
+            special = last > i
+              && db->get_special_fare(nodes[i].line, nodes[i].station,
+                                      nodes[last].station);
+          }
+          if(nodes[i].line != nodes[i+1].line) { continue; }
+          edge_t & edge = edges[i];
+          db->get_company_and_kilo(nodes[i].line,
+                                   nodes[i].station, nodes[i+1].station,
+                                   edge.kilos, edge.is_main,
+                                   edge.denshaid, edge.circleid);
+          edge.special = special;
+        }
+      });
+    return edges;
+  }
+
+  std::vector<int> CRouteFinder::distances(station_id_t from,
+                                           bool jr_only,
+                                           size_t company) const
+  {
+    const std::vector<edge_t> * edges = jr_only ? &$.get_edges() : nullptr;
+    std::vector<int> dist(nodes.size(), UNREACHABLE);
+    typedef std::pair<int, unsigned> item_t;
+    std::priority_queue<item_t, std::vector<item_t>,
+                        std::greater<item_t> > queue;
+    const auto relax = [&](unsigned to, int d)
+      {
+        if(d >= dist[to]) { return; }
+        dist[to] = d;
+        queue.push(item_t(d, to));
+      };
+    const auto first = nodes_of(from);
+    for(auto itr=first.first; itr != first.second; ++itr)
+    {
+      relax(itr->second, 0);
+    }
+    while(!queue.empty())
+    {
+      const item_t item = queue.top();
+      queue.pop();
+      const unsigned i = item.second;
+      if(dist[i] < item.first) { continue; }
+      $.for_each_neighbor(i, [&](unsigned j, bool transfer)
+        {
+          int d = item.first;
+          if(!transfer && !edges)
+          {
+            d += std::abs(nodes[j].kilo - nodes[i].kilo);
+          }
+          else if(!transfer && !(*edges)[std::min(i, j)].special)
+          {
+            for(const CKiloValue & value : (*edges)[std::min(i, j)].kilos)
+            {
+              if(value.company < MAX_JR_COMPANY_TYPE
+                 && (company == MAX_JR_COMPANY_TYPE
+                     || value.company == static_cast<int>(company)))
+              {
+                d += value.end - value.begin;
+              }
+            }
+          }
+          relax(j, d);
+        });
+    }
+    return dist;
+  }
+
+  std::vector<unsigned>
+  CRouteFinder::search_spur(unsigned spur, station_id_t end,
+                            const std::vector<bool> & banned,
+                            const std::vector<unsigned> & banned_next,
+                            bool transfer,
+                            const std::vector<int> & rest,
+                            const parallel_t & parallel) const
+  {
+    const cost_t infinity(std::numeric_limits<int>::max(), 0);
+    std::vector<cost_t> cost(nodes.size(), infinity);
+    std::vector<unsigned> prev(nodes.size(), NO_NODE);
+    std::priority_queue<queue_item_t, std::vector<queue_item_t>,
+                        std::greater<queue_item_t> > queue;
+    const auto relax = [&](unsigned from, unsigned to, cost_t c)
+      {
+        if(rest[to] == UNREACHABLE || !(c < cost[to])) { return; }
+        cost[to] = c;
+        prev[to] = from;
+        queue.push(queue_item_t(cost_t(c.first + rest[to], c.second), to));
+      };
+    relax(NO_NODE, spur, cost_t(0, 0));
+    unsigned goal = NO_NODE;
+    while(!queue.empty())
+    {
+      const unsigned i = queue.top().second;
+      const cost_t c = queue.top().first;
+      queue.pop();
+      if(cost_t(cost[i].first + rest[i], cost[i].second) < c) { continue; }
+      if(nodes[i].station == end) { goal = i; break; }
+      $.for_each_neighbor(i, [&](unsigned j, bool is_transfer)
+        {
+          if(!is_transfer && parallel.covered[std::min(i, j)]
+             && parallel.twin[i] != NO_NODE)
+          {
+            return;
+          }
+          if(i == spur)
+          {
+            if(std::find(banned_next.begin(), banned_next.end(), j)
+               != banned_next.end())
+            {
+              return;
+            }
+            // spurの駅の他の頂点へは, spurからの乗り換えでだけ行ける.
+            if(is_transfer)
+            {
+              if(transfer) { relax(i, j, cost_t(0, cost[i].second + 1)); }
+              return;
+            }
+          }
+          if(banned[j] || nodes[j].station == nodes[spur].station) { return; }
+          relax(i, j, is_transfer
+                ? cost_t(cost[i].first, cost[i].second + 1)
+                : cost_t(cost[i].first + std::abs(nodes[j].kilo
+                                                  - nodes[i].kilo),
+                         cost[i].second));
+        });
+    }
+    std::vector<unsigned> path;
+    if(goal == NO_NODE) { return path; }
+    for(unsigned i=goal; i != NO_NODE; i = prev[i]) { path.push_back(i); }
+    std::reverse(path.begin(), path.end());
+    return path;
+  }
+
+  int CRouteFinder::length_of(const std::vector<unsigned> & path) const
+  {
+    int hecto = 0;
+    for(size_t i=1; i<path.size(); ++i)
+    {
+      const node_t & prev = nodes[path[i-1]], & curr = nodes[path[i]];
+      if(prev.line == curr.line) { hecto += std::abs(curr.kilo - prev.kilo); }
+    }
+    return hecto;
+  }
+
+  void CRouteFinder::append_path(const std::vector<unsigned> & path,
+                                 CRoute & route) const
+  {
+    for(size_t i=1; i<path.size(); ++i)
+    {
+      const node_t & prev = nodes[path[i-1]], & curr = nodes[path[i]];
+      // 乗り換え.
+      if(prev.line != curr.line) { continue; }
+      // 路線の最後の駅で区間を閉じる.
+      if(i + 1 == path.size() || nodes[path[i+1]].line != curr.line)
+      {
+        route.append_route(curr.line, curr.station);
+      }
+    }
+  }
+
+  CRouteFinder::parallel_t
+  CRouteFinder::find_parallel(station_id_t begin, station_id_t end) const
+  {
+    parallel_t parallel;
+    parallel.twin.assign(nodes.size(), NO_NODE);
+    parallel.covered.assign(nodes.size(), false);
+    for(unsigned p=0; p<nodes.size();)
+    {
+      unsigned last = p;
+      line_id_t line = INVALID_LINE_ID;
+      const auto here = nodes_of(nodes[p].station);
+      for(auto itr=here.first; itr != here.second; ++itr)
+      {
+        const unsigned lp = itr->second;
+        if(nodes[lp].line == nodes[p].line) { continue; }
+        // 並行する路線で駅の間の営業キロが同じ限り進む.
+        unsigned q_last = p, l_last = lp;
+        for(unsigned q=p+1;
+            q < nodes.size() && nodes[q].line == nodes[p].line; ++q)
+        {
+          const unsigned lq = $.node_on_line(nodes[q].station, nodes[lp].line);
+          if(lq != NO_NODE
+             && std::abs(nodes[lq].kilo - nodes[lp].kilo)
+                == nodes[q].kilo - nodes[p].kilo
+             && (q_last == p || (lq > l_last) == (l_last > lp)))
+          {
+            q_last = q;
+            l_last = lq;
+          }
+          else if(lq != NO_NODE || nodes[q].station == begin
+                  || nodes[q].station == end)
+          {
+            break;
+          }
+        }
+        const unsigned span = std::max(lp, l_last) - std::min(lp, l_last);
+        if(q_last > last && span > q_last - p)
+        {
+          last = q_last;
+          line = nodes[lp].line;
+        }
+      }
+      if(last == p) { ++p; continue; }
+      for(unsigned n=p; n<=last; ++n)
+      {
+        parallel.twin[n] = $.node_on_line(nodes[n].station, line);
+        if(n < last) { parallel.covered[n] = true; }
+      }
+      p = last;
+    }
+    return parallel;
+  }
+
+  std::vector<unsigned>
+  CRouteFinder::to_parallel(const std::vector<unsigned> & path,
+                            const parallel_t & parallel) const
+  {
+    std::vector<unsigned> result;
+    // 同じ駅での乗り換えが続けば, 最初と最後の頂点だけを残す.
+    const auto append = [&](unsigned n)
+      {
+        if(!result.empty() && result.back() == n) { return; }
+        const size_t size = result.size();
+        if(size >= 2 && nodes[result[size-2]].station == nodes[n].station
+           && nodes[result[size-1]].station == nodes[n].station)
+        {
+          result.pop_back();
+          if(result.back() == n) { return; }
+        }
+        result.push_back(n);
+      };
+    // 置き換えている区間で, 最後に通った並行する路線にもある頂点.
+    unsigned from = NO_NODE;
+    for(size_t n=0; n<path.size(); ++n)
+    {
+      const unsigned v = path[n];
+      const bool ride = n > 0 && nodes[path[n-1]].line == nodes[v].line;
+      // 並行する路線にない駅から乗った区間は置き換えられない.
+      if(ride && parallel.covered[std::min(path[n-1], v)]
+         && (from != NO_NODE || parallel.twin[path[n-1]] != NO_NODE))
+      {
+        if(from == NO_NODE) { from = path[n-1]; }
+        // 並行する路線にない駅は飛ばす.
+        if(parallel.twin[v] == NO_NODE) { continue; }
+        const unsigned a = parallel.twin[from], b = parallel.twin[v];
+        for(unsigned m=a; ; m = a < b ? m + 1 : m - 1)
+        {
+          append(m);
+          if(m == b) { break; }
+        }
+        from = v;
+        continue;
+      }
+      // 並行する路線から元の路線に戻る.
+      if(ride && from != NO_NODE) { append(path[n-1]); }
+      from = NO_NODE;
+      append(v);
+    }
+    return result;
+  }
+
+  station_vector
+  CRouteFinder::stations_of(const std::vector<unsigned> & path) const
+  {
+    station_vector stations;
+    for(const unsigned n : path)
+    {
+      // 乗り換えでは同じ駅が続く.
+      if(stations.empty() || stations.back() != nodes[n].station)
+      {
+        stations.push_back(nodes[n].station);
+      }
+    }
+    return stations;
+  }
+
+  station_vector CRouteFinder::passed_stations(const CRoute & route) const
+  {
+    std::vector<unsigned> path;
+    for(const CSegment & segment : route)
+    {
+      if(segment.is_begin())
+      {
+        return station_vector{segment.begin};
+      }
+      const unsigned first = $.node_on_line(segment.begin, segment.line);
+      const unsigned last = $.node_on_line(segment.end, segment.line);
+      if(first == NO_NODE || last == NO_NODE)
+      {
+        throw std::invalid_argument("segment is not in the graph");
+      }
+      for(unsigned n=first; ; n = first < last ? n + 1 : n - 1)
+      {
+        path.push_back(n);
+        if(n == last) { break; }
+      }
+    }
+    const parallel_t parallel = $.find_parallel(nodes[path.front()].station,
+                                                nodes[path.back()].station);
+    return $.stations_of($.to_parallel(path, parallel));
+  }
+
+  CRoute CRouteFinder::find(station_id_t begin, station_id_t end) const
+  {
+    return $.find(station_vector{begin, end});
+  }
+
+  CRoute CRouteFinder::find(const station_vector & stops) const
+  {
+    if(stops.size() < 2)
+    {
+      throw std::invalid_argument("route needs two or more stations");
+    }
+    CRoute route(db, stops.front());
+    for(size_t i=1; i<stops.size(); ++i)
+    {
+      if(stops[i-1] == stops[i]) { continue; }
+      size_t reached = 0;
+      const std::vector<unsigned> path = $.search(stops[i-1], stops[i],
+                                                  reached);
+      if(path.empty())
+      {
+        throw RouteNotFound(stops[i-1], stops[i], reached, route);
+      }
+      $.append_path(path, route);
+    }
+    return route;
+  }
+
+  CRoute CRouteFinder::find_cheapest(station_id_t begin, station_id_t end,
+                                     size_t max_labels) const
+  {
+    // 最短の経路の運賃を最初の上界にする.
+    CRoute best = $.find(begin, end);
+    if(begin == end) { return best; }
+    int best_fare;
+    try { best_fare = best.calc_fare_inplace(); }
+    catch(const std::invalid_argument &) { best_fare = -1; }
+    // 運賃を計算できなければ上界にならない.
+    if(best_fare < 0) { best_fare = std::numeric_limits<int>::max(); }
+    const std::vector<edge_t> & edges = $.get_edges();
+    // 着駅までの残りのJRの営業キロ. 探索の順序と運賃の下界に使う.
+    const std::vector<int> rest = $.distances(end, true);
+    // 着駅までに通らなければならないJR北海道・四国・九州の営業キロ.
+    const JR_COMPANY_TYPE islands[] = {JR_COMPANY_HOKKAIDO,
+                                       JR_COMPANY_KYUSHU,
+                                       JR_COMPANY_SHIKOKU};
+    std::vector<std::vector<int> > island_rest;
+    for(const JR_COMPANY_TYPE company : islands)
+    {
+      island_rest.push_back($.distances(end, true, company));
+    }
+    // 運賃の下界. 運賃表にないキロなら例外を投げる.
+    const auto lower_bound = [&](const CKilo & bound, unsigned node)
+      {
+        CFare lower;
+        lower.kilo = bound;
+        const int fare = CRoute::calc_fare(*db, lower);
+        if(bound.is_all_JR_zero()
+           || bound.get_densha_and_circleid() != DENSHA_SPECIAL_NONE
+           || rest[node] == 0)
+        {
+          return fare;
+        }
+        // 残りは, 通らなければならない三島会社のキロの他を本州の幹線とする.
+        int honshu = rest[node];
+        for(size_t i=0; i<island_rest.size(); ++i)
+        {
+          const int hecto = island_rest[i][node];
+          lower.kilo.add(islands[i], true, 0, hecto);
+          honshu -= hecto;
+        }
+        if(honshu > 0) { lower.kilo.add(COMPANY_HONSHU, true, 0, honshu); }
+        try { return std::max(fare, CRoute::calc_fare(*db, lower)); }
+        catch(const std::invalid_argument &) { return fare; }
+      };
+    std::vector<label_t> labels;
+    std::vector<std::vector<unsigned> > node_labels(nodes.size());
+    std::priority_queue<label_item_t, std::vector<label_item_t>,
+                        std::greater<label_item_t> > queue;
+    const auto push = [&](unsigned node, unsigned parent,
+                          const CKilo & kilo, const CKilo & bound, int hecto)
+      {
+        if(rest[node] == UNREACHABLE) { return; }
+        std::vector<unsigned> & here = node_labels[node];
+        for(const unsigned l : here)
+        {
+          if(dominates(labels[l].kilo, labels[l].hecto, kilo, hecto))
+          {
+            return;
+          }
+        }
+        int fare;
+        // 運賃表にないキロは, 先へ進んでも運賃を計算できない.
+        try { fare = lower_bound(bound, node); }
+        catch(const std::invalid_argument &) { return; }
+        if(fare >= best_fare) { return; }
+        here.erase(std::remove_if(here.begin(), here.end(),
+                                  [&](unsigned l)
+                                  {
+                                    if(!dominates(kilo, hecto,
+                                                  labels[l].kilo,
+                                                  labels[l].hecto))
+                                    {
+                                      return false;
+                                    }
+                                    labels[l].dead = true;
+                                    return true;
+                                  }),
+                   here.end());
+        const label_t label = {node, parent, kilo, bound, hecto, fare, false};
+        here.push_back(labels.size());
+        queue.push(label_item_t(hecto + rest[node], labels.size()));
+        labels.push_back(label);
+      };
+    const auto first = nodes_of(begin);
+    for(auto itr=first.first; itr != first.second; ++itr)
+    {
+      push(itr->second, NO_NODE, CKilo(), CKilo(), 0);
+    }
+    while(!queue.empty())
+    {
+      if(labels.size() >= max_labels)
+      {
+        throw SearchTruncated(max_labels, best);
+      }
+      const unsigned l = queue.top().second;
+      queue.pop();
+      // pushで要素が増えるので複製する.
+      const label_t label = labels[l];
+      if(label.dead || label.fare >= best_fare) { continue; }
+      if(nodes[label.node].station == end)
+      {
+        std::vector<unsigned> path;
+        for(unsigned i=l; i != NO_NODE; i = labels[i].parent)
+        {
+          path.push_back(labels[i].node);
+        }
+        std::reverse(path.begin(), path.end());
+        CRoute route(db, begin);
+        $.append_path(path, route);
+        int fare;
+        try { fare = route.calc_fare_inplace(); }
+        catch(const std::invalid_argument &) { continue; }
+        if(fare >= 0 && fare < best_fare)
+        {
+          best = route;
+          best_fare = fare;
+        }
+        continue;
+      }
+      $.for_each_neighbor(label.node, [&](unsigned j, bool transfer)
+        {
+          if(transfer)
+          {
+            push(j, l, label.kilo, label.bound, label.hecto);
+            return;
+          }
+          const edge_t & edge = edges[std::min(label.node, j)];
+          CKilo kilo = label.kilo, bound = label.bound;
+          kilo.update_denshaid(edge.denshaid, edge.circleid);
+          bound.update_denshaid(edge.denshaid, edge.circleid);
+          for(const CKiloValue & value : edge.kilos)
+          {
+            kilo.add(value.company, edge.is_main, value.begin, value.end);
+            if(!edge.special)
+            {
+              bound.add(value.company, edge.is_main, value.begin, value.end);
+            }
+          }
+          push(j, l, kilo, bound,
+               label.hecto + std::abs(nodes[j].kilo - nodes[label.node].kilo));
+        });
+    }
+    return best;
+  }
+
+  std::vector<CRouteFinder::alternative_t>
+  CRouteFinder::find_alternatives(station_id_t begin, station_id_t end,
+                                  size_t k, ORDER order) const
+  {
+    std::vector<alternative_t> result;
+    if(k == 0) { return result; }
+    if(begin == end)
+    {
+      const alternative_t empty = {CRoute(db, begin), 0, 0};
+      result.push_back(empty);
+      return result;
+    }
+    size_t reached = 0;
+    const std::vector<unsigned> shortest = $.search(begin, end, reached);
+    if(shortest.empty())
+    {
+      throw RouteNotFound(begin, end, reached, CRoute(db, begin));
+    }
+    // 並行する路線のある区間は並行する路線で表して, 乗り換える駅だけが
+    // 違う経路を探さない.
+    const parallel_t parallel = $.find_parallel(begin, end);
+    std::vector<std::vector<unsigned> > accepted(
+      1, $.to_parallel(shortest, parallel));
+    const std::vector<int> rest = $.distances(end, false);
+    // 営業キロ, 乗り換えの回数, 頂点の列の順に並べた候補.
+    typedef std::pair<cost_t, std::vector<unsigned> > candidate_t;
+    std::set<candidate_t> candidates;
+    // 返した経路の通る駅. 並行する路線を乗り換える駅だけが違う経路は返さない.
+    std::set<station_vector> corridors;
+    const auto accept = [&](const std::vector<unsigned> & path)
+      {
+        CRoute route(db, begin);
+        $.append_path(path, route);
+        if(!route.is_valid()) { return; }
+        if(!corridors.insert(
+             $.stations_of($.to_parallel(path, parallel))).second)
+        {
+          return;
+        }
+        int fare;
+        try { fare = route.calc_fare_inplace(); }
+        catch(const std::invalid_argument &) { fare = -1; }
+        const alternative_t alternative = {route, $.length_of(path), fare};
+        result.push_back(alternative);
+      };
+    accept(shortest);
+    while(result.size() < k)
+    {
+      const std::vector<unsigned> last = accepted.back();
+      std::vector<bool> banned(nodes.size(), false);
+      for(size_t i=0; i+1<last.size(); ++i)
+      {
+        const unsigned spur = last[i];
+        const auto here = nodes_of(nodes[spur].station);
+        // 乗り換えのない駅では, 戻ると同じ駅を通るので分かれない.
+        if(i == 0 || here.second - here.first > 1)
+        {
+          std::vector<unsigned> banned_next;
+          for(const std::vector<unsigned> & path : accepted)
+          {
+            if(path.size() > i + 1
+               && std::equal(last.begin(), last.begin() + i + 1,
+                             path.begin()))
+            {
+              banned_next.push_back(path[i+1]);
+            }
+          }
+          const bool transfer =
+            i == 0 || nodes[last[i-1]].station != nodes[spur].station;
+          const std::vector<unsigned> spur_path =
+            $.search_spur(spur, end, banned, banned_next, transfer, rest,
+                          parallel);
+          if(!spur_path.empty())
+          {
+            std::vector<unsigned> path(last.begin(), last.begin() + i);
+            path.insert(path.end(), spur_path.begin(), spur_path.end());
+            int transfers = 0;
+            for(size_t j=1; j<path.size(); ++j)
+            {
+              if(nodes[path[j]].line != nodes[path[j-1]].line) { ++transfers; }
+            }
+            candidates.insert(
+              candidate_t(cost_t($.length_of(path), transfers), path));
+          }
+        }
+        // 通った駅には戻らない.
+        for(auto itr=here.first; itr != here.second; ++itr)
+        {
+          banned[itr->second] = true;
+        }
+      }
+      if(candidates.empty()) { break; }
+      accepted.push_back(candidates.begin()->second);
+      candidates.erase(candidates.begin());
+      accept(accepted.back());
+    }
+    if(order == ORDER_FARE)
+    {
+      // 計算できない運賃は最後に並べる.
+      std::stable_sort(result.begin(), result.end(),
+                       [](const alternative_t & a, const alternative_t & b)
+                       {
+                         return static_cast<unsigned>(a.fare)
+                           < static_cast<unsigned>(b.fare);
+                       });
+    }
+    return result;
+  }
+
+  std::uint64_t CRouteFinder::fingerprint() const
+  {
+    // FNV-1a
+    std::uint64_t hash = 14695981039346656037ull;
+    for(const node_t & node : nodes)
+    {
+      for(const int value : {node.station, node.line, node.kilo})
+      {
+        for(int shift=0; shift<32; shift+=8)
+        {
+          hash ^= (static_cast<unsigned>(value) >> shift) & 0xff;
+          hash *= 1099511628211ull;
+        }
+      }
+    }
+    return hash;
+  }
+
+  std::shared_ptr<const CLandmarks>
+  CRouteFinder::build_landmarks(size_t count) const
+  {
+    if(count == 0 || nodes.empty())
+    {
+      throw std::invalid_argument("no landmark");
+    }
+    station_vector stations;
+    std::vector<std::int32_t> table(nodes.size() * count,
+                                    CLandmarks::UNREACHABLE);
+    // 選んだ目印のうち最も近いものまでの営業キロ.
+    // 最初は最初の頂点からの営業キロで, 最初の目印を選ぶのに使う.
+    std::vector<int> nearest = $.distances(nodes.front().station, false);
+    for(size_t l=0; l<count; ++l)
+    {
+      unsigned farthest = 0;
+      for(unsigned i=0; i<nodes.size(); ++i)
+      {
+        if(nearest[i] != UNREACHABLE && nearest[i] > nearest[farthest])
+        {
+          farthest = i;
+        }
+      }
+      stations.push_back(nodes[farthest].station);
+      const std::vector<int> dist = $.distances(stations.back(), false);
+      for(unsigned i=0; i<nodes.size(); ++i)
+      {
+        if(dist[i] != UNREACHABLE) { table[i * count + l] = dist[i]; }
+        nearest[i] = l == 0 ? dist[i] : std::min(nearest[i], dist[i]);
+      }
+    }
+    return std::make_shared<CLandmarks>(stations, $.fingerprint(), table);
+  }
+
+  void CRouteFinder::set_landmarks(std::shared_ptr<const CLandmarks> landmarks)
+  {
+    if(landmarks && (landmarks->get_fingerprint() != $.fingerprint()
+                     || landmarks->size() != nodes.size()))
+    {
+      throw InvalidLandmarks("built for another graph");
+    }
+    $.landmarks = landmarks;
+  }
+
+  bool CRouteFinder::use_landmarks(const char * filename, size_t count)
+  {
+    try
+    {
+      std::shared_ptr<const CLandmarks> loaded(new CLandmarks(filename));
+      if(loaded->get_stations().size() == count)
+      {
+        $.set_landmarks(loaded);
+        return true;
+      }
+    }
+    catch(const sqlite3_wrapper::IOException &) {}
+    catch(const InvalidLandmarks &) {}
+    $.landmarks = $.build_landmarks(count);
+    $.landmarks->write(filename);
+    return false;
+  }
+
+  std::shared_ptr<const CContractionHierarchy>
+  CRouteFinder::build_hierarchy() const
+  {
+    station_vector stations;
+    for(const auto & pair : station_nodes)
+    {
+      if(stations.empty() || stations.back() != pair.first)
+      {
+        stations.push_back(pair.first);
+      }
+    }
+    std::vector<CContractionHierarchy::edge_t> edges;
+    for(size_t i=0; i+1<nodes.size(); ++i)
+    {
+      const node_t & node = nodes[i], & next = nodes[i+1];
+      if(node.line != next.line) { continue; }
+      const CContractionHierarchy::edge_t edge =
+        {node.station, next.station, node.line,
+         std::abs(next.kilo - node.kilo)};
+      edges.push_back(edge);
+    }
+    return std::make_shared<CContractionHierarchy>(stations, edges,
+                                                   $.fingerprint());
+  }
+
+  void CRouteFinder::set_hierarchy(
+    std::shared_ptr<const CContractionHierarchy> hierarchy)
+  {
+    if(hierarchy && hierarchy->get_fingerprint() != $.fingerprint())
+    {
+      throw InvalidHierarchy("built for another graph");
+    }
+    $.hierarchy = hierarchy;
+  }
+
+  bool CRouteFinder::use_hierarchy(const char * filename)
+  {
+    try
+    {
+      $.set_hierarchy(std::make_shared<CContractionHierarchy>(filename));
+      return true;
+    }
+    catch(const sqlite3_wrapper::IOException &) {}
+    catch(const InvalidHierarchy &) {}
+    $.hierarchy = $.build_hierarchy();
+    $.hierarchy->write(filename);
+    return false;
+  }
+
+  int CRouteFinder::distance(station_id_t begin, station_id_t end) const
+  {
+    if(hierarchy) { return hierarchy->distance(begin, end); }
+    size_t reached = 0;
+    const std::vector<unsigned> path = $.search(begin, end, reached);
+    if(path.empty()) { return -1; }
+    return $.length_of(path);
+  }
+
+  int CRouteFinder::distance(station_id_t begin, station_id_t end,
+                             CRoute & route) const
+  {
+    route = CRoute(db, begin);
+    if(!hierarchy)
+    {
+      size_t reached = 0;
+      const std::vector<unsigned> path = $.search(begin, end, reached);
+      if(path.empty()) { return -1; }
+      $.append_path(path, route);
+      return $.length_of(path);
+    }
+    std::vector<CContractionHierarchy::step_t> steps;
+    const int hecto = hierarchy->path(begin, end, steps);
+    if(hecto == CContractionHierarchy::UNREACHABLE) { return -1; }
+    // 縮約階層の経路の駅の頂点の範囲と, 発駅からの営業キロ.
+    typedef std::pair<StationNodes::const_iterator,
+                      StationNodes::const_iterator> range_t;
+    std::vector<range_t> ranges(1, nodes_of(begin));
+    std::vector<int> at(1, 0);
+    const auto kilo_on = [this](const range_t & range, line_id_t line)
+      {
+        auto itr = range.first;
+        while(nodes[itr->second].line != line) { ++itr; }
+        return nodes[itr->second].kilo;
+      };
+    for(const CContractionHierarchy::step_t & step : steps)
+    {
+      ranges.push_back(nodes_of(step.station));
+      at.push_back(at.back()
+                   + std::abs(kilo_on(ranges.back(), step.line)
+                              - kilo_on(ranges[ranges.size()-2], step.line)));
+    }
+    // 各駅まで乗る最少の回数と, 最後に乗った駅の添字と路線.
+    std::vector<int> rides(at.size(), std::numeric_limits<int>::max());
+    std::vector<std::pair<size_t, line_id_t> > last(at.size());
+    rides[0] = 0;
+    // 路線ごとに, 経路の駅を同じ営業キロで続けて通る乗車.
+    struct ride_t
+    {
+      //! 最後に通った経路の駅の添字と, その頂点.
+      size_t index;
+      unsigned node;
+      //! キロ程の増える向きなら1, 減る向きなら-1, まだ決まらなければ0.
+      int direction;
+      //! 乗った駅のうち, 乗るまでの回数が最少の駅の添字.
+      size_t from;
+    };
+    std::unordered_map<line_id_t, ride_t> riding;
+    // 経路の駅jの頂点uまで乗車を続けられるか.
+    const auto follow = [&](const ride_t & ride, size_t j, unsigned u)
+      {
+        const int d = nodes[u].kilo - nodes[ride.node].kilo;
+        return std::abs(d) == at[j] - at[ride.index]
+          && (d == 0 || ride.direction == 0 || (d > 0) == (ride.direction > 0));
+      };
+    for(size_t j=0; j<at.size(); ++j)
+    {
+      const range_t & here = ranges[j];
+      for(auto itr=here.first; j > 0 && itr != here.second; ++itr)
+      {
+        const auto found = riding.find(nodes[itr->second].line);
+        if(found == riding.end() || !follow(found->second, j, itr->second))
+        {
+          continue;
+        }
+        const size_t from = found->second.from;
+        if(rides[from] + 1 < rides[j])
+        {
+          rides[j] = rides[from] + 1;
+          last[j] = std::make_pair(from, found->first);
+        }
+      }
+      // rides[j]が決まってから, 乗車を延ばすか始め直す.
+      for(auto itr=here.first; itr != here.second; ++itr)
+      {
+        const unsigned u = itr->second;
+        const auto found = riding.find(nodes[u].line);
+        if(found == riding.end() || !follow(found->second, j, u))
+        {
+          const ride_t ride = {j, u, 0, j};
+          riding[nodes[u].line] = ride;
+          continue;
+        }
+        ride_t & ride = found->second;
+        const int d = nodes[u].kilo - nodes[ride.node].kilo;
+        if(d != 0) { ride.direction = d > 0 ? 1 : -1; }
+        ride.index = j;
+        ride.node = u;
+        if(rides[j] < rides[ride.from]) { ride.from = j; }
+      }
+    }
+    std::vector<std::pair<line_id_t, station_id_t> > segments;
+    for(size_t j=at.size()-1; j>0; j=last[j].first)
+    {
+      segments.push_back(std::make_pair(last[j].second, steps[j-1].station));
+    }
+    for(auto itr=segments.rbegin(); itr != segments.rend(); ++itr)
+    {
+      route.append_route(itr->first, itr->second);
+    }
+    return hecto;
+  }
+}
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ares.h"
+#include "croute.h"
+
+namespace ares
+{
+  class CDatabase;
+  class CLandmarks;
+  class CContractionHierarchy;
+
+  /**
+   * @~english
+   * Exception to represent that no route connects the stations.
+   */
+  /**
+   * @~japanese
+   * 経路が見つからなかった時の例外.
+   * 経由駅を指定した場合は, 見つからなかった区間と, その手前までの経路を持つ.
+   */
+  class RouteNotFound : public std::runtime_error
+  {
+  public:
+    //! 経路が見つからなかった区間の始点と終点.
+    const station_id_t from, to;
+    //! 始点から行ける駅の数. 始点を含む.
+    const size_t reached;
+    //! 発駅からfromまでの経路.
+    const CRoute partial;
+
+    RouteNotFound(station_id_t from, station_id_t to, size_t reached,
+                  const CRoute & partial)
+      : std::runtime_error("No route from station " + std::to_string(from)
+                           + " to station " + std::to_string(to)),
+        from(from), to(to), reached(reached), partial(partial) {}
+  };
+
+  /**
+   * @~english
+   * Exception to represent that find_cheapest() reached the label limit
+   * before the search was exhausted.
+   */
+  /**
+   * @~japanese
+   * find_cheapest()がラベルの数の上限に達し, 探索を終えられなかった時の例外.
+   * それまでに見つけた最安の経路を持つ. 最安とは限らない.
+   */
+  class SearchTruncated : public std::runtime_error
+  {
+  public:
+    //! 上限に達するまでに見つけた最安の経路.
+    const CRoute best;
+
+    SearchTruncated(size_t max_labels, const CRoute & best)
+      : std::runtime_error("Reached the limit of "
+                           + std::to_string(max_labels) + " labels"),
+        best(best) {}
+  };
+
+  /**
+   * @~english
+   * Route search engine over the line/station graph.
+   */
+  /**
+   * @~japanese
+   * 路線網の上で経路を探す.
+   * 構築時に路線ごとの駅をキロ程の順に読み込み, 路線と駅の組を頂点,
+   * 隣り合う駅の間を営業キロを重みとする辺, 同じ駅での乗り換えを重み0の辺とした
+   * グラフを作る. 探索はこのグラフのダイクストラ法で, データベースには
+   * 問い合わせない. 営業キロが同じなら乗り換えの少ない経路を選ぶ.
+   * 目印(CLandmarks)を設定すると, find()はALT探索になる.
+   * 縮約階層(CContractionHierarchy)を設定すると, distance()が速くなる.
+   * 運賃の計算(CRoute::calc_fare_inplace())は縮約階層を使わない.
+   * 運賃が最安の経路も探せる(find_cheapest()).
+   * 構築後は変更しないので, 複数のスレッドから同時に探索してよい.
+   */
+  class CRouteFinder
+  {
+  public:
+    //! 頂点. 路線上の1つの駅.
+    struct node_t
+    {
+      station_id_t station;
+      line_id_t line;
+      //! 路線上のキロ程(10倍営業キロ).
+      int kilo;
+    };
+
+    //! find_alternatives()の経路の並べ方.
+    enum ORDER
+    {
+      //! 営業キロの短い順.
+      ORDER_KILO,
+      //! 運賃の安い順. 運賃が同じなら営業キロの短い順.
+      ORDER_FARE,
+    };
+
+    //! find_alternatives()で見つけた経路.
+    struct alternative_t
+    {
+      CRoute route;
+      //! 営業キロ(10倍).
+      int hecto;
+      //! 運賃. 運賃表になく計算できなければ-1.
+      int fare;
+    };
+
+    //! find_cheapest()で作るラベルの数の既定の上限.
+    static const size_t DEFAULT_MAX_LABELS = 200000;
+    //! use_landmarks()で選ぶ目印の既定の数.
+    static const size_t DEFAULT_LANDMARKS = 16;
+
+  private:
+    //! 隣り合う駅の間の辺. 運賃の計算に使う.
+    struct edge_t
+    {
+      //! 会社ごとのキロ程.
+      std::vector<CKiloValue> kilos;
+      bool is_main;
+      DENSHA_SPECIAL_TYPE denshaid, circleid;
+      //! 特定運賃のある路線. キロの代わりに特定運賃になりうる.
+      bool special;
+    };
+
+    //! 並行する路線に置き換える区間.
+    struct parallel_t
+    {
+      //! 区間の頂点の, 並行する路線の同じ駅の頂点. なければ-1.
+      std::vector<unsigned> twin;
+      //! 頂点iとi+1の間の辺が区間にあればtrue.
+      std::vector<bool> covered;
+    };
+
+    std::shared_ptr<CDatabase> db;
+    //! 路線ごとにキロ程の順に並べた頂点. 前後の同じ路線の頂点が隣の駅.
+    std::vector<node_t> nodes;
+    typedef std::vector<std::pair<station_id_t, unsigned> > StationNodes;
+    //! 駅IDと頂点の添字の組を駅IDの順に並べたもの. 乗り換えに使う.
+    StationNodes station_nodes;
+    mutable std::once_flag edges_once;
+    //! 頂点iとi+1の間の辺. 最初にfind_cheapest()を呼んだ時に読み込む.
+    mutable std::vector<edge_t> edges;
+    //! find()の探索に使う目印.
+    std::shared_ptr<const CLandmarks> landmarks;
+    //! distance()に使う縮約階層.
+    std::shared_ptr<const CContractionHierarchy> hierarchy;
+
+    //! 駅の頂点の範囲.
+    std::pair<StationNodes::const_iterator, StationNodes::const_iterator>
+    nodes_of(station_id_t station) const;
+
+    //! 駅の, 路線の頂点. なければ-1.
+    unsigned node_on_line(station_id_t station, line_id_t line) const;
+
+    /**
+     * 隣の頂点をそれぞれfに渡す.
+     * fの引数は隣の頂点の添字と, 乗り換えならtrue.
+     */
+    template<class Function>
+    void for_each_neighbor(unsigned i, Function f) const;
+
+    //! 辺を読み込んで返す.
+    const std::vector<edge_t> & get_edges() const;
+
+    /**
+     * 駅から各頂点までの営業キロ(10倍). 行けない頂点はintの最大値.
+     * @param[in] jr_only trueならJRの営業キロだけを数え, 社線の区間と
+     *                    特定運賃のある路線の区間は0とする.
+     * @param[in] company jr_onlyの時, MAX_JR_COMPANY_TYPEでなければ
+     *                    その会社の営業キロだけを数える.
+     */
+    std::vector<int> distances(station_id_t from, bool jr_only,
+                               size_t company=MAX_JR_COMPANY_TYPE) const;
+
+    /**
+     * 2駅間の最短経路を探し, 頂点の列を返す.
+     * @param[out] reached 見つからなかった場合に, 始点から行ける駅の数.
+     * @return 見つからなければ空.
+     */
+    std::vector<unsigned> search(station_id_t begin, station_id_t end,
+                                 size_t & reached) const;
+
+    /**
+     * 頂点spurから着駅までの最短経路を, 通れない頂点と辺を除いてA*探索で探す.
+     * @param[in] banned      通れない頂点.
+     * @param[in] banned_next spurから進めない頂点.
+     * @param[in] transfer    falseならspurで乗り換えない.
+     * @param[in] rest        各頂点から着駅までの営業キロ. 探索の下界.
+     * @param[in] parallel    並行する路線に置き換える区間. 並行する路線にも
+     *                        ある駅からは, 区間の辺を通らない.
+     * @return spurから着駅までの頂点の列. 見つからなければ空.
+     */
+    std::vector<unsigned> search_spur(unsigned spur, station_id_t end,
+                                      const std::vector<bool> & banned,
+                                      const std::vector<unsigned> & banned_next,
+                                      bool transfer,
+                                      const std::vector<int> & rest,
+                                      const parallel_t & parallel) const;
+
+    //! 頂点の列の営業キロ(10倍).
+    int length_of(const std::vector<unsigned> & path) const;
+
+    //! 頂点の列を区間にまとめて経路に加える.
+    void append_path(const std::vector<unsigned> & path, CRoute & route) const;
+
+    /**
+     * 並行する路線に置き換える区間を探す.
+     * 路線の区間の両端と途中の駅が他の路線にもあり, 駅の間の営業キロが
+     * 同じで, 他の路線の方が駅が多ければ, 他の路線に置き換える.
+     * 途中には他の路線にない駅があってもよい.
+     * 例えば新幹線の区間を並行する在来線に置き換える.
+     * @param[in] begin 発駅. 他の路線になくても区間の途中にはしない.
+     * @param[in] end   着駅. 同上.
+     */
+    parallel_t find_parallel(station_id_t begin, station_id_t end) const;
+
+    //! 頂点の列のうち置き換える区間を, 並行する路線に置き換える.
+    std::vector<unsigned> to_parallel(const std::vector<unsigned> & path,
+                                      const parallel_t & parallel) const;
+
+    //! 頂点の列が順に通る駅.
+    station_vector stations_of(const std::vector<unsigned> & path) const;
+
+  public:
+    /**
+     * Constructor.
+     * Build the graph from the database.
+     */
+    explicit CRouteFinder(std::shared_ptr<CDatabase> db);
+
+    //! グラフの頂点の数.
+    size_t size() const { return nodes.size(); }
+
+    //! グラフの指紋. 頂点の駅, 路線, キロ程の並びが同じなら同じ値.
+    std::uint64_t fingerprint() const;
+
+    /**
+     * 目印を選び, 各頂点までの営業キロを求める.
+     * 目印には, それまでに選んだ目印から最も遠い駅を順に選ぶ.
+     * @param[in] count 目印の数.
+     * @throw std::invalid_argument countが0の場合.
+     */
+    std::shared_ptr<const CLandmarks> build_landmarks(size_t count) const;
+
+    /**
+     * find()の探索に目印を使う. nullptrなら使わない.
+     * 探索と同時に呼んではいけない.
+     * @throw InvalidLandmarks 目印を作ったグラフと指紋が違う場合.
+     */
+    void set_landmarks(std::shared_ptr<const CLandmarks> landmarks);
+
+    //! 探索に使う目印. なければnullptr.
+    std::shared_ptr<const CLandmarks> get_landmarks() const
+    {
+      return landmarks;
+    }
+
+    /**
+     * ファイルに保存した目印を読み込んで探索に使う.
+     * ファイルがないか, 壊れているか, 指紋か目印の数が違えば
+     * 目印を作り直してファイルに書く.
+     * @param[in] filename 目印のファイル名. データベースの隣に置く.
+     * @param[in] count    目印の数.
+     * @retval true  ファイルから読み込んだ.
+     * @retval false 作り直した.
+     * @throw IOException 作り直した目印を書けなかった場合. 目印は使う.
+     */
+    bool use_landmarks(const char * filename,
+                       size_t count=DEFAULT_LANDMARKS);
+
+    /**
+     * 駅を頂点とするグラフを作って縮約する.
+     */
+    std::shared_ptr<const CContractionHierarchy> build_hierarchy() const;
+
+    /**
+     * distance()に縮約階層を使う. nullptrなら使わない.
+     * 問い合わせと同時に呼んではいけない.
+     * @throw InvalidHierarchy 縮約階層を作ったグラフと指紋が違う場合.
+     */
+    void set_hierarchy(std::shared_ptr<const CContractionHierarchy> hierarchy);
+
+    //! distance()に使う縮約階層. なければnullptr.
+    std::shared_ptr<const CContractionHierarchy> get_hierarchy() const
+    {
+      return hierarchy;
+    }
+
+    /**
+     * ファイルに保存した縮約階層を読み込んで使う.
+     * ファイルがないか, 壊れているか, 指紋が違えば作り直してファイルに書く.
+     * @param[in] filename 縮約階層のファイル名. データベースの隣に置く.
+     * @retval true  ファイルから読み込んだ.
+     * @retval false 作り直した.
+     * @throw IOException 作り直した縮約階層を書けなかった場合.
+     *                    縮約階層は使う.
+     */
+    bool use_hierarchy(const char * filename);
+
+    /**
+     * 2駅間の最短の営業キロ(10倍).
+     * 縮約階層があれば使い, なければfind()と同じ探索をする.
+     * @return 行けなければ-1.
+     */
+    int distance(station_id_t begin, station_id_t end) const;
+
+    /**
+     * 2駅間の最短の営業キロ(10倍)と, その経路.
+     * 縮約階層があれば, 縮約階層の経路と同じ駅を同じ営業キロで通る経路の
+     * うち, 乗り換えの少ない経路を返す. 新幹線と並行する在来線のように,
+     * 営業キロの同じ路線のどちらに乗るかは縮約階層では決まらないため.
+     * 縮約階層の経路にない駅を通る経路は調べないので, find()より区間が
+     * 多いことがある. 縮約階層がなければfind()と同じ探索をする.
+     * @param[out] route 経路. 行けなければ発駅だけの経路.
+     * @return 行けなければ-1.
+     */
+    int distance(station_id_t begin, station_id_t end, CRoute & route) const;
+
+    /**
+     * 営業キロが最短の経路を探す.
+     * 目印があれば, 着駅までの営業キロの下界を足した順に頂点を調べる.
+     * @param[in] begin 発駅.
+     * @param[in] end   着駅.
+     * @return 運賃を計算できる経路. 発駅と着駅が同じなら区間のない経路.
+     * @throw RouteNotFound 経路がない場合.
+     */
+    CRoute find(station_id_t begin, station_id_t end) const;
+
+    /**
+     * 経由駅を順に通る, 区間ごとに営業キロが最短の経路を探す.
+     * @param[in] stops 発駅, 経由駅, 着駅の順の駅. 2駅以上.
+     * @throw RouteNotFound   経路がない区間がある場合.
+     * @throw std::invalid_argument 駅が2駅未満の場合.
+     */
+    CRoute find(const station_vector & stops) const;
+
+    /**
+     * 経路が通る駅を順に返す.
+     * 新幹線のように, 同じ営業キロで駅の多い路線が並行する区間は,
+     * 並行する路線の駅を通るとみなす.
+     * @throw std::invalid_argument 経路の区間がグラフにない場合.
+     */
+    station_vector passed_stations(const CRoute & route) const;
+
+    /**
+     * 営業キロの短い順にk本の経路を探す(Yenの方法).
+     * どの経路も同じ駅を2度通らず, CRoute::is_validを満たす.
+     * passed_stations()が同じ経路, 例えば新幹線と並行する在来線を
+     * 乗り換える駅だけが違う経路は1本だけ返す. 2本目からの経路では,
+     * 並行する路線のある新幹線などの区間は並行する路線で表す.
+     * 並べ方にORDER_FAREを選んでも, 選ぶ経路は営業キロの短いk本である.
+     * @param[in] begin 発駅.
+     * @param[in] end   着駅.
+     * @param[in] k     経路の数の上限.
+     * @param[in] order 並べ方.
+     * @return 経路. 発駅と着駅が同じなら区間のない経路1本.
+     * @throw RouteNotFound 経路がない場合.
+     */
+    std::vector<alternative_t>
+    find_alternatives(station_id_t begin, station_id_t end, size_t k,
+                      ORDER order=ORDER_KILO) const;
+
+    /**
+     * 運賃(CRoute::calc_fare_inplace())が最安の経路を探す.
+     * 頂点ごとに会社・幹線/地方交通線別のキロと電車特定区間の状態を
+     * ラベルに持ち, 他のラベル以上のキロしか持たないラベル,
+     * 運賃表にないキロのラベルと,
+     * 運賃の下界が最安の運賃に達するラベルを捨てる.
+     * 本州を含み幹線と地方交通線の両方を通ったラベルどうしは,
+     * 本州のキロの代わりにJRの幹線の営業キロと地方交通線の擬制キロの和を比べる.
+     * 下界は特定運賃のある路線を除いたキロの運賃で, JRの区間を通り
+     * 電車特定区間でなければ, 着駅までの残りのJRの営業キロを加える.
+     * 残りのうちJR北海道・四国・九州をそれぞれ通らなければならない分は
+     * その会社の幹線, 他は本州の幹線とする.
+     * 特定運賃は加算でなければキロより安くなりうるので下界に数えない.
+     * 運賃はキロが増えても下がらず, 本州の幹線が最も安いとみなしている.
+     * 着駅に着いた経路はcalc_fare_inplace()で運賃を求める.
+     * @param[in] begin      発駅.
+     * @param[in] end        着駅.
+     * @param[in] max_labels ラベルの数の上限.
+     * @return 最安の経路. find()の経路と運賃が同じならその経路.
+     * @throw RouteNotFound   経路がない場合.
+     * @throw SearchTruncated 探索を終える前にラベルの数が上限に達した場合.
+     */
+    CRoute find_cheapest(station_id_t begin, station_id_t end,
+                         size_t max_labels=DEFAULT_MAX_LABELS) const;
+  };
+}
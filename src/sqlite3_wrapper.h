@@ -2,7 +2,9 @@
 
 #include <string>
 #include <sstream>
+#include <memory>
 #include <stdexcept>
+#include <unordered_map>
 #include <boost/utility.hpp>
 #include <boost/optional.hpp>
 #include <sqlite3.h>
@@ -14,6 +16,16 @@ namespace sqlite3_wrapper
   //! UTF-16のstd::basic_stringを使用.
   using std::u16string;
 
+  /**
+   * このスレッドでこれまでにsqlite3_stepで得た行の数.
+   * 呼び出しの前後の差で, その間に読んだ行の数が分かる.
+   */
+  inline unsigned long & rows_stepped()
+  {
+    static thread_local unsigned long rows = 0;
+    return rows;
+  }
+
   /**
    * SQLite全般の例外
    */
@@ -458,6 +470,7 @@ namespace sqlite3_wrapper
       {
         throw db.createException();
       }
+      if(rc == SQLITE_ROW) { ++rows_stepped(); }
       return rc;
     }
 
@@ -563,4 +576,78 @@ namespace sqlite3_wrapper
       }
     }
   };
+
+  /**
+   * @~english
+   * Cache of prepared statements keyed by its query string.
+   */
+  /**
+   * @~japanese
+   * クエリ文字列をキーにしたプリペアドステートメントのキャッシュ.
+   * 同じクエリを繰り返し実行するときにsqlite3_prepare_v2を省略できる.
+   * @note 取得したステートメントはリセット・バインド解除済みで返される.
+   *       同じクエリのステートメントを入れ子にして使ってはいけない.
+   */
+  class SQLiteStmtCache : boost::noncopyable
+  {
+  private:
+    typedef std::unordered_map<std::string,
+                               std::unique_ptr<SQLiteStmt> > Container;
+    SQLite & db;
+    Container cache;
+    size_t hit_count, miss_count;
+
+  public:
+    /**
+     * Constructor.
+     * @param[in] db SQLite object to tie up with.
+     */
+    explicit SQLiteStmtCache(SQLite & db)
+      : db(db), hit_count(0), miss_count(0) {}
+
+    /**
+     * Function to get prepared statement of the query.
+     * @param[in] query    Query string of char *.
+     * @param[in] qlength  Size of query in bytes.
+     * @return             Statement which is reset and has no bindings.
+     */
+    SQLiteStmt & get(const char * query, size_t qlength)
+    {
+      return this->get(std::string(query, qlength));
+    }
+
+    /**
+     * Function to get prepared statement of the query.
+     * @param[in] query Query string of std::string.
+     * @return          Statement which is reset and has no bindings.
+     */
+    SQLiteStmt & get(const std::string & query)
+    {
+      Container::iterator itr = cache.find(query);
+      if(itr != cache.end())
+      {
+        ++hit_count;
+        itr->second->reset();
+        itr->second->clear_bindings();
+        return *itr->second;
+      }
+      ++miss_count;
+      std::unique_ptr<SQLiteStmt> stmt(new SQLiteStmt(db, query));
+      SQLiteStmt & ret = *stmt;
+      cache.insert(std::make_pair(query, std::move(stmt)));
+      return ret;
+    }
+
+    //! The number of requests served from the cache.
+    size_t hit() const { return hit_count; }
+
+    //! The number of requests which prepared a new statement.
+    size_t miss() const { return miss_count; }
+
+    //! The number of cached statements.
+    size_t size() const { return cache.size(); }
+
+    //! Finalize all cached statements.
+    void clear() { cache.clear(); }
+  };
 }
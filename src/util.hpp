@@ -33,6 +33,65 @@ namespace liquid
     }
   }
 
+  /**
+   * @~english
+   * Comparator of structures by its member.
+   * Use with std::lower_bound etc. to compare with bare key value.
+   */
+  /**
+   * @~japanese
+   * 構造体をメンバの値で比較する関数オブジェクト.
+   * std::lower_boundなどでキーの値と直接比較するのに使う.
+   */
+  template <class T, class K, K T::*Member>
+  struct KeyLess
+  {
+    bool operator()(const T & a, const T & b) const {
+      return a.*Member < b.*Member;
+    }
+    bool operator()(const T & a, const K & b) const {
+      return a.*Member < b;
+    }
+    bool operator()(const K & a, const T & b) const {
+      return a < b.*Member;
+    }
+  };
+
+  /**
+   * @~english
+   * Read-only view of an array owned by someone else.
+   */
+  /**
+   * @~japanese
+   * 他が所有する配列を参照する読み込み専用のビュー.
+   * 所有者より長く生きてはいけない.
+   */
+  template <class T>
+  class ArrayView
+  {
+  private:
+    const T * first;
+    size_t length;
+
+  public:
+    typedef const T * iterator;
+    typedef const T * const_iterator;
+    typedef T value_type;
+
+    ArrayView() : first(nullptr), length(0) {}
+
+    ArrayView(const T * first, size_t length)
+      : first(first), length(length) {}
+
+    iterator begin() const { return first; }
+    iterator end() const { return first + length; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const T & operator[](size_t i) const { return first[i]; }
+    const T & front() const { return first[0]; }
+    const T & back() const { return first[length - 1]; }
+  };
+
   /**
    * @~english
    * Interval Tree for ranges without overlap.
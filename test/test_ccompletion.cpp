@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "cdatabase.h"
+#include "ccompletion.h"
+#include "aresutil.h"
+
+#include "test_dbfilename.h"
+
+class CStationCompletionTest : public ::testing::Test
+{
+protected:
+  std::shared_ptr<ares::CDatabase> db;
+
+  CStationCompletionTest() : db(new ares::CDatabase(TEST_DB_FILENAME)) {}
+
+  //! 部分一致で検索した結果を並べ替えたもの.
+  ares::station_vector find_partial(const std::string & query)
+  {
+    ares::station_vector result;
+    db->find_stationid(query.c_str(), ares::FIND_PARTIAL, result);
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+  }
+};
+
+TEST_F(CStationCompletionTest, SameAsPartialSearch) {
+  const char * inputs[] = {"東京", "しんじゅく", "トウキヨ", "桂川", "ヒメ"};
+  for(const char * input : inputs)
+  {
+    ares::CStationCompletion completion(db);
+    for(const std::string & c : ares::u8split(input))
+    {
+      completion.push(c);
+      SCOPED_TRACE(completion.get_query());
+      const ares::station_vector expected = find_partial(completion.get_query());
+      ares::station_vector actual;
+      completion.top(completion.size(), actual);
+      std::sort(actual.begin(), actual.end());
+      EXPECT_EQ(expected, actual);
+    }
+  }
+}
+
+TEST_F(CStationCompletionTest, Ranking) {
+  ares::CStationCompletion completion(db);
+  completion.push("大阪");
+  ares::station_vector result;
+  completion.top(3, result);
+  ASSERT_EQ(3u, result.size());
+  EXPECT_EQ(db->get_stationid("大阪"), result[0]);
+  EXPECT_EQ(db->get_stationid("大阪城北詰"), result[1]);
+  EXPECT_LT(3u, completion.size());
+
+  SCOPED_TRACE("prefix matches go before partial matches");
+  result.clear();
+  completion.top(completion.size(), result);
+  std::vector<ares::CStation> stations;
+  db->get_stations(result, stations);
+  bool partial = false;
+  for(const ares::CStation & station : stations)
+  {
+    const auto type = ares::CStationCompletion::match(station, "大阪");
+    ASSERT_NE(ares::CStationCompletion::MATCH_NONE, type) << station.name;
+    if(type == ares::CStationCompletion::MATCH_PARTIAL) { partial = true; }
+    else { EXPECT_FALSE(partial) << station.name; }
+  }
+}
+
+TEST_F(CStationCompletionTest, Pop) {
+  ares::CStationCompletion completion(db);
+  EXPECT_FALSE(completion.pop());
+  completion.push("し");
+  const size_t size1 = completion.size();
+  completion.push("ん");
+  const size_t size2 = completion.size();
+  EXPECT_LE(size2, size1);
+  completion.push("じ");
+  EXPECT_TRUE(completion.pop());
+  EXPECT_EQ("しん", completion.get_query());
+  EXPECT_EQ(size2, completion.size());
+  EXPECT_TRUE(completion.pop());
+  EXPECT_EQ(size1, completion.size());
+  completion.clear();
+  EXPECT_EQ("", completion.get_query());
+  EXPECT_EQ(0u, completion.size());
+}
@@ -0,0 +1,182 @@
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "ccontractionhierarchy.h"
+#include "cstation.h"
+
+#include "test_croutefinder.h"
+
+class CContractionHierarchyTest : public CRouteFinderTest
+{
+protected:
+  //! 東海道線と山陽線の駅.
+  ares::station_vector stations()
+  {
+    ares::station_vector result;
+    for(const char * line : {"東海道", "山陽"})
+    {
+      std::vector<ares::CStation> on_line;
+      db->get_stations_of_line(db->get_lineid(line), on_line);
+      for(const ares::CStation & station : on_line)
+      {
+        result.push_back(station.id);
+      }
+    }
+    return result;
+  }
+};
+
+TEST_F(CContractionHierarchyTest, Distance) {
+  const std::shared_ptr<const ares::CContractionHierarchy> hierarchy =
+    finder.build_hierarchy();
+  EXPECT_EQ(finder.fingerprint(), hierarchy->get_fingerprint());
+  EXPECT_LT(1000u, hierarchy->size());
+
+  // 縮約階層を使わない探索と同じ営業キロ.
+  const ares::station_vector targets = stations();
+  ASSERT_LT(100u, targets.size());
+  for(size_t i=0; i<targets.size(); i+=7)
+  {
+    for(size_t j=3; j<targets.size(); j+=41)
+    {
+      EXPECT_EQ(finder.distance(targets[i], targets[j]),
+                hierarchy->distance(targets[i], targets[j]));
+    }
+  }
+  for(const auto & pair : {std::make_pair("稚内", "鹿児島中央"),
+                           std::make_pair("高知", "青森"),
+                           std::make_pair("新宿", "東京")})
+  {
+    EXPECT_EQ(finder.distance(id(pair.first), id(pair.second)),
+              hierarchy->distance(id(pair.first), id(pair.second)));
+  }
+
+  EXPECT_EQ(0, hierarchy->distance(id("東京"), id("東京")));
+  EXPECT_EQ(ares::CContractionHierarchy::UNREACHABLE,
+            hierarchy->distance(id("東京"), -1));
+  EXPECT_EQ(-1, finder.distance(id("東京"), -1));
+
+  finder.set_hierarchy(hierarchy);
+  EXPECT_EQ(hierarchy->distance(id("東京"), id("博多")),
+            finder.distance(id("東京"), id("博多")));
+  finder.set_hierarchy(nullptr);
+  EXPECT_FALSE(finder.get_hierarchy());
+}
+
+TEST_F(CContractionHierarchyTest, Path) {
+  const std::shared_ptr<const ares::CContractionHierarchy> hierarchy =
+    finder.build_hierarchy();
+  std::vector<ares::CContractionHierarchy::step_t> steps;
+  const int hecto = hierarchy->path(id("稚内"), id("鹿児島中央"), steps);
+  EXPECT_EQ(finder.distance(id("稚内"), id("鹿児島中央")), hecto);
+  ASSERT_FALSE(steps.empty());
+  EXPECT_EQ(id("鹿児島中央"), steps.back().station);
+
+  // 区間ごとの営業キロの和が最短の営業キロ.
+  ares::station_id_t station = id("稚内");
+  int sum = 0;
+  for(const auto & step : steps)
+  {
+    const std::pair<int, int> range =
+      db->get_range(step.line, station, step.station);
+    sum += range.second - range.first;
+    station = step.station;
+  }
+  EXPECT_EQ(hecto, sum);
+
+  // 新幹線と東海道線を乗り換えず, find()と同じ数の区間.
+  finder.set_hierarchy(hierarchy);
+  for(const auto & pair : {std::make_pair("東京", "大阪"),
+                           std::make_pair("東京", "博多")})
+  {
+    ares::CRoute route(db);
+    EXPECT_EQ(hierarchy->distance(id(pair.first), id(pair.second)),
+              finder.distance(id(pair.first), id(pair.second), route));
+    EXPECT_TRUE(route.is_valid());
+    const ares::CRoute found = finder.find(id(pair.first), id(pair.second));
+    EXPECT_EQ(found.end() - found.begin(), route.end() - route.begin());
+  }
+  // 営業キロはfind()と同じで, 区間はfind()より少なくない.
+  const ares::station_vector targets = stations();
+  for(size_t i=0; i<targets.size(); i+=7)
+  {
+    for(size_t j=3; j<targets.size(); j+=41)
+    {
+      if(targets[i] == targets[j]) { continue; }
+      ares::CRoute route(db);
+      const ares::CRoute found = finder.find(targets[i], targets[j]);
+      EXPECT_EQ(length(found), finder.distance(targets[i], targets[j], route));
+      EXPECT_EQ(length(found), length(route));
+      EXPECT_LE(found.end() - found.begin(), route.end() - route.begin());
+    }
+  }
+  ares::CRoute unreachable(db);
+  EXPECT_EQ(-1, finder.distance(id("東京"), -1, unreachable));
+
+  EXPECT_EQ(0, hierarchy->path(id("東京"), id("東京"), steps));
+  EXPECT_TRUE(steps.empty());
+  EXPECT_EQ(ares::CContractionHierarchy::UNREACHABLE,
+            hierarchy->path(-1, id("東京"), steps));
+}
+
+TEST_F(CContractionHierarchyTest, File) {
+  const char filename[] = "test_ccontractionhierarchy.ch";
+  std::remove(filename);
+  EXPECT_FALSE(finder.use_hierarchy(filename));
+  const std::shared_ptr<const ares::CContractionHierarchy> built =
+    finder.get_hierarchy();
+  ASSERT_TRUE(built.get() != nullptr);
+
+  // 2回目はファイルから読む.
+  ares::CRouteFinder other(db);
+  EXPECT_TRUE(other.use_hierarchy(filename));
+  const std::shared_ptr<const ares::CContractionHierarchy> loaded =
+    other.get_hierarchy();
+  ASSERT_TRUE(loaded.get() != nullptr);
+  EXPECT_EQ(built->size(), loaded->size());
+  EXPECT_EQ(built->count_arcs(), loaded->count_arcs());
+  EXPECT_EQ(built->distance(id("東京"), id("博多")),
+            loaded->distance(id("東京"), id("博多")));
+
+  // 別のグラフの縮約階層は使わない.
+  const ares::CContractionHierarchy foreign(
+    ares::station_vector{id("東京")},
+    std::vector<ares::CContractionHierarchy::edge_t>(),
+    built->get_fingerprint() + 1);
+  EXPECT_THROW(other.set_hierarchy(
+                 std::make_shared<ares::CContractionHierarchy>(foreign)),
+               ares::InvalidHierarchy);
+  const ares::CContractionHierarchy::edge_t unknown =
+    {id("東京"), id("神田"), db->get_lineid("東北"), 13};
+  EXPECT_THROW(ares::CContractionHierarchy(
+                 ares::station_vector{id("東京")},
+                 std::vector<ares::CContractionHierarchy::edge_t>{unknown}, 0),
+               std::invalid_argument);
+
+  std::ifstream ifs(filename, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(ifs)),
+                   std::istreambuf_iterator<char>());
+  ifs.close();
+  const auto write = [&](const std::string & data)
+    {
+      std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+      ofs.write(data.data(), data.size());
+    };
+  write(data.substr(0, data.size() - 1));
+  EXPECT_THROW(ares::CContractionHierarchy broken(filename),
+               ares::InvalidHierarchy);
+  std::string bad_version(data);
+  bad_version[8] ^= 0x7f;
+  write(bad_version);
+  EXPECT_THROW(ares::CContractionHierarchy broken(filename),
+               ares::InvalidHierarchy);
+  // 壊れたファイルは書き直す.
+  EXPECT_FALSE(other.use_hierarchy(filename));
+  EXPECT_NO_THROW(ares::CContractionHierarchy reloaded(filename));
+  std::remove(filename);
+  EXPECT_THROW(ares::CContractionHierarchy missing(filename),
+               ares::IOException);
+}
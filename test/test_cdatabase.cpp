@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <functional>
 #include <boost/preprocessor.hpp>
 #include "gtest/gtest.h"
@@ -6,6 +8,7 @@
 #include "sqlite3_wrapper.h"
 #include "cdatabase.h"
 #include "csegment.h"
+#include "ckilo.h"
 
 #include "test_dbfilename.h"
 
@@ -104,6 +107,20 @@ TEST_F(CDatabaseTest, BadFileName) {
     }, ares::IOException);
 }
 
+TEST_F(CDatabaseTest, StmtCache) {
+  const ares::line_id_t l = db->get_lineid("東海道");
+  const ares::station_id_t s1 = db->get_stationid("東京"),
+    s2 = db->get_stationid("大阪"), s3 = db->get_stationid("仙台");
+  const size_t miss = db->get_stmt_cache_miss();
+  const size_t hit = db->get_stmt_cache_hit();
+  EXPECT_EQ(0, db->get_kilo(l, s1));
+  EXPECT_LT(0, db->get_kilo(l, s2));
+  EXPECT_EQ(-1, db->get_kilo(l, s3));
+  // get_kilo is prepared only once.
+  EXPECT_EQ(miss + 1, db->get_stmt_cache_miss());
+  EXPECT_EQ(hit + 2, db->get_stmt_cache_hit());
+}
+
 TEST_F(CDatabaseTest, GetStationNameKanji) {
   u8vec_t kagoshima_prefix = {
     "鹿児島",
@@ -267,3 +284,140 @@ TEST_F(CDatabaseTest, GetStationsInSegment)
                               actual);
   diffVectorWithoutSort(expected, actual);
 }
+
+TEST_F(CDatabaseTest, CompanyAndKilo)
+{
+  const ares::line_id_t sanyo = db->get_lineid("山陽");
+  std::vector<ares::CKiloValue> result;
+  bool is_main = false;
+  ares::DENSHA_SPECIAL_TYPE denshaid, circleid;
+
+  SCOPED_TRACE(L"segment across the company boundary.");
+  ASSERT_TRUE(db->get_company_and_kilo(sanyo,
+                                       db->get_stationid("新下関"),
+                                       db->get_stationid("門司"),
+                                       result, is_main, denshaid, circleid));
+  EXPECT_TRUE(is_main);
+  ASSERT_EQ(2u, result.size());
+  EXPECT_EQ(db->get_company_id("本州"), result[0].company);
+  EXPECT_EQ(5209, result[0].begin);
+  EXPECT_EQ(5281, result[0].end);
+  EXPECT_EQ(db->get_company_id("九州"), result[1].company);
+  EXPECT_EQ(5281, result[1].begin);
+  EXPECT_EQ(5344, result[1].end);
+
+  SCOPED_TRACE(L"segment ends at the boundary.");
+  result.clear();
+  ASSERT_TRUE(db->get_company_and_kilo(sanyo,
+                                       db->get_stationid("新下関"),
+                                       db->get_stationid("下関"),
+                                       result, is_main, denshaid, circleid));
+  ASSERT_EQ(1u, result.size());
+  EXPECT_EQ(db->get_company_id("本州"), result[0].company);
+
+  SCOPED_TRACE(L"empty segment.");
+  result.clear();
+  EXPECT_FALSE(db->get_company_and_kilo(sanyo,
+                                        db->get_stationid("下関"),
+                                        db->get_stationid("下関"),
+                                        result, is_main, denshaid, circleid));
+  EXPECT_TRUE(result.empty());
+}
+
+TEST_F(CDatabaseTest, CompanyAndKiloInterleaved)
+{
+  // 会社の駅が交互に現れる路線を作る.
+  const char filename[] = "test_cdatabase_interleaved.sqlite";
+  {
+    std::ifstream ifs(TEST_DB_FILENAME, std::ios::binary);
+    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+    ofs << ifs.rdbuf();
+  }
+  {
+    sqlite3_wrapper::SQLite sqlite(filename);
+    ASSERT_EQ(SQLITE_OK,
+              sqlite.exec("UPDATE kilo SET kilocompanyid = 2"
+                          " WHERE lineid = (SELECT lineid FROM line"
+                          "                  WHERE linename = '山陽')"
+                          "   AND stationid = (SELECT stationid FROM station"
+                          "                     WHERE stationname = '新下関')"));
+  }
+  std::shared_ptr<ares::CDatabase> modified(
+    new ares::CDatabase(filename, false));
+  const ares::line_id_t sanyo = modified->get_lineid("山陽");
+  std::vector<ares::CKiloValue> result;
+  bool is_main = false;
+  ares::DENSHA_SPECIAL_TYPE denshaid, circleid;
+  ASSERT_TRUE(modified->get_company_and_kilo(sanyo,
+                                             modified->get_stationid("新下関"),
+                                             modified->get_stationid("門司"),
+                                             result, is_main,
+                                             denshaid, circleid));
+  EXPECT_TRUE(is_main);
+  ASSERT_EQ(3u, result.size());
+  const ares::company_id_t honshu = modified->get_company_id("本州");
+  const ares::company_id_t kyushu = modified->get_company_id("九州");
+  EXPECT_EQ(kyushu, result[0].company);
+  EXPECT_EQ(5209, result[0].begin);
+  EXPECT_EQ(5246, result[0].end);
+  EXPECT_EQ(honshu, result[1].company);
+  EXPECT_EQ(5246, result[1].begin);
+  EXPECT_EQ(5281, result[1].end);
+  EXPECT_EQ(kyushu, result[2].company);
+  EXPECT_EQ(5281, result[2].begin);
+  EXPECT_EQ(5344, result[2].end);
+  modified.reset();
+  std::remove(filename);
+}
+
+TEST_F(CDatabaseTest, LineAlias)
+{
+  const ares::line_id_t tohoku = db->get_lineid("東北新幹線");
+  EXPECT_EQ(tohoku, db->get_lineid("トホシ"));
+  EXPECT_EQ(tohoku, db->get_lineid_with_marscode("トホシ"));
+  EXPECT_EQ(db->get_lineid("石勝2"), db->get_lineid_with_marscode("セキシ2"));
+  EXPECT_THROW(db->get_lineid_with_marscode("東北新幹線"), ares::DoesNotExist);
+  EXPECT_THROW(db->get_lineid_with_marscode(""), ares::DoesNotExist);
+
+  SCOPED_TRACE(L"prefix of the line code.");
+  ares::line_vector lines;
+  db->find_lineid_with_alias("トウホ", ares::FIND_PREFIX, lines);
+  const ares::line_vector expected = {
+    db->get_lineid("東北"),
+    db->get_lineid("東北2"),
+    db->get_lineid("東北3"),
+  };
+  EXPECT_EQ(expected, lines);
+}
+
+TEST_F(CDatabaseTest, ResolveNames)
+{
+  const std::vector<std::string> stations = {
+    "東京", "ミフ", "存在しない駅", "東京", "とうきょう",
+  };
+  std::vector<ares::resolution_t> result;
+  db->resolve_stations(stations, result);
+  ASSERT_EQ(stations.size(), result.size());
+  EXPECT_EQ(db->get_stationid("東京"), result[0].id);
+  EXPECT_EQ(1u, result[0].candidates.size());
+  SCOPED_TRACE(L"ambiguous denryaku returns all candidates.");
+  ares::station_vector mifu;
+  db->find_stationid("ミフ", ares::FIND_EXACT, mifu);
+  EXPECT_EQ(0, result[1].id);
+  EXPECT_EQ(mifu, result[1].candidates);
+  SCOPED_TRACE(L"unknown name.");
+  EXPECT_EQ(0, result[2].id);
+  EXPECT_TRUE(result[2].candidates.empty());
+  EXPECT_EQ(result[0].candidates, result[3].candidates);
+  EXPECT_EQ(result[0].id, result[4].id);
+
+  const std::vector<std::string> lines = { "東海道", "トホシ", "山手" };
+  result.clear();
+  db->resolve_lines(lines, result);
+  ASSERT_EQ(lines.size(), result.size());
+  EXPECT_EQ(db->get_lineid("東海道"), result[0].id);
+  EXPECT_EQ(db->get_lineid("東北新幹線"), result[1].id);
+  ares::line_vector yamanote;
+  db->find_lineid("山手", ares::FIND_EXACT, yamanote);
+  EXPECT_EQ(yamanote, result[2].candidates);
+}
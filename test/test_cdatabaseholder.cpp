@@ -0,0 +1,88 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "sqlite3_wrapper.h"
+#include "cdatabase.h"
+#include "cdatabaseholder.h"
+#include "croute.h"
+
+#include "test_dbfilename.h"
+
+class CDatabaseHolderTest : public ::testing::Test
+{
+protected:
+  ares::CDatabaseHolder holder;
+
+  CDatabaseHolderTest() : holder(TEST_DB_FILENAME, true, false, true) {}
+
+  static int fare(std::shared_ptr<ares::CDatabase> db)
+  {
+    ares::CRoute route(db);
+    route.append_route("東海道", "東京", "神戸");
+    return route.calc_fare_inplace();
+  }
+};
+
+TEST_F(CDatabaseHolderTest, Reload) {
+  std::shared_ptr<ares::CDatabase> old = holder.get();
+  EXPECT_EQ(1u, holder.get_version());
+  std::weak_ptr<ares::CDatabase> weak(old);
+  ares::CRoute route(old);
+  route.append_route("東海道", "東京", "神戸");
+
+  EXPECT_EQ(2u, holder.reload(TEST_DB_FILENAME).get());
+  unsigned long version = 0;
+  std::shared_ptr<ares::CDatabase> db = holder.get(version);
+  EXPECT_EQ(2u, version);
+  EXPECT_NE(old, db);
+  EXPECT_TRUE(db->is_concurrent());
+
+  SCOPED_TRACE(L"the old version lives while it is used.");
+  old.reset();
+  ASSERT_FALSE(weak.expired());
+  EXPECT_EQ(fare(db), route.calc_fare_inplace());
+  route = ares::CRoute(db);
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST_F(CDatabaseHolderTest, FailedReload) {
+  std::shared_ptr<ares::CDatabase> db = holder.get();
+  std::future<unsigned long> result = holder.reload(".");
+  EXPECT_THROW(result.get(), ares::IOException);
+  EXPECT_EQ(1u, holder.get_version());
+  EXPECT_EQ(db, holder.get());
+}
+
+TEST_F(CDatabaseHolderTest, ReadersDuringReload) {
+  const int expected = fare(holder.get());
+  std::atomic<bool> done(false);
+  std::atomic<int> mismatch(0), count(0);
+  std::vector<std::thread> readers;
+  for(int i=0; i<4; ++i)
+  {
+    readers.push_back(std::thread([&]()
+      {
+        while(!done || count < 8)
+        {
+          if(fare(holder.get()) != expected) { ++mismatch; }
+          ++count;
+        }
+      }));
+  }
+  for(int i=0; i<3; ++i) { holder.reload(TEST_DB_FILENAME).get(); }
+  done = true;
+  for(std::thread & reader : readers) { reader.join(); }
+  EXPECT_EQ(4u, holder.get_version());
+  EXPECT_EQ(0, mismatch);
+}
+
+TEST_F(CDatabaseHolderTest, DestroyedDuringReload) {
+  std::unique_ptr<ares::CDatabaseHolder> other(
+    new ares::CDatabaseHolder(holder.get(), false, false, true));
+  std::future<unsigned long> result = other->reload(TEST_DB_FILENAME);
+  other.reset();
+  EXPECT_EQ(2u, result.get());
+}
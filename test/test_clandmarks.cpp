@@ -0,0 +1,110 @@
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "clandmarks.h"
+
+#include "test_croutefinder.h"
+
+class CLandmarksTest : public CRouteFinderTest {};
+
+TEST_F(CLandmarksTest, Build) {
+  const std::shared_ptr<const ares::CLandmarks> landmarks =
+    finder.build_landmarks(4);
+  ASSERT_EQ(4u, landmarks->get_stations().size());
+  ASSERT_EQ(finder.size(), landmarks->size());
+  EXPECT_EQ(finder.fingerprint(), landmarks->get_fingerprint());
+  // 目印はそれぞれ別の駅で, 目印の駅からの営業キロは0.
+  for(size_t i=0; i<4; ++i)
+  {
+    for(size_t j=0; j<i; ++j)
+    {
+      EXPECT_NE(landmarks->get_stations()[j], landmarks->get_stations()[i]);
+    }
+    int nearest = -1;
+    for(unsigned node=0; node<landmarks->size(); ++node)
+    {
+      const int d = landmarks->get_distance(node, i);
+      if(d != ares::CLandmarks::UNREACHABLE
+         && (nearest < 0 || d < nearest)) { nearest = d; }
+    }
+    EXPECT_EQ(0, nearest);
+  }
+  EXPECT_EQ(0, landmarks->lower_bound(0, 0));
+  EXPECT_THROW(finder.build_landmarks(0), std::invalid_argument);
+}
+
+TEST_F(CLandmarksTest, SameRoute) {
+  finder.set_landmarks(finder.build_landmarks(8));
+  const ares::CRouteFinder plain(db);
+  for(const auto & pair : {std::make_pair("東京", "神戸"),
+                           std::make_pair("稚内", "鹿児島中央"),
+                           std::make_pair("新宿", "東京"),
+                           std::make_pair("高知", "青森")})
+  {
+    // 営業キロと乗り換えが同じ経路が他にもあるので, 経路そのものは比べない.
+    const ares::CRoute expected = plain.find(id(pair.first), id(pair.second));
+    const ares::CRoute actual = finder.find(id(pair.first), id(pair.second));
+    EXPECT_EQ(length(expected), length(actual));
+    EXPECT_EQ(expected.end() - expected.begin(), actual.end() - actual.begin());
+  }
+  EXPECT_THROW(finder.find(id("東京"), -1), ares::RouteNotFound);
+
+  finder.set_landmarks(nullptr);
+  EXPECT_FALSE(finder.get_landmarks());
+}
+
+TEST_F(CLandmarksTest, File) {
+  const char filename[] = "test_clandmarks.alt";
+  std::remove(filename);
+  EXPECT_FALSE(finder.use_landmarks(filename, 4));
+  const std::shared_ptr<const ares::CLandmarks> built =
+    finder.get_landmarks();
+  ASSERT_TRUE(built.get() != nullptr);
+
+  // 2回目はファイルから読む.
+  ares::CRouteFinder other(db);
+  EXPECT_TRUE(other.use_landmarks(filename, 4));
+  ASSERT_TRUE(other.get_landmarks().get() != nullptr);
+  EXPECT_EQ(built->get_stations(), other.get_landmarks()->get_stations());
+  for(unsigned node=0; node<built->size(); node+=97)
+  {
+    EXPECT_EQ(built->get_distance(node, 3),
+              other.get_landmarks()->get_distance(node, 3));
+  }
+  // 数が違えば作り直す.
+  EXPECT_FALSE(other.use_landmarks(filename, 2));
+  EXPECT_EQ(2u, ares::CLandmarks(filename).get_stations().size());
+
+  // 別のグラフの目印は使わない.
+  const ares::CLandmarks foreign(built->get_stations(),
+                                 built->get_fingerprint() + 1,
+                                 std::vector<std::int32_t>(
+                                   built->size() * 4, 0));
+  EXPECT_THROW(other.set_landmarks(
+                 std::make_shared<ares::CLandmarks>(foreign)),
+               ares::InvalidLandmarks);
+
+  std::ifstream ifs(filename, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(ifs)),
+                   std::istreambuf_iterator<char>());
+  ifs.close();
+  const auto write = [&](const std::string & data)
+    {
+      std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+      ofs.write(data.data(), data.size());
+    };
+  write(data.substr(0, data.size() - 1));
+  EXPECT_THROW(ares::CLandmarks loaded(filename), ares::InvalidLandmarks);
+  std::string bad_version(data);
+  bad_version[8] ^= 0x7f;
+  write(bad_version);
+  EXPECT_THROW(ares::CLandmarks loaded(filename), ares::InvalidLandmarks);
+  // 壊れたファイルは書き直す.
+  EXPECT_FALSE(other.use_landmarks(filename, 2));
+  EXPECT_NO_THROW(ares::CLandmarks loaded(filename));
+  std::remove(filename);
+  EXPECT_THROW(ares::CLandmarks loaded(filename), ares::IOException);
+}
@@ -0,0 +1,255 @@
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "sqlite3_wrapper.h"
+#include "cdatabase.h"
+#include "cnameindex.h"
+#include "cnetworksnapshot.h"
+#include "cstation.h"
+#include "aresutil.h"
+
+#include "test_dbfilename.h"
+
+/**
+ * 索引を使うCDatabaseがLIKEで検索するCDatabaseと
+ * 同じ結果を返すことを確かめる.
+ */
+class CNameIndexTest : public ::testing::Test
+{
+protected:
+  std::shared_ptr<ares::CDatabase> sql, mem;
+  std::vector<std::string> queries;
+
+  CNameIndexTest()
+    : sql(new ares::CDatabase(TEST_DB_FILENAME)),
+      mem(new ares::CDatabase(TEST_DB_FILENAME, true, true))
+  {
+    // 全駅を調べると遅いので, 決めた路線の途中の駅だけを使う.
+    for(const char * line : {"東海道", "東北新幹線", "函館", "石勝2",
+                             "予讃", "鹿児島1"})
+    {
+      std::vector<ares::CStation> stations;
+      sql->get_stations_of_line(sql->get_lineid(line), stations);
+      add_queries(line);
+      const ares::CStation & station = stations[stations.size() / 2];
+      add_queries(station.name);
+      add_queries(station.yomi);
+      add_queries(station.denryaku);
+    }
+    const char * extra[] = {
+      "", "ａ", "ー", "（", "）", "（函）", "桂川", "高松", "とうきょう",
+      "東京", "山手", "新幹線", "SA", "sa", "ABC",
+      "トホシ", "トウホ", "シ", "2", "ト_シ",
+    };
+    queries.insert(queries.end(), std::begin(extra), std::end(extra));
+  }
+
+  //! 文字列全体と先頭, 末尾の1文字と途中の2文字を問い合わせに加える.
+  void add_queries(const std::string & str)
+  {
+    const std::vector<std::string> chars = ares::u8split(str);
+    queries.push_back(str);
+    if(chars.empty()) { return; }
+    queries.push_back(chars.front());
+    queries.push_back(chars.back());
+    if(chars.size() < 3) { return; }
+    queries.push_back(chars[chars.size()/2] + chars[chars.size()/2+1]);
+  }
+};
+
+TEST_F(CNameIndexTest, Station) {
+  const ares::find_mode modes[] = {
+    ares::FIND_EXACT, ares::FIND_PREFIX, ares::FIND_SUFFIX, ares::FIND_PARTIAL,
+  };
+  for(const std::string & query : queries)
+  {
+    for(const ares::find_mode mode : modes)
+    {
+      ares::station_vector expected, actual;
+      sql->find_stationid_with_name(query.c_str(), mode, expected);
+      mem->find_stationid_with_name(query.c_str(), mode, actual);
+      EXPECT_EQ(expected, actual) << "name " << query << " " << mode;
+      expected.clear();
+      actual.clear();
+      sql->find_stationid_with_yomi(query.c_str(), mode, expected);
+      mem->find_stationid_with_yomi(query.c_str(), mode, actual);
+      EXPECT_EQ(expected, actual) << "yomi " << query << " " << mode;
+      expected.clear();
+      actual.clear();
+      sql->find_stationid_with_denryaku(query.c_str(), mode, expected);
+      mem->find_stationid_with_denryaku(query.c_str(), mode, actual);
+      EXPECT_EQ(expected, actual) << "denryaku " << query << " " << mode;
+    }
+  }
+}
+
+TEST_F(CNameIndexTest, Line) {
+  const ares::find_mode modes[] = {
+    ares::FIND_EXACT, ares::FIND_PREFIX, ares::FIND_SUFFIX, ares::FIND_PARTIAL,
+  };
+  for(const std::string & query : queries)
+  {
+    for(const ares::find_mode mode : modes)
+    {
+      ares::line_vector expected, actual;
+      sql->find_lineid(query.c_str(), mode, expected);
+      mem->find_lineid(query.c_str(), mode, actual);
+      EXPECT_EQ(expected, actual) << query << " " << mode;
+    }
+  }
+}
+
+TEST_F(CNameIndexTest, Paren) {
+  ares::station_vector actual;
+  mem->find_stationid_with_name("桂川", ares::FIND_EXACT, actual);
+  EXPECT_NE(actual.end(), std::find(actual.begin(), actual.end(),
+                                    mem->get_stationid("（函）桂川")));
+}
+
+TEST_F(CNameIndexTest, Wildcard) {
+  // ワイルドカードを含む問い合わせはLIKEで答える.
+  EXPECT_FALSE(ares::CNameIndex::is_searchable("東_"));
+  EXPECT_FALSE(ares::CNameIndex::is_searchable("%京"));
+  EXPECT_TRUE(ares::CNameIndex::is_searchable("東京"));
+  ares::station_vector expected, actual;
+  sql->find_stationid("東_", ares::FIND_EXACT, expected);
+  mem->find_stationid("東_", ares::FIND_EXACT, actual);
+  EXPECT_EQ(expected, actual);
+  EXPECT_FALSE(actual.empty());
+}
+
+TEST_F(CNameIndexTest, NormalizeKey) {
+  EXPECT_EQ("とうきょう", ares::CNameIndex::normalize_key("トウキョウ"));
+  EXPECT_EQ("とうきょう", ares::CNameIndex::normalize_key("ﾄｳｷｮｳ"));
+  EXPECT_EQ("がーら湯沢", ares::CNameIndex::normalize_key("ｶﾞｰﾗ湯沢"));
+  EXPECT_EQ("ぱ", ares::CNameIndex::normalize_key("ﾊﾟ"));
+  EXPECT_EQ("ゔ", ares::CNameIndex::normalize_key("ｳﾞ"));
+  EXPECT_EQ("(函)桂川", ares::CNameIndex::normalize_key("（函）桂川"));
+  EXPECT_EQ("jr 2", ares::CNameIndex::normalize_key("ＪＲ　２"));
+  EXPECT_EQ("駒け岳", ares::CNameIndex::normalize_key("駒ヶ岳"));
+  // 結合文字の濁点は合成する.
+  EXPECT_EQ("が", ares::CNameIndex::normalize_key("か\u3099"));
+  // 全角と半角以外の互換文字はmksql.pyと同じくそのまま残す.
+  EXPECT_EQ("Ⅱ①㈱㌔", ares::CNameIndex::normalize_key("Ⅱ①㈱㌔"));
+}
+
+namespace
+{
+  //! ひらがなをカタカナにする.
+  std::string to_katakana(const std::string & str)
+  {
+    std::string result;
+    for(std::string c : ares::u8split(str))
+    {
+      if(c.size() == 3)
+      {
+        const unsigned cp = ((c[0] & 0x0f) << 12) | ((c[1] & 0x3f) << 6)
+          | (c[2] & 0x3f);
+        if(0x3041 <= cp && cp <= 0x3096)
+        {
+          const unsigned k = cp + 0x60;
+          c[0] = static_cast<char>(0xe0 | (k >> 12));
+          c[1] = static_cast<char>(0x80 | ((k >> 6) & 0x3f));
+          c[2] = static_cast<char>(0x80 | (k & 0x3f));
+        }
+      }
+      result += c;
+    }
+    return result;
+  }
+}
+
+TEST_F(CNameIndexTest, Key) {
+  const ares::find_mode modes[] = {
+    ares::FIND_EXACT, ares::FIND_PREFIX, ares::FIND_SUFFIX, ares::FIND_PARTIAL,
+  };
+  for(const std::string & query_ : queries)
+  {
+    for(const std::string & query : { query_, to_katakana(query_) })
+    {
+      for(const ares::find_mode mode : modes)
+      {
+        ares::station_vector expected, actual;
+        sql->find_stationid_with_key(query.c_str(), mode, expected);
+        mem->find_stationid_with_key(query.c_str(), mode, actual);
+        EXPECT_EQ(expected, actual) << "station " << query << " " << mode;
+        ares::line_vector expected_line, actual_line;
+        sql->find_lineid_with_key(query.c_str(), mode, expected_line);
+        mem->find_lineid_with_key(query.c_str(), mode, actual_line);
+        EXPECT_EQ(expected_line, actual_line) << "line " << query << " " << mode;
+      }
+    }
+  }
+}
+
+TEST_F(CNameIndexTest, KeyOfYomi) {
+  // 読みをカタカナで入力しても1回の問い合わせで見つかる.
+  std::vector<std::pair<ares::line_id_t, std::string> > lines;
+  sql->get_all_lines_name(lines);
+  for(size_t i=0; i<lines.size(); i+=3)
+  {
+    std::vector<ares::CStation> stations;
+    sql->get_stations_of_line(lines[i].first, stations);
+    for(const ares::CStation & station : stations)
+    {
+      ares::station_vector found;
+      mem->find_stationid_with_key(to_katakana(station.yomi).c_str(),
+                                   ares::FIND_EXACT, found);
+      EXPECT_NE(found.end(), std::find(found.begin(), found.end(), station.id))
+        << station.yomi;
+    }
+  }
+  ares::line_vector found;
+  sql->find_lineid_with_key("トウホクシンカンセン", ares::FIND_EXACT, found);
+  ASSERT_EQ(1u, found.size());
+  EXPECT_EQ(sql->get_lineid("東北新幹線"), found[0]);
+}
+
+TEST_F(CNameIndexTest, Snapshot) {
+  // mmapしたスナップショットの中の索引は, SQLで作った索引と同じ結果を返す.
+  const char filename[] = "test_cnameindex.bin";
+  mem->get_snapshot()->write(filename);
+  std::shared_ptr<const ares::CNetworkSnapshot> mapped(
+    new ares::CNetworkSnapshot(filename));
+  std::remove(filename);
+  sqlite3_wrapper::SQLite db(TEST_DB_FILENAME, SQLITE_OPEN_READONLY);
+  const ares::CNameIndex built(db);
+  const ares::CNameIndex attached(mapped);
+  EXPECT_EQ(built.station_size(), attached.station_size());
+  const ares::find_mode modes[] = {
+    ares::FIND_EXACT, ares::FIND_PREFIX, ares::FIND_SUFFIX, ares::FIND_PARTIAL,
+  };
+  for(const std::string & query : queries)
+  {
+    if(!ares::CNameIndex::is_searchable(query.c_str())) { continue; }
+    const std::string key = ares::CNameIndex::normalize_key(query);
+    for(const ares::find_mode mode : modes)
+    {
+      ares::station_vector expected, actual;
+      built.find_stationid_with_name(query.c_str(), mode, expected);
+      built.find_stationid_with_denryaku(query.c_str(), mode, expected);
+      built.find_stationid_with_key(key.c_str(), mode, expected);
+      attached.find_stationid_with_name(query.c_str(), mode, actual);
+      attached.find_stationid_with_denryaku(query.c_str(), mode, actual);
+      attached.find_stationid_with_key(key.c_str(), mode, actual);
+      EXPECT_EQ(expected, actual) << query << " " << mode;
+      ares::line_vector expected_lines, actual_lines;
+      built.find_lineid_with_yomi(query.c_str(), mode, expected_lines);
+      built.find_lineid_with_alias(query.c_str(), mode, expected_lines);
+      attached.find_lineid_with_yomi(query.c_str(), mode, actual_lines);
+      attached.find_lineid_with_alias(query.c_str(), mode, actual_lines);
+      EXPECT_EQ(expected_lines, actual_lines) << query << " " << mode;
+    }
+  }
+
+  std::shared_ptr<ares::CDatabase> db_mapped(
+    new ares::CDatabase(TEST_DB_FILENAME, mapped));
+  ares::station_vector expected, actual;
+  sql->find_stationid_with_yomi("とうきょう", ares::FIND_PREFIX, expected);
+  db_mapped->find_stationid_with_yomi("とうきょう", ares::FIND_PREFIX, actual);
+  EXPECT_EQ(expected, actual);
+  EXPECT_FALSE(actual.empty());
+}
@@ -0,0 +1,558 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <boost/optional/optional_io.hpp>
+#include "gtest/gtest.h"
+
+#include "sqlite3_wrapper.h"
+#include "cdatabase.h"
+#include "cnetworksnapshot.h"
+#include "croute.h"
+#include "csegment.h"
+#include "cstation.h"
+#include "ckilo.h"
+
+#include "test_dbfilename.h"
+
+/**
+ * スナップショットを使うCDatabaseがSQLだけのCDatabaseと
+ * 同じ結果を返すことを確かめる.
+ */
+class CNetworkSnapshotTest : public ::testing::Test
+{
+protected:
+  std::shared_ptr<ares::CDatabase> sql, mem;
+  std::vector<std::pair<ares::line_id_t, std::string> > lines;
+
+  CNetworkSnapshotTest()
+    : sql(new ares::CDatabase(TEST_DB_FILENAME)),
+      mem(new ares::CDatabase(TEST_DB_FILENAME, true, true))
+  {
+    sql->get_all_lines_name(lines);
+  }
+
+  std::vector<ares::CStation> stations_of(ares::line_id_t line)
+  {
+    std::vector<ares::CStation> stations;
+    sql->get_stations_of_line(line, stations);
+    return stations;
+  }
+
+  static std::pair<int, int>
+  flatten(const boost::optional<std::pair<bool, int> > & fare)
+  {
+    return fare ? std::make_pair(static_cast<int>(fare->first), fare->second)
+      : std::make_pair(-1, -1);
+  }
+};
+
+TEST_F(CNetworkSnapshotTest, Loaded) {
+  ASSERT_EQ(nullptr, sql->get_snapshot());
+  ASSERT_NE(nullptr, mem->get_snapshot());
+  EXPECT_EQ(lines.size(), mem->get_snapshot()->line_size());
+  EXPECT_LT(0u, mem->get_snapshot()->kilo_size());
+  EXPECT_LT(0u, mem->get_snapshot()->fare_size());
+}
+
+TEST_F(CNetworkSnapshotTest, Kilo) {
+  const ares::station_id_t tokyo = sql->get_stationid("東京");
+  for(const auto & line : lines)
+  {
+    SCOPED_TRACE(line.second);
+    const auto stations = stations_of(line.first);
+    if(stations.empty()) { continue; }
+    const ares::station_id_t first = stations.front().id;
+    const ares::station_id_t last = stations.back().id;
+    EXPECT_EQ(sql->get_kilo(line.first, tokyo),
+              mem->get_kilo(line.first, tokyo));
+    EXPECT_EQ(sql->is_belong_to_line(line.first, tokyo),
+              mem->is_belong_to_line(line.first, tokyo));
+    EXPECT_EQ(sql->get_range(line.first, tokyo, last),
+              mem->get_range(line.first, tokyo, last));
+    for(const auto & station : stations)
+    {
+      const ares::CSegment segment(last, line.first, station.id);
+      EXPECT_EQ(sql->get_kilo(line.first, station.id),
+                mem->get_kilo(line.first, station.id));
+      EXPECT_TRUE(mem->is_belong_to_line(line.first, station.id));
+      EXPECT_EQ(sql->get_range(line.first, first, station.id),
+                mem->get_range(line.first, first, station.id));
+      EXPECT_EQ(sql->is_contains(segment, first),
+                mem->is_contains(segment, first));
+      EXPECT_EQ(sql->is_contains(segment, stations[stations.size()/2].id),
+                mem->is_contains(segment, stations[stations.size()/2].id));
+      ares::station_vector expected, actual;
+      EXPECT_EQ(sql->get_stations_of_segment(line.first, station.id, first,
+                                             expected),
+                mem->get_stations_of_segment(line.first, station.id, first,
+                                             actual));
+      EXPECT_EQ(expected, actual);
+    }
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, KiloOfEveryLine) {
+  // 隣り合う路線の駅も含めて, すべての路線と駅の組をSQLと比べる.
+  for(const auto & line : lines)
+  {
+    SCOPED_TRACE(line.second);
+    ares::connect_vector connect;
+    sql->get_connect_line(line.first, connect);
+    std::set<ares::line_id_t> others;
+    for(const auto & other : connect) { others.insert(other.first); }
+    for(const auto & station : stations_of(line.first))
+    {
+      EXPECT_EQ(station.realkilo.get_hecto(),
+                mem->get_kilo(line.first, station.id));
+      for(const ares::line_id_t other : others)
+      {
+        EXPECT_EQ(sql->get_kilo(other, station.id),
+                  mem->get_kilo(other, station.id));
+        EXPECT_EQ(sql->is_belong_to_line(other, station.id),
+                  mem->is_belong_to_line(other, station.id));
+      }
+    }
+  }
+  const ares::station_id_t tokyo = sql->get_stationid("東京");
+  EXPECT_EQ(-1, mem->get_kilo(-1, tokyo));
+  EXPECT_FALSE(mem->is_belong_to_line(-1, tokyo));
+  EXPECT_FALSE(mem->is_contains(ares::CSegment(tokyo, -1, tokyo), tokyo));
+}
+
+TEST_F(CNetworkSnapshotTest, Densha) {
+  for(const auto & line : lines)
+  {
+    SCOPED_TRACE(line.second);
+    const auto stations = stations_of(line.first);
+    for(size_t i=0; i<stations.size(); ++i)
+    {
+      const size_t others[] = {0, i, i+1, i+3, stations.size()-1};
+      for(const size_t j : others)
+      {
+        if(j >= stations.size()) { continue; }
+        const auto range = sql->get_range(line.first,
+                                          stations[i].id, stations[j].id);
+        EXPECT_EQ(sql->get_denshaid(line.first, range),
+                  mem->get_denshaid(line.first, range))
+          << range.first << " " << range.second;
+      }
+    }
+    const auto outside = std::make_pair(-10, -1);
+    EXPECT_EQ(sql->get_denshaid(line.first, outside),
+              mem->get_denshaid(line.first, outside));
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, CompanyAndKilo) {
+  for(const auto & line : lines)
+  {
+    SCOPED_TRACE(line.second);
+    const auto stations = stations_of(line.first);
+    for(size_t i=0; i<stations.size(); ++i)
+    {
+      const size_t others[] = {0, i, i+1, stations.size()-1};
+      for(const size_t j : others)
+      {
+        if(j >= stations.size()) { continue; }
+        std::vector<ares::CKiloValue> expected, actual;
+        bool expected_main = false, actual_main = false;
+        ares::DENSHA_SPECIAL_TYPE densha[4];
+        EXPECT_EQ(sql->get_company_and_kilo(line.first,
+                                            stations[i].id, stations[j].id,
+                                            expected, expected_main,
+                                            densha[0], densha[1]),
+                  mem->get_company_and_kilo(line.first,
+                                            stations[i].id, stations[j].id,
+                                            actual, actual_main,
+                                            densha[2], densha[3]));
+        EXPECT_EQ(densha[0], densha[2]);
+        EXPECT_EQ(densha[1], densha[3]);
+        ASSERT_EQ(expected.size(), actual.size());
+        if(expected.empty()) { continue; }
+        EXPECT_EQ(expected_main, actual_main);
+        for(size_t k=0; k<expected.size(); ++k)
+        {
+          EXPECT_EQ(expected[k].company, actual[k].company);
+          EXPECT_EQ(expected[k].begin, actual[k].begin);
+          EXPECT_EQ(expected[k].end, actual[k].end);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, FareTable) {
+  const std::pair<const char *, ares::company_id_t> tables[] = {
+    {"A1", 0}, {"A2", 1}, {"A2", 2}, {"A2", 3}, {"B1", 0}, {"B1", 1},
+    {"B2", 1}, {"C1", 1}, {"C1", 2}, {"C1", 3}, {"D1", 0}, {"D2", 0},
+    {"E1", 0}, {"E2", 0}, {"Z", 4}, {"C2", 3}, {"X", 0},
+  };
+  for(const auto & table : tables)
+  {
+    for(int kilo=0; kilo<=2100; ++kilo)
+    {
+      SCOPED_TRACE(table.first);
+      try
+      {
+        const int expected =
+          sql->get_fare_table(table.first, table.second, kilo);
+        EXPECT_EQ(expected,
+                  mem->get_fare_table(table.first, table.second, kilo))
+          << kilo;
+      }
+      catch(const std::invalid_argument &)
+      {
+        EXPECT_THROW(mem->get_fare_table(table.first, table.second, kilo),
+                     std::invalid_argument) << kilo;
+      }
+    }
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, FareTableBounds) {
+  const std::pair<const char *, ares::company_id_t> tables[] = {
+    {"A1", 0}, {"A2", 1}, {"B2", 1}, {"E1", 0}, {"A1", 4}, {"A3", 0},
+    // 種別の配列に収まらない運賃表もSQLと同じ例外.
+    {"A1XX", 0},
+  };
+  const int kilos[] = {-100, -1, 0, 1, 3399, 3400, 3401, 9998, 9999, 10000};
+  for(const auto & table : tables)
+  {
+    for(const int kilo : kilos)
+    {
+      const auto expected = mem->get_snapshot()->get_fare_table(
+        table.first, table.second, kilo);
+      bool thrown = false;
+      try
+      {
+        EXPECT_EQ(expected,
+                  sql->get_fare_table(table.first, table.second, kilo))
+          << table.first << " " << table.second << " " << kilo;
+      }
+      catch(const std::invalid_argument &) { thrown = true; }
+      EXPECT_EQ(!expected, thrown)
+        << table.first << " " << table.second << " " << kilo;
+    }
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, FareCountryTable) {
+  const char * tables[] = {"C2", "C3", "C2XX"};
+  for(const char * table : tables)
+  {
+    for(ares::company_id_t company=0; company<5; ++company)
+    {
+      for(int fakekilo=0; fakekilo<200; ++fakekilo)
+      {
+        for(int realkilo=fakekilo*9/10-2; realkilo<=fakekilo; ++realkilo)
+        {
+          EXPECT_EQ(sql->get_fare_country_table(table, company,
+                                                realkilo, fakekilo),
+                    mem->get_fare_country_table(table, company,
+                                                realkilo, fakekilo))
+            << table << " " << company << " " << realkilo << " " << fakekilo;
+        }
+      }
+    }
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, FareCountryTableBatch) {
+  std::vector<std::pair<int, int> > kilos;
+  for(int fakekilo=0; fakekilo<200; ++fakekilo)
+  {
+    for(int realkilo=fakekilo*9/10-2; realkilo<=fakekilo; ++realkilo)
+    {
+      kilos.push_back(std::make_pair(realkilo, fakekilo));
+    }
+  }
+  for(ares::company_id_t company=0; company<5; ++company)
+  {
+    std::vector<boost::optional<int> > expected, actual;
+    sql->get_fare_country_table("C2", company, kilos, expected);
+    mem->get_fare_country_table("C2", company, kilos, actual);
+    ASSERT_EQ(kilos.size(), expected.size());
+    EXPECT_EQ(expected, actual) << company;
+    for(size_t i=0; i<kilos.size(); i+=37)
+    {
+      EXPECT_EQ(sql->get_fare_country_table("C2", company,
+                                            kilos[i].first, kilos[i].second),
+                expected[i]);
+    }
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, SpecialFare) {
+  for(const auto & line : lines)
+  {
+    SCOPED_TRACE(line.second);
+    const auto stations = stations_of(line.first);
+    if(stations.empty()) { continue; }
+    for(const auto & station : stations)
+    {
+      const ares::station_id_t first = stations.front().id;
+      const ares::station_id_t last = stations.back().id;
+      EXPECT_EQ(flatten(sql->get_special_fare(line.first, first, station.id)),
+                flatten(mem->get_special_fare(line.first, first, station.id)));
+      EXPECT_EQ(flatten(sql->get_special_fare(line.first, station.id, last)),
+                flatten(mem->get_special_fare(line.first, station.id, last)));
+    }
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, RouteFare) {
+  const char * routes[][4] = {
+    {"東海道", "東京", "神戸", nullptr},
+    {"山手2", "田端", "新宿", nullptr},
+    {"予讃", "多度津", "松山", nullptr},
+    {"本四備讃", "児島", "宇多津", nullptr},
+    {"青い森鉄道", "目時", "野辺地", nullptr},
+  };
+  for(const auto & r : routes)
+  {
+    ares::CRoute expected(sql), actual(mem);
+    expected.append_route(r[0], r[1], r[2]);
+    actual.append_route(r[0], r[1], r[2]);
+    EXPECT_EQ(expected.calc_fare_inplace(), actual.calc_fare_inplace())
+      << r[0] << " " << r[1] << " " << r[2];
+  }
+}
+
+TEST_F(CNetworkSnapshotTest, NameView) {
+  const ares::CNetworkSnapshot & snapshot = *mem->get_snapshot();
+  const auto in_image = [&snapshot](const boost::string_ref & name)
+    {
+      return snapshot.data() <= name.data()
+        && name.data() + name.size() < snapshot.data() + snapshot.size();
+    };
+  for(const auto & line : lines)
+  {
+    SCOPED_TRACE(line.second);
+    const boost::string_ref name = mem->get_line_name_view(line.first);
+    EXPECT_EQ(line.second, name.to_string());
+    EXPECT_TRUE(in_image(name));
+    EXPECT_EQ(line.second, mem->get_line_name(line.first));
+    for(const ares::CStation & station : stations_of(line.first))
+    {
+      const boost::string_ref name = mem->get_station_name_view(station.id);
+      EXPECT_EQ(station.name, name.to_string());
+      EXPECT_TRUE(in_image(name));
+      EXPECT_EQ(station.yomi,
+                mem->get_station_yomi_view(station.id).to_string());
+      EXPECT_EQ(station.denryaku,
+                mem->get_station_denryaku_view(station.id).to_string());
+    }
+  }
+  // 同じ読みは同じ文字列を指す.
+  EXPECT_EQ(mem->get_station_yomi_view(sql->get_stationid("愛野")).data(),
+            mem->get_station_yomi_view(sql->get_stationid("相野")).data());
+  EXPECT_THROW(mem->get_line_name_view(-1), std::out_of_range);
+  EXPECT_THROW(mem->get_station_name_view(-1), std::out_of_range);
+
+  // スナップショットがなくても, 2回目以降は同じ文字列を指す.
+  const ares::station_id_t tokyo = sql->get_stationid("東京");
+  const boost::string_ref first = sql->get_station_name_view(tokyo);
+  EXPECT_EQ("東京", first.to_string());
+  EXPECT_EQ(first.data(), sql->get_station_name_view(tokyo).data());
+  EXPECT_EQ(sql->get_station_yomi(tokyo),
+            sql->get_station_yomi_view(tokyo).to_string());
+  EXPECT_THROW(sql->get_line_name_view(-1), std::out_of_range);
+
+  // 経路の表示はどちらでも同じ.
+  ares::CRoute expected(sql), actual(mem);
+  expected.append_route("東海道", "東京", "神戸");
+  actual.append_route("東海道", "東京", "神戸");
+  std::stringstream expected_ss, actual_ss;
+  expected_ss << expected;
+  actual_ss << actual;
+  EXPECT_EQ(expected_ss.str(), actual_ss.str());
+}
+
+TEST_F(CNetworkSnapshotTest, Graph) {
+  const ares::CNetworkSnapshot & snapshot = *mem->get_snapshot();
+  // SQLで全路線を引くと遅いので, 20路線ごとに1路線と,
+  // 会社の境界や分岐の多い路線だけを比べる.
+  std::vector<std::pair<ares::line_id_t, std::string> > sample;
+  for(size_t i=0; i<lines.size(); i+=20) { sample.push_back(lines[i]); }
+  for(const char * name : {"東海道", "山陽", "東北新幹線", "本四備讃", "石勝2"})
+  {
+    sample.push_back(std::make_pair(sql->get_lineid(name), name));
+  }
+  for(const auto & line : sample)
+  {
+    SCOPED_TRACE(line.second);
+    ares::connect_vector expected_connect, actual_connect;
+    sql->get_connect_line(line.first, expected_connect);
+    mem->get_connect_line(line.first, actual_connect);
+    EXPECT_EQ(expected_connect, actual_connect);
+
+    std::vector<ares::CStation> expected = stations_of(line.first), actual;
+    mem->get_stations_of_line(line.first, actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for(size_t i=0; i<expected.size(); ++i)
+    {
+      EXPECT_EQ(expected[i].id, actual[i].id);
+      EXPECT_EQ(expected[i].name, actual[i].name);
+      EXPECT_EQ(expected[i].yomi, actual[i].yomi);
+      EXPECT_EQ(expected[i].denryaku, actual[i].denryaku);
+      EXPECT_EQ(expected[i].realkilo.get_hecto(),
+                actual[i].realkilo.get_hecto());
+      EXPECT_EQ(expected[i].fakekilo.get_hecto(),
+                actual[i].fakekilo.get_hecto());
+    }
+    const auto kilos = snapshot.get_kilos_of_line(line.first);
+    ASSERT_EQ(expected.size(), kilos.size());
+
+    // 駅ごとの路線は, 路線の両端と途中の駅だけ比べる.
+    if(expected.empty()) { continue; }
+    for(const size_t i : {size_t(0), expected.size() / 2, expected.size() - 1})
+    {
+      const ares::CStation & station = expected[i];
+      ares::line_vector expected_lines, actual_lines;
+      sql->get_belong_line(station.id, expected_lines);
+      mem->get_belong_line(station.id, actual_lines);
+      EXPECT_EQ(expected_lines, actual_lines);
+
+      expected_lines.clear();
+      actual_lines.clear();
+      sql->get_lines_of_station(station.id, expected_lines);
+      mem->get_lines_of_station(station.id, actual_lines);
+      std::sort(expected_lines.begin(), expected_lines.end());
+      std::sort(actual_lines.begin(), actual_lines.end());
+      EXPECT_EQ(expected_lines, actual_lines);
+    }
+  }
+  EXPECT_TRUE(snapshot.get_lines_of_station(-1).empty());
+  EXPECT_TRUE(snapshot.get_kilos_of_line(-1).empty());
+  EXPECT_TRUE(snapshot.get_junctions_of_line(-1).empty());
+  std::vector<ares::CStation> none;
+  mem->get_stations_of_line(-1, none);
+  EXPECT_TRUE(none.empty());
+}
+
+TEST_F(CNetworkSnapshotTest, WriteAndMap) {
+  const char filename[] = "test_cnetworksnapshot.bin";
+  mem->get_snapshot()->write(filename);
+  std::shared_ptr<const ares::CNetworkSnapshot> mapped(
+    new ares::CNetworkSnapshot(filename));
+  std::remove(filename);
+  ASSERT_EQ(mem->get_snapshot()->size(), mapped->size());
+  EXPECT_EQ(0, std::memcmp(mem->get_snapshot()->data(), mapped->data(),
+                           mapped->size()));
+  EXPECT_EQ(mem->get_snapshot()->kilo_size(), mapped->kilo_size());
+
+  std::shared_ptr<ares::CDatabase> db(
+    new ares::CDatabase(TEST_DB_FILENAME, mapped));
+  ASSERT_EQ(mapped.get(), db->get_snapshot());
+  ares::CRoute expected(sql), actual(db);
+  expected.append_route("東海道", "東京", "神戸");
+  actual.append_route("東海道", "東京", "神戸");
+  EXPECT_EQ(expected.calc_fare_inplace(), actual.calc_fare_inplace());
+}
+
+TEST_F(CNetworkSnapshotTest, SharedMemory) {
+  const std::string name = "/ares_test_" + std::to_string(::getpid());
+  mem->get_snapshot()->publish(name.c_str());
+  std::shared_ptr<const ares::CNetworkSnapshot> shared =
+    ares::CNetworkSnapshot::open_shared(name.c_str());
+  ASSERT_EQ(mem->get_snapshot()->size(), shared->size());
+  EXPECT_EQ(0, std::memcmp(mem->get_snapshot()->data(), shared->data(),
+                           shared->size()));
+
+  SCOPED_TRACE(L"another process attaches the same object.");
+  ares::CRoute expected(sql);
+  expected.append_route("東海道", "東京", "神戸");
+  const int fare = expected.calc_fare_inplace();
+  const pid_t pid = ::fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0)
+  {
+    int status = 1;
+    try
+    {
+      std::shared_ptr<ares::CDatabase> db(
+        new ares::CDatabase(TEST_DB_FILENAME,
+                            ares::CNetworkSnapshot::open_shared(name.c_str())));
+      ares::CRoute route(db);
+      route.append_route("東海道", "東京", "神戸");
+      status = route.calc_fare_inplace() == fare ? 0 : 2;
+    }
+    catch(...) {}
+    ::_exit(status);
+  }
+  int status = -1;
+  ASSERT_EQ(pid, ::waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  SCOPED_TRACE(L"republishing never hides the name from other processes.");
+  const pid_t reader = ::fork();
+  ASSERT_NE(-1, reader);
+  if(reader == 0)
+  {
+    int status = 0;
+    for(int i=0; i<200 && status == 0; ++i)
+    {
+      try
+      {
+        std::shared_ptr<const ares::CNetworkSnapshot> attached =
+          ares::CNetworkSnapshot::open_shared(name.c_str());
+        if(attached->size() != shared->size()) { status = 2; }
+      }
+      catch(...) { status = 1; }
+    }
+    ::_exit(status);
+  }
+  for(int i=0; i<20; ++i) { mem->get_snapshot()->publish(name.c_str()); }
+  ASSERT_EQ(reader, ::waitpid(reader, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  EXPECT_EQ(mem->get_snapshot()->kilo_size(), shared->kilo_size());
+  // 前の世代のイメージは削除され, 最後の世代だけが残る.
+  EXPECT_GT(0, ::shm_open((name + ".1").c_str(), O_RDONLY, 0));
+  const int latest = ::shm_open((name + ".21").c_str(), O_RDONLY, 0);
+  EXPECT_LE(0, latest);
+  if(latest >= 0) { ::close(latest); }
+
+  SCOPED_TRACE(L"attached image survives unpublish.");
+  ares::CNetworkSnapshot::unpublish(name.c_str());
+  EXPECT_THROW(ares::CNetworkSnapshot::open_shared(name.c_str()),
+               ares::IOException);
+  EXPECT_GT(0, ::shm_open((name + ".21").c_str(), O_RDONLY, 0));
+  EXPECT_EQ(mem->get_snapshot()->kilo_size(), shared->kilo_size());
+}
+
+TEST_F(CNetworkSnapshotTest, InvalidImage) {
+  const char filename[] = "test_cnetworksnapshot_invalid.bin";
+  const ares::CNetworkSnapshot & snapshot = *mem->get_snapshot();
+  std::string image(snapshot.data(), snapshot.size());
+  const auto write = [&](const std::string & data)
+    {
+      std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+      ofs.write(data.data(), data.size());
+    };
+
+  write(image.substr(0, image.size() / 2));
+  EXPECT_THROW(ares::CNetworkSnapshot loaded(filename),
+               ares::InvalidSnapshot);
+  std::string bad_magic(image);
+  bad_magic[0] = 'X';
+  write(bad_magic);
+  EXPECT_THROW(ares::CNetworkSnapshot loaded(filename),
+               ares::InvalidSnapshot);
+  std::string bad_version(image);
+  bad_version[8] ^= 0x7f;
+  write(bad_version);
+  EXPECT_THROW(ares::CNetworkSnapshot loaded(filename),
+               ares::InvalidSnapshot);
+  std::remove(filename);
+  EXPECT_THROW(ares::CNetworkSnapshot loaded(filename), ares::IOException);
+}
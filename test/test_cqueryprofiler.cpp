@@ -0,0 +1,100 @@
+#include <chrono>
+#include <sstream>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "sqlite3_wrapper.h"
+#include "cdatabase.h"
+#include "cqueryprofiler.h"
+#include "croute.h"
+
+#include "test_dbfilename.h"
+
+class CQueryProfilerTest : public ::testing::Test
+{
+protected:
+  std::shared_ptr<ares::CDatabase> db;
+
+  CQueryProfilerTest() : db(new ares::CDatabase(TEST_DB_FILENAME)) {}
+
+  int fare()
+  {
+    ares::CRoute route(db);
+    route.append_route("東海道", "東京", "神戸");
+    return route.calc_fare_inplace();
+  }
+};
+
+TEST_F(CQueryProfilerTest, Record) {
+  ares::CQueryProfiler profiler;
+  profiler.record("b", 2, std::chrono::nanoseconds(500));
+  profiler.record("b", 3, std::chrono::microseconds(3));
+  profiler.record("a", 0, std::chrono::seconds(100));
+  const ares::CQueryProfiler::stat_t b = profiler.get_stat("b");
+  EXPECT_EQ(2u, b.calls);
+  EXPECT_EQ(5u, b.rows);
+  EXPECT_EQ(3500, b.total_ns);
+  EXPECT_EQ(3000, b.max_ns);
+  EXPECT_EQ(1u, b.histogram[0]);
+  EXPECT_EQ(1u, b.histogram[2]);
+  const ares::CQueryProfiler::stat_t a = profiler.get_stat("a");
+  EXPECT_EQ(1u, a.histogram[ares::CQueryProfiler::NBUCKET - 1]);
+  EXPECT_EQ(0u, profiler.get_stat("c").calls);
+
+  const auto stats = profiler.get_stats();
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_EQ("a", stats[0].first);
+  EXPECT_EQ("b", stats[1].first);
+
+  std::stringstream json;
+  profiler.dump_json(json);
+  EXPECT_EQ(0u, json.str().find("{\"buckets_us\":[1,2,4,"));
+  EXPECT_NE(std::string::npos,
+            json.str().find("\"b\":{\"calls\":2,\"rows\":5,"
+                            "\"total_ns\":3500,\"max_ns\":3000,"
+                            "\"histogram\":[1,0,1,0,"));
+  std::stringstream text;
+  profiler.dump_text(text);
+  EXPECT_NE(std::string::npos, text.str().find("  us: <1:1 <4:1"));
+
+  profiler.clear();
+  EXPECT_TRUE(profiler.get_stats().empty());
+}
+
+TEST_F(CQueryProfilerTest, Database) {
+  ares::CQueryProfiler & profiler = db->get_profiler();
+  EXPECT_FALSE(profiler.is_enabled());
+  fare();
+  EXPECT_TRUE(profiler.get_stats().empty());
+  if(!ares::CQueryProfiler::is_compiled()) { return; }
+
+  profiler.set_enabled(true);
+  EXPECT_EQ(9030, fare());
+  const ares::CQueryProfiler::stat_t company =
+    profiler.get_stat("get_company_and_kilo");
+  EXPECT_EQ(1u, company.calls);
+  // 会社ごとに集計するので, 東京から神戸までの駅を1つずつは読まない.
+  EXPECT_LT(0u, company.rows);
+  EXPECT_GT(10u, company.rows);
+  EXPECT_LT(0, company.total_ns);
+  EXPECT_LT(0u, profiler.get_stat("get_range").calls);
+  EXPECT_LT(0u, profiler.get_stat("get_special_fare").calls);
+
+  profiler.set_enabled(false);
+  fare();
+  EXPECT_EQ(1u, profiler.get_stat("get_company_and_kilo").calls);
+}
+
+TEST_F(CQueryProfilerTest, Snapshot) {
+  if(!ares::CQueryProfiler::is_compiled()) { return; }
+  std::shared_ptr<ares::CDatabase> mem(
+    new ares::CDatabase(TEST_DB_FILENAME, true, true));
+  mem->get_profiler().set_enabled(true);
+  ares::CRoute route(mem);
+  route.append_route("東海道", "東京", "神戸");
+  EXPECT_EQ(9030, route.calc_fare_inplace());
+  const ares::CQueryProfiler::stat_t range =
+    mem->get_profiler().get_stat("get_range");
+  EXPECT_LT(0u, range.calls);
+  EXPECT_EQ(0u, range.rows);
+}
@@ -1,3 +1,5 @@
+#include <thread>
+#include <atomic>
 #include "gtest/gtest.h"
 
 #include "sqlite3_wrapper.h"
@@ -661,3 +663,70 @@ TEST_F(CRouteTest, FareShasenKTRHashidate)
   route.append_route(UTF8("宮津(KTR)"), UTF8("豊岡"));
   EXPECT_FARE_EQ(3200, route);
 }
+
+TEST(CRouteConcurrentTest, FareFromThreads) {
+  // 1つのCDatabaseを複数のスレッドのCRouteで共有する.
+  std::shared_ptr<ares::CDatabase> db(
+    new ares::CDatabase(TEST_DB_FILENAME, true, false, true));
+  ASSERT_TRUE(db->is_concurrent());
+  const std::vector<std::vector<const char *> > routes = {
+    { "米原", "北陸", "直江津" },
+    { "蕨", "東北", "北上" },
+    { "蕨", "東北", "東京", "東海道", "名古屋", "関西", "王寺" },
+    { "品川", "東海道", "東京", "東北", "田端" },
+  };
+  const int fares[] = { 5780, 7350, 8190, 190 };
+  std::atomic<int> mismatch(0);
+  std::vector<std::thread> threads;
+  for(int t=0; t<4; ++t)
+  {
+    threads.push_back(std::thread([&, t]()
+      {
+        for(int n=0; n<20; ++n)
+        {
+          const size_t i = (t + n) % routes.size();
+          ares::CRoute route(db, db->get_stationid(routes[i][0]));
+          for(size_t j=1; j+1<routes[i].size(); j+=2)
+          {
+            route.append_route(db->get_lineid(routes[i][j]),
+                               db->get_stationid(routes[i][j+1]));
+          }
+          if(route.calc_fare_inplace() != fares[i]) { ++mismatch; }
+        }
+      }));
+  }
+  for(std::thread & thread : threads) { thread.join(); }
+  EXPECT_EQ(0, mismatch);
+}
+
+TEST(CRouteConcurrentTest, ConnectionsOfThreads) {
+  std::shared_ptr<ares::CDatabase> db(
+    new ares::CDatabase(TEST_DB_FILENAME, true, false, true));
+  const ares::station_id_t tokyo = db->get_stationid("東京");
+  const ares::station_id_t hakata = db->get_stationid("博多");
+  EXPECT_EQ("東京", db->get_station_name(tokyo));
+  // このスレッドの接続だけ.
+  EXPECT_EQ(1u, db->count_connections());
+
+  // 終わったスレッドの接続は閉じる.
+  std::thread thread([&]()
+    {
+      EXPECT_EQ("博多", db->get_station_name(hakata));
+      EXPECT_EQ(2u, db->count_connections());
+    });
+  thread.join();
+  EXPECT_EQ(1u, db->count_connections());
+
+  // 破棄したCDatabaseの接続は使わない.
+  std::thread other([&]()
+    {
+      EXPECT_EQ("東京", db->get_station_name(tokyo));
+      db.reset(new ares::CDatabase(TEST_DB_FILENAME, true, false, true));
+      EXPECT_EQ("東京", db->get_station_name(tokyo));
+      EXPECT_EQ(1u, db->count_connections());
+    });
+  other.join();
+  EXPECT_EQ(0u, db->count_connections());
+  EXPECT_EQ("博多", db->get_station_name(hakata));
+  EXPECT_EQ(1u, db->count_connections());
+}
@@ -0,0 +1,192 @@
+#include <sstream>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "test_croutefinder.h"
+
+TEST_F(CRouteFinderTest, Shortest) {
+  ares::CRoute route = finder.find(id("新宿"), id("東京"));
+  EXPECT_EQ(std::make_pair(id("新宿"), id("東京")), terminals(route));
+  EXPECT_TRUE(route.is_valid());
+  ares::CRoute chuo(db);
+  chuo.append_route("中央東", "新宿", "神田");
+  chuo.append_route("東北", "神田", "東京");
+  EXPECT_EQ(length(chuo), length(route));
+
+  // 東海道線だけの経路より短いか同じ.
+  route = finder.find(id("東京"), id("神戸"));
+  EXPECT_EQ(std::make_pair(id("東京"), id("神戸")), terminals(route));
+  EXPECT_TRUE(route.is_valid());
+  ares::CRoute tokaido(db);
+  tokaido.append_route("東海道", "東京", "神戸");
+  EXPECT_GE(length(tokaido), length(route));
+  EXPECT_LT(0, route.calc_fare_inplace());
+}
+
+TEST_F(CRouteFinderTest, Segments) {
+  // 1つの路線で行けるなら1区間.
+  ares::CRoute route = finder.find(id("札幌"), id("函館"));
+  ASSERT_EQ(1, route.end() - route.begin());
+  EXPECT_EQ(db->get_lineid("函館"), route.begin()->line);
+
+  // 乗り換えた駅で区間が変わる.
+  route = finder.find(id("稚内"), id("鹿児島中央"));
+  EXPECT_TRUE(route.is_valid());
+  for(auto itr=route.begin(); itr + 1 != route.end(); ++itr)
+  {
+    EXPECT_EQ(itr->end, (itr + 1)->begin);
+    EXPECT_NE(itr->line, (itr + 1)->line);
+  }
+  EXPECT_LT(0, route.calc_fare_inplace());
+}
+
+TEST_F(CRouteFinderTest, Stops) {
+  const ares::CRoute route =
+    finder.find(ares::station_vector{id("東京"), id("名古屋"), id("大阪")});
+  EXPECT_EQ(std::make_pair(id("東京"), id("大阪")), terminals(route));
+  bool stopped = false;
+  for(const ares::CSegment & segment : route)
+  {
+    stopped = stopped || segment.end == id("名古屋");
+  }
+  EXPECT_TRUE(stopped);
+  EXPECT_EQ(length(finder.find(id("東京"), id("名古屋")))
+            + length(finder.find(id("名古屋"), id("大阪"))),
+            length(route));
+
+  // 同じ駅なら区間はない.
+  const ares::CRoute empty = finder.find(id("東京"), id("東京"));
+  ASSERT_EQ(1, empty.end() - empty.begin());
+  EXPECT_TRUE(empty.begin()->is_begin());
+  EXPECT_THROW(finder.find(ares::station_vector{id("東京")}),
+               std::invalid_argument);
+}
+
+TEST_F(CRouteFinderTest, NotFound) {
+  const ares::station_id_t missing = -1;
+  try
+  {
+    finder.find(ares::station_vector{id("東京"), id("名古屋"), missing});
+    FAIL() << "RouteNotFound is not thrown";
+  }
+  catch(const ares::RouteNotFound & e)
+  {
+    EXPECT_EQ(id("名古屋"), e.from);
+    EXPECT_EQ(missing, e.to);
+    EXPECT_LT(1000u, e.reached);
+    EXPECT_EQ(std::make_pair(id("東京"), id("名古屋")),
+              terminals(e.partial));
+  }
+}
+
+TEST_F(CRouteFinderTest, WithoutSnapshot) {
+  std::shared_ptr<ares::CDatabase> sql(new ares::CDatabase(TEST_DB_FILENAME));
+  const ares::CRouteFinder sql_finder(sql);
+  EXPECT_EQ(finder.size(), sql_finder.size());
+  std::stringstream expected, actual;
+  expected << finder.find(id("東京"), id("博多"));
+  actual << sql_finder.find(id("東京"), id("博多"));
+  EXPECT_EQ(expected.str(), actual.str());
+}
+
+TEST_F(CRouteFinderTest, Cheapest) {
+  // 最短の経路より高くない.
+  for(const auto & pair : {std::make_pair("東京", "神戸"),
+                           std::make_pair("東京", "博多"),
+                           std::make_pair("札幌", "旭川"),
+                           std::make_pair("新宿", "東京"),
+                           std::make_pair("札幌", "鹿児島中央")})
+  {
+    ares::CRoute shortest = finder.find(id(pair.first), id(pair.second));
+    ares::CRoute cheapest =
+      finder.find_cheapest(id(pair.first), id(pair.second));
+    EXPECT_EQ(std::make_pair(id(pair.first), id(pair.second)),
+              terminals(cheapest));
+    EXPECT_TRUE(cheapest.is_valid());
+    const int fare = cheapest.calc_fare_inplace();
+    EXPECT_LT(0, fare);
+    EXPECT_GE(shortest.calc_fare_inplace(), fare);
+  }
+
+  // 赤穂線(地方交通線)を通る最短の経路より, 新幹線の方が安い.
+  ares::CRoute shortest = finder.find(id("三原"), id("徳和"));
+  EXPECT_EQ(6830, shortest.calc_fare_inplace());
+  ares::CRoute cheapest = finder.find_cheapest(id("三原"), id("徳和"));
+  EXPECT_EQ(6620, cheapest.calc_fare_inplace());
+  EXPECT_EQ(db->get_lineid("新幹線"), cheapest.begin()->line);
+
+  // 上限に達したら, それまでの最安の経路と共に知らせる.
+  std::stringstream expected, actual;
+  expected << finder.find(id("東京"), id("神戸"));
+  try
+  {
+    finder.find_cheapest(id("東京"), id("神戸"), 0);
+    ADD_FAILURE() << "SearchTruncated is not thrown";
+  }
+  catch(const ares::SearchTruncated & e)
+  {
+    actual << e.best;
+  }
+  EXPECT_EQ(expected.str(), actual.str());
+
+  const ares::CRoute empty = finder.find_cheapest(id("東京"), id("東京"));
+  EXPECT_EQ(1, empty.end() - empty.begin());
+  EXPECT_THROW(finder.find_cheapest(id("東京"), -1), ares::RouteNotFound);
+}
+
+TEST_F(CRouteFinderTest, Alternatives) {
+  const std::vector<ares::CRouteFinder::alternative_t> routes =
+    finder.find_alternatives(id("東京"), id("大阪"), 5);
+  ASSERT_EQ(5u, routes.size());
+  EXPECT_EQ(length(finder.find(id("東京"), id("大阪"))), routes[0].hecto);
+  std::vector<std::string> printed;
+  for(size_t i=0; i<routes.size(); ++i)
+  {
+    ares::CRoute route = routes[i].route;
+    EXPECT_EQ(std::make_pair(id("東京"), id("大阪")), terminals(route));
+    EXPECT_TRUE(route.is_valid());
+    EXPECT_EQ(length(route), routes[i].hecto);
+    EXPECT_EQ(route.calc_fare_inplace(), routes[i].fare);
+    if(i > 0) { EXPECT_LE(routes[i-1].hecto, routes[i].hecto); }
+    std::stringstream ss;
+    ss << route;
+    printed.push_back(ss.str());
+  }
+  std::sort(printed.begin(), printed.end());
+  EXPECT_EQ(printed.end(), std::unique(printed.begin(), printed.end()));
+
+  // 新幹線と並行する在来線を乗り換える駅だけが違う経路は返さない.
+  const std::vector<ares::CRouteFinder::alternative_t> ten =
+    finder.find_alternatives(id("東京"), id("大阪"), 10);
+  ASSERT_EQ(10u, ten.size());
+  std::vector<ares::station_vector> passed;
+  for(const auto & alternative : ten)
+  {
+    ares::station_vector stations = finder.passed_stations(alternative.route);
+    std::sort(stations.begin(), stations.end());
+    passed.push_back(stations);
+  }
+  std::sort(passed.begin(), passed.end());
+  EXPECT_EQ(passed.end(), std::unique(passed.begin(), passed.end()));
+  ares::CRoute shinkansen(db), zairaisen(db);
+  shinkansen.append_route("新幹線", "東京", "名古屋");
+  zairaisen.append_route("東海道", "東京", "静岡");
+  zairaisen.append_route("新幹線", "静岡", "名古屋");
+  EXPECT_EQ(finder.passed_stations(shinkansen),
+            finder.passed_stations(zairaisen));
+
+  // 運賃の順でも同じ経路.
+  const std::vector<ares::CRouteFinder::alternative_t> by_fare =
+    finder.find_alternatives(id("東京"), id("大阪"), 5,
+                             ares::CRouteFinder::ORDER_FARE);
+  ASSERT_EQ(routes.size(), by_fare.size());
+  for(size_t i=1; i<by_fare.size(); ++i)
+  {
+    EXPECT_LE(by_fare[i-1].fare, by_fare[i].fare);
+  }
+
+  EXPECT_EQ(1u, finder.find_alternatives(id("東京"), id("東京"), 3).size());
+  EXPECT_TRUE(finder.find_alternatives(id("東京"), id("大阪"), 0).empty());
+  EXPECT_THROW(finder.find_alternatives(id("東京"), -1, 3),
+               ares::RouteNotFound);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include "gtest/gtest.h"
+
+#include "sqlite3_wrapper.h"
+#include "cdatabase.h"
+#include "croute.h"
+#include "croutefinder.h"
+#include "csegment.h"
+
+#include "test_dbfilename.h"
+
+//! CRouteFinderで経路を探すテスト. 目印や縮約階層のテストもこれから派生する.
+class CRouteFinderTest : public ::testing::Test
+{
+protected:
+  std::shared_ptr<ares::CDatabase> db;
+  ares::CRouteFinder finder;
+
+  CRouteFinderTest()
+    : db(new ares::CDatabase(TEST_DB_FILENAME, true, true)),
+      finder(db) {}
+
+  ares::station_id_t id(const char * name)
+  {
+    return db->get_stationid(name);
+  }
+
+  //! 経路の営業キロの10倍.
+  int length(const ares::CRoute & route)
+  {
+    int hecto = 0;
+    for(const ares::CSegment & segment : route)
+    {
+      if(segment.is_begin()) { continue; }
+      const std::pair<int, int> range =
+        db->get_range(segment.line, segment.begin, segment.end);
+      hecto += range.second - range.first;
+    }
+    return hecto;
+  }
+
+  //! 経路の発駅と着駅.
+  static std::pair<ares::station_id_t, ares::station_id_t>
+  terminals(const ares::CRoute & route)
+  {
+    return std::make_pair(route.begin()->begin, (route.end() - 1)->end);
+  }
+};
@@ -107,3 +107,23 @@ TEST_F(SQLiteBackupTest, CompletionBackup)
     ++j;
   }
 }
+
+TEST_F(SQLiteTest, StmtCacheReuse)
+{
+  db->exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, name TEXT)");
+  db->exec("INSERT INTO foo VALUES (0, 'John')");
+  db->exec("INSERT INTO foo VALUES (1, 'Tom')");
+  SQLiteStmtCache cache(*db);
+  const char * names[] = {"John", "Tom"};
+  for(int i=0; i<2; ++i)
+  {
+    SQLiteStmt & stmt = cache.get("SELECT name FROM foo WHERE id = ?");
+    stmt.bind(1, i);
+    SQLiteStmt::iterator itr = stmt.execute(), end;
+    ASSERT_NE(end, itr);
+    EXPECT_STREQ(names[i], static_cast<const char *>(itr[0]));
+  }
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(1u, cache.miss());
+  EXPECT_EQ(1u, cache.hit());
+}